@@ -43,6 +43,33 @@ class Trie
         current->isLeaf = true;
     }
 
+    void remove(const std::string& word)
+    {
+        // Unmark the word and prune nodes that no longer lead to any word
+        std::function<bool(Node*, size_t)> removeFrom = [&](Node* node, size_t depth)
+        {
+            if (depth == word.size())
+            {
+                node->isLeaf = false;
+                return node->children.empty();
+            }
+
+            auto it = node->children.find(word[depth]);
+            if (it == node->children.end())
+            {
+                return false;
+            }
+
+            if (removeFrom(it->second, depth + 1))
+            {
+                delete it->second;
+                node->children.erase(it);
+            }
+            return node != root && !node->isLeaf && node->children.empty();
+        };
+        removeFrom(root, 0);
+    }
+
     bool search(const std::string& word)
     {
         Node* current = root;
@@ -0,0 +1,106 @@
+#include "alloc_counter.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Per thread, so the background PATH indexer doesn't show up in the REPL's numbers
+static thread_local size_t allocations = 0;
+
+size_t allocation_count()
+{
+    return allocations;
+}
+
+void report_allocations(size_t count)
+{
+    std::cerr << "[alloc] " << count << std::endl;
+}
+
+static void* counted_alloc(size_t size, size_t alignment)
+{
+    allocations++;
+    if (size == 0)
+    {
+        size = 1;
+    }
+
+    void* ptr = alignment <= alignof(std::max_align_t)
+                    ? std::malloc(size)
+                    : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    return ptr;
+}
+
+void* operator new(size_t size)
+{
+    if (void* ptr = counted_alloc(size, alignof(std::max_align_t)))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    if (void* ptr = counted_alloc(size, static_cast<size_t>(alignment)))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+
+// Test hook for checking that the read-parse-dispatch loop stays off the heap. Configure with
+// -DSHELL_COUNT_ALLOCATIONS=ON to replace the global operator new with one that counts calls made
+// by the current thread; every command line then reports its allocation count on stderr.
+#ifdef SHELL_COUNT_ALLOCATIONS
+size_t allocation_count();
+void report_allocations(size_t count);
+#else
+inline size_t allocation_count()
+{
+    return 0;
+}
+
+inline void report_allocations(size_t)
+{
+}
+#endif
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+
+#include "shell_batch.h"
+#include "shell_commands.h"
+#include "shell_memo.h"
+#include "shell_placement.h"
+#include "text_builtins.h"
+
+// Properties a builtin declares about itself
+enum builtin_flags : uint8_t
+{
+    BUILTIN_NO_FLAGS = 0,
+    // Leaves shell state alone, so a pipeline can run it inside the shell instead of forking. It
+    // may still read stdin and files (cat, grep) or start commands (batch), but does its I/O only
+    // through the descriptors or streams it is handed. Any other builtin runs in a forked child
+    // when it is a pipeline stage, so a change it makes (cd, exit, set) is lost, like in sh.
+    BUILTIN_PIPELINE_SAFE = 1 << 0,
+};
+
+// Builtins either write through std::cout/std::cerr or work on raw descriptors. Descriptor
+// builtins may read stdin and run on a worker thread when they are a pipeline stage.
+using builtin_handler = int (*)(const arg_list& args);
+using builtin_fd_handler = int (*)(const arg_list& args, int in_fd, int out_fd, int err_fd);
+
+// Returned by a descriptor builtin for options it doesn't implement; the executable of the same
+// name in PATH runs instead with the same descriptors
+constexpr int BUILTIN_USE_EXTERNAL = -1;
+
+struct builtin_command
+{
+    std::string_view name;
+    builtin_handler handler;
+    uint8_t flags;
+    builtin_fd_handler fd_handler = nullptr;
+
+    constexpr bool has_flag(builtin_flags flag) const
+    {
+        return (flags & flag) != 0;
+    }
+};
+
+// Every builtin the shell knows about. Dispatch, completion and `type` all read from here.
+constexpr std::array BuiltinRegistry = {
+    builtin_command{"echo", handle_echo, BUILTIN_PIPELINE_SAFE},
+    builtin_command{"type", handle_type, BUILTIN_PIPELINE_SAFE},
+    builtin_command{"exit", handle_exit, BUILTIN_NO_FLAGS},
+    builtin_command{"pwd", handle_pwd, BUILTIN_PIPELINE_SAFE},
+    builtin_command{"cd", handle_cd, BUILTIN_NO_FLAGS},
+    builtin_command{"history", handle_history, BUILTIN_NO_FLAGS},
+    builtin_command{"enable", handle_enable, BUILTIN_NO_FLAGS},
+    builtin_command{"set", handle_set, BUILTIN_NO_FLAGS},
+    builtin_command{"ulimit", handle_ulimit, BUILTIN_NO_FLAGS},
+    builtin_command{"cpuset", handle_cpuset, BUILTIN_NO_FLAGS},
+    builtin_command{"test", handle_test, BUILTIN_PIPELINE_SAFE},
+    builtin_command{"[", handle_bracket, BUILTIN_PIPELINE_SAFE},
+    builtin_command{"true", handle_true, BUILTIN_PIPELINE_SAFE},
+    builtin_command{":", handle_true, BUILTIN_PIPELINE_SAFE},
+    builtin_command{"false", handle_false, BUILTIN_PIPELINE_SAFE},
+    builtin_command{"memo", handle_memo, BUILTIN_NO_FLAGS},
+    builtin_command{"cat", nullptr, BUILTIN_PIPELINE_SAFE, handle_cat},
+    builtin_command{"wc", nullptr, BUILTIN_PIPELINE_SAFE, handle_wc},
+    builtin_command{"head", nullptr, BUILTIN_PIPELINE_SAFE, handle_head},
+    builtin_command{"tail", nullptr, BUILTIN_PIPELINE_SAFE, handle_tail},
+    builtin_command{"grep", nullptr, BUILTIN_PIPELINE_SAFE, handle_grep},
+    builtin_command{"batch", nullptr, BUILTIN_PIPELINE_SAFE, handle_batch},
+};
+
+// Perfect hash over the registry names, generated at compile time: a seeded FNV-1a whose seed is
+// searched until every builtin lands in its own slot
+namespace builtin_hash
+{
+constexpr size_t TableSize = std::bit_ceil(BuiltinRegistry.size() * 4);
+
+constexpr uint32_t hash(std::string_view name, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ (seed * 16777619u);
+    for (char c : name)
+    {
+        h ^= static_cast<uint8_t>(c);
+        h *= 16777619u;
+    }
+    // FNV's low bits only depend on the low bits of its input, so mix the high bits down before
+    // the table index masks them off
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+constexpr uint32_t find_seed()
+{
+    for (uint32_t seed = 0; seed < 100000; seed++)
+    {
+        std::array<bool, TableSize> used{};
+        bool collision = false;
+        for (const auto& builtin : BuiltinRegistry)
+        {
+            size_t slot = hash(builtin.name, seed) & (TableSize - 1);
+            collision = collision || used[slot];
+            used[slot] = true;
+        }
+        if (!collision)
+        {
+            return seed;
+        }
+    }
+    return UINT32_MAX;
+}
+
+constexpr uint32_t Seed = find_seed();
+static_assert(Seed != UINT32_MAX, "no perfect hash seed found for the builtin registry");
+
+// Slot -> index into BuiltinRegistry, -1 for empty slots
+constexpr std::array<int8_t, TableSize> Table = []
+{
+    std::array<int8_t, TableSize> table{};
+    table.fill(-1);
+    for (size_t i = 0; i < BuiltinRegistry.size(); i++)
+    {
+        table[hash(BuiltinRegistry[i].name, Seed) & (TableSize - 1)] = static_cast<int8_t>(i);
+    }
+    return table;
+}();
+}  // namespace builtin_hash
+
+// Look up a builtin by name: one hash, one slot, one string compare
+constexpr const builtin_command* find_builtin(std::string_view name)
+{
+    int8_t index = builtin_hash::Table[builtin_hash::hash(name, builtin_hash::Seed) &
+                                       (builtin_hash::TableSize - 1)];
+    if (index < 0 || BuiltinRegistry[index].name != name)
+    {
+        return nullptr;
+    }
+    return &BuiltinRegistry[index];
+}
+
+static_assert(
+    []
+    {
+        for (const auto& builtin : BuiltinRegistry)
+        {
+            if (find_builtin(builtin.name) != &builtin)
+                return false;
+        }
+        return find_builtin("") == nullptr && find_builtin("ls") == nullptr;
+    }(),
+    "builtin perfect hash must map every name to its own entry");
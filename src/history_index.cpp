@@ -0,0 +1,226 @@
+#include "history_index.h"
+
+#include <readline/history.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Runs after which an old run counts half as much as a new one
+constexpr double HalfLife = 200.0;
+
+// A run within the current directory counts as if its weight were this many times larger
+constexpr double CwdBoost = 4.0;
+
+// log2(2^a + 2^b) without leaving the log domain
+double log2_add(double a, double b)
+{
+    double high = std::max(a, b);
+    double low = std::min(a, b);
+    return high + std::log2(1.0 + std::exp2(low - high));
+}
+}  // namespace
+
+std::string_view history_index::prefix_tree::label(const node& n,
+                                                   const history_index& index) const
+{
+    return std::string_view(index.entries_[n.label_entry]).substr(n.label_start, n.label_length);
+}
+
+uint32_t history_index::prefix_tree::find_child(const node& n, char first) const
+{
+    auto it = std::lower_bound(n.children.begin(), n.children.end(), first,
+                               [&](uint32_t child, char c) { return nodes_[child].first < c; });
+    if (it == n.children.end() || nodes_[*it].first != first)
+        return NoEntry;
+    return *it;
+}
+
+void history_index::prefix_tree::offer(node& n, uint32_t id, double score)
+{
+    // Only id's score changed, and only upwards, so it either takes over or nothing changes
+    if (n.best == NoEntry || n.best == id || score >= n.best_score)
+    {
+        n.best = id;
+        n.best_score = score;
+    }
+}
+
+void history_index::prefix_tree::add(uint32_t id, double weight, const history_index& index)
+{
+    auto [entry_score, inserted] = scores_.try_emplace(id, weight);
+    if (!inserted)
+        entry_score->second = log2_add(entry_score->second, weight);
+    double score = entry_score->second;
+
+    std::string_view text = index.entries_[id];
+    uint32_t current = 0;
+    size_t pos = 0;
+    offer(nodes_[current], id, score);
+    while (pos < text.size())
+    {
+        uint32_t child = find_child(nodes_[current], text[pos]);
+        if (child == NoEntry)
+        {
+            // The rest of the text becomes a new leaf
+            node leaf;
+            leaf.label_entry = id;
+            leaf.label_start = static_cast<uint32_t>(pos);
+            leaf.label_length = static_cast<uint32_t>(text.size() - pos);
+            leaf.best = id;
+            leaf.best_score = score;
+            leaf.first = text[pos];
+            uint32_t leaf_id = static_cast<uint32_t>(nodes_.size());
+            nodes_.push_back(std::move(leaf));
+
+            std::vector<uint32_t>& children = nodes_[current].children;
+            auto it = std::lower_bound(children.begin(), children.end(), text[pos],
+                                       [&](uint32_t other, char c)
+                                       { return nodes_[other].first < c; });
+            children.insert(it, leaf_id);
+            return;
+        }
+
+        std::string_view edge = label(nodes_[child], index);
+        auto [edge_end, text_end] = std::mismatch(edge.begin(), edge.end(), text.begin() + pos,
+                                                  text.end());
+        uint32_t common = static_cast<uint32_t>(edge_end - edge.begin());
+        if (common < edge.size())
+        {
+            // Split the edge: a new node takes the shared part and the old child hangs below it
+            node middle;
+            middle.label_entry = nodes_[child].label_entry;
+            middle.label_start = nodes_[child].label_start;
+            middle.label_length = common;
+            middle.best = nodes_[child].best;
+            middle.best_score = nodes_[child].best_score;
+            middle.first = nodes_[child].first;
+            middle.children.push_back(child);
+            nodes_[child].label_start += common;
+            nodes_[child].label_length -= common;
+            nodes_[child].first = edge[common];
+
+            uint32_t middle_id = static_cast<uint32_t>(nodes_.size());
+            nodes_.push_back(std::move(middle));
+            std::vector<uint32_t>& children = nodes_[current].children;
+            *std::find(children.begin(), children.end(), child) = middle_id;
+            child = middle_id;
+        }
+
+        current = child;
+        pos += common;
+        offer(nodes_[current], id, score);
+    }
+}
+
+uint32_t history_index::prefix_tree::best(std::string_view prefix, const history_index& index,
+                                          double& score) const
+{
+    uint32_t current = 0;
+    size_t pos = 0;
+    while (pos < prefix.size())
+    {
+        uint32_t child = find_child(nodes_[current], prefix[pos]);
+        if (child == NoEntry)
+            return NoEntry;
+        std::string_view edge = label(nodes_[child], index);
+        size_t length = std::min(edge.size(), prefix.size() - pos);
+        if (edge.substr(0, length) != prefix.substr(pos, length))
+            return NoEntry;
+        current = child;
+        pos += length;
+    }
+
+    // When the prefix is an entry of its own and the best one here, look below it for a longer one
+    const node* found = &nodes_[current];
+    if (found->best != NoEntry && index.entries_[found->best].size() == prefix.size())
+    {
+        found = nullptr;
+        for (uint32_t child : nodes_[current].children)
+        {
+            if (!found || nodes_[child].best_score > found->best_score)
+                found = &nodes_[child];
+        }
+    }
+    if (!found || found->best == NoEntry)
+        return NoEntry;
+    score = found->best_score;
+    return found->best;
+}
+
+void history_index::add(std::string_view line, std::string_view cwd)
+{
+    if (line.empty())
+        return;
+
+    auto [it, inserted] =
+        ids_.try_emplace(std::string(line), static_cast<uint32_t>(entries_.size()));
+    if (inserted)
+        entries_.emplace_back(line);
+    uint32_t id = it->second;
+
+    double weight = static_cast<double>(runs_++) / HalfLife;
+    all_.add(id, weight, *this);
+    if (!cwd.empty())
+    {
+        auto tree = by_cwd_.find(cwd);
+        if (tree == by_cwd_.end())
+            tree = by_cwd_.try_emplace(std::string(cwd)).first;
+        tree->second.add(id, weight, *this);
+    }
+}
+
+std::string_view history_index::suggest(std::string_view prefix, std::string_view cwd) const
+{
+    if (prefix.empty())
+        return {};
+
+    double score = 0;
+    uint32_t found = all_.best(prefix, *this, score);
+
+    // Score a command by the better of its runs anywhere and its boosted runs in cwd
+    auto tree = by_cwd_.find(cwd);
+    double local_score = 0;
+    uint32_t local =
+        tree == by_cwd_.end() ? NoEntry : tree->second.best(prefix, *this, local_score);
+    if (local != NoEntry && (found == NoEntry || local_score + std::log2(CwdBoost) >= score))
+        found = local;
+
+    return found == NoEntry ? std::string_view() : std::string_view(entries_[found]);
+}
+
+namespace
+{
+history_index shell_history;
+// Entries of readline's history list taken into the index so far, counted from the first ever
+int history_consumed = 0;
+
+// Take entries up to (excluding) absolute position end from the history list
+void sync_history(int end)
+{
+    // Entries that fell off a stifled list before they were seen are gone
+    history_consumed = std::max(history_consumed, history_base - 1);
+    for (; history_consumed < end; history_consumed++)
+    {
+        HIST_ENTRY* entry = history_get(history_consumed + 1);
+        if (entry && entry->line)
+            shell_history.add(entry->line, {});
+    }
+}
+}  // namespace
+
+history_index& shell_history_index()
+{
+    sync_history(history_base - 1 + history_length);
+    return shell_history;
+}
+
+void record_history_run(std::string_view line, std::string_view cwd)
+{
+    // The line itself is the last entry of the list
+    int end = history_base - 1 + history_length;
+    sync_history(end - 1);
+    shell_history.add(line, cwd);
+    history_consumed = end;
+}
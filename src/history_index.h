@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Prefix index over the deduplicated history list, used for the line editor's autosuggestions.
+// Entries are ranked by frecency: every run of a command adds 2^(t / HalfLife) to its weight,
+// where t counts the commands run so far, and the weight is kept as a base-2 logarithm. Since
+// every weight would decay by the same factor over time, the ranking between entries that aren't
+// run never changes, so each node of the radix tree can keep its subtree's best entry and a run
+// only has to update the nodes on that entry's own path. A lookup walks the prefix and reads one
+// node, independent of the size of the history.
+class history_index
+{
+   public:
+    // Add one run of line, from cwd (empty when unknown, e.g. for entries read from HISTFILE)
+    void add(std::string_view line, std::string_view cwd);
+
+    // The best entry that starts with prefix and is longer than it, preferring commands run in
+    // cwd; empty if there is none
+    std::string_view suggest(std::string_view prefix, std::string_view cwd) const;
+
+    size_t size() const
+    {
+        return entries_.size();
+    }
+
+   private:
+    static constexpr uint32_t NoEntry = UINT32_MAX;
+
+    // Radix tree over entry texts, ranked by its own scores so a per-directory tree ranks by the
+    // runs in that directory alone. Edge labels point into the entry text that created them.
+    class prefix_tree
+    {
+       public:
+        void add(uint32_t id, double weight, const history_index& index);
+        // Best entry whose text starts with prefix, and its score
+        uint32_t best(std::string_view prefix, const history_index& index, double& score) const;
+
+       private:
+        // The first label byte and the best entry's score are copied in, so a walk doesn't
+        // have to chase entry texts or scores for nodes it only passes by
+        struct node
+        {
+            uint32_t label_entry = NoEntry;
+            uint32_t label_start = 0;
+            uint32_t label_length = 0;
+            uint32_t best = NoEntry;
+            double best_score = 0;
+            char first = 0;
+            std::vector<uint32_t> children;  // Sorted by first
+        };
+
+        std::string_view label(const node& n, const history_index& index) const;
+        uint32_t find_child(const node& n, char first) const;
+        void offer(node& n, uint32_t id, double score);
+
+        std::vector<node> nodes_ = std::vector<node>(1);  // nodes_[0] is the root
+        std::unordered_map<uint32_t, double> scores_;
+    };
+
+    struct string_hash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view text) const
+        {
+            return std::hash<std::string_view>{}(text);
+        }
+    };
+
+    std::vector<std::string> entries_;
+    std::unordered_map<std::string, uint32_t, string_hash, std::equal_to<>> ids_;
+    prefix_tree all_;
+    std::unordered_map<std::string, prefix_tree, string_hash, std::equal_to<>> by_cwd_;
+    uint64_t runs_ = 0;
+};
+
+// The index fed from readline's history list. Entries added to the list since the last call
+// (HISTFILE, `history -r`) are picked up first, without a directory.
+history_index& shell_history_index();
+
+// Record a line the user just added to the history list, run from cwd
+void record_history_run(std::string_view line, std::string_view cwd);
@@ -0,0 +1,787 @@
+#include "line_editor.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <readline/history.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <vector>
+
+#include "history_index.h"
+#include "line_highlighter.h"
+#include "shell_executor.h"
+#include "user_input.h"
+
+namespace
+{
+constexpr char Escape = '\x1b';
+
+// How long to wait for the rest of an escape sequence before taking ESC as a key of its own
+constexpr int EscapeTimeoutMs = 50;
+
+size_t utf8_sequence_length(unsigned char lead)
+{
+    if (lead >= 0xf0)
+        return 4;
+    if (lead >= 0xe0)
+        return 3;
+    if (lead >= 0xc0)
+        return 2;
+    return 1;
+}
+
+bool is_continuation_byte(char c)
+{
+    return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+// One character position on screen
+struct cell
+{
+    std::array<char, 4> bytes{};
+    uint8_t size = 0;
+    uint8_t style = 0;
+
+    bool operator==(const cell&) const = default;
+};
+
+// Split text into cells, styled by styles[i] for the cell starting at byte i (plain if null)
+void append_cells(std::string_view text, const uint8_t* styles, std::vector<cell>& cells)
+{
+    for (size_t i = 0; i < text.size();)
+    {
+        size_t length = std::min(utf8_sequence_length(text[i]), text.size() - i);
+        cell c;
+        std::memcpy(c.bytes.data(), text.data() + i, length);
+        c.size = static_cast<uint8_t>(length);
+        c.style = styles ? styles[i] : static_cast<uint8_t>(HIGHLIGHT_PLAIN);
+        cells.push_back(c);
+        i += length;
+    }
+}
+
+// Number of cells text takes up
+size_t cell_count(std::string_view text)
+{
+    return std::count_if(text.begin(), text.end(), [](char c) { return !is_continuation_byte(c); });
+}
+
+int terminal_width()
+{
+    winsize size{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+        return size.ws_col;
+    return 80;
+}
+
+void write_all(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t written = write(fd, data.data(), data.size());
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        data.remove_prefix(written);
+    }
+}
+
+// Keeps a model of the cells the terminal shows and brings it to a new state with the fewest
+// cursor moves and rewritten cells, in one write()
+class screen_renderer
+{
+   public:
+    void render(const std::vector<cell>& cells, size_t cursor)
+    {
+        out_.clear();
+        int width = terminal_width();
+        if (width != width_ && !shown_.empty())
+        {
+            // The terminal reflowed the old rows; go back to the first one and redraw everything
+            move(cursor_, 0);
+            out_ += "\r\x1b[J";
+            shown_.clear();
+            cursor_ = 0;
+        }
+        width_ = width;
+
+        size_t common = 0;
+        while (common < shown_.size() && common < cells.size() && shown_[common] == cells[common])
+            common++;
+
+        if (common < cells.size() || common < shown_.size())
+        {
+            move(cursor_, common);
+            cursor_ = common;
+
+            uint8_t style = 0;
+            for (size_t i = common; i < cells.size(); i++)
+            {
+                if (cells[i].style != style)
+                {
+                    style = cells[i].style;
+                    append_style(style);
+                }
+                out_.append(cells[i].bytes.data(), cells[i].size);
+            }
+            if (style != 0)
+                append_style(0);
+            cursor_ = cells.size();
+
+            // After the last column the terminal holds the cursor in a pending-wrap state; move
+            // it to the next row for real so the position model stays exact
+            if (cursor_ > common && cursor_ % width_ == 0)
+                out_ += "\r\n";
+            if (shown_.size() > cells.size())
+                out_ += "\x1b[J";
+        }
+
+        move(cursor_, cursor);
+        cursor_ = cursor;
+        shown_ = cells;
+        flush();
+    }
+
+    // Leave the cursor on a fresh row below the line, appending extra (e.g. "^C") at its end
+    void finish(std::string_view extra = {})
+    {
+        out_.clear();
+        move(cursor_, shown_.size());
+        out_ += extra;
+        if (shown_.empty() || shown_.size() % width_ != 0 || !extra.empty())
+            out_ += "\r\n";
+        flush();
+        forget();
+    }
+
+    // Something else wrote to the terminal; assume an empty line at column 0
+    void forget()
+    {
+        shown_.clear();
+        cursor_ = 0;
+    }
+
+    void bell()
+    {
+        write_all(STDOUT_FILENO, "\a");
+    }
+
+   private:
+    void move(size_t from, size_t to)
+    {
+        size_t from_row = from / width_;
+        size_t to_row = to / width_;
+        size_t from_column = from % width_;
+        size_t to_column = to % width_;
+        if (to_row < from_row)
+            append_csi(from_row - to_row, 'A');
+        else if (to_row > from_row)
+            append_csi(to_row - from_row, 'B');
+
+        if (to_column == from_column)
+            return;
+        if (to_column == 0)
+            out_ += '\r';
+        else if (to_column < from_column)
+            append_csi(from_column - to_column, 'D');
+        else
+            append_csi(to_column - from_column, 'C');
+    }
+
+    void append_csi(size_t count, char command)
+    {
+        out_ += Escape;
+        out_ += '[';
+        out_ += std::to_string(count);
+        out_ += command;
+    }
+
+    void append_style(uint8_t style)
+    {
+        // Indexed by highlight_style
+        static constexpr std::array<std::string_view, 8> Styles = {
+            "\x1b[0m",  "\x1b[32m", "\x1b[31m", "\x1b[33m",
+            "\x1b[36m", "\x1b[35m", "\x1b[90m", "\x1b[34m",
+        };
+        out_ += Styles[style < Styles.size() ? style : 0];
+    }
+
+    void flush()
+    {
+        write_all(STDOUT_FILENO, out_);
+    }
+
+    std::vector<cell> shown_;
+    size_t cursor_ = 0;
+    int width_ = 80;
+    std::string out_;
+};
+
+// Puts the terminal in raw mode for as long as it lives
+class raw_mode
+{
+   public:
+    raw_mode()
+    {
+        if (tcgetattr(STDIN_FILENO, &original_) != 0)
+            return;
+        termios raw = original_;
+        raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+        raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+        raw.c_cflag |= CS8;
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        enabled_ = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+    }
+
+    raw_mode(const raw_mode&) = delete;
+    raw_mode& operator=(const raw_mode&) = delete;
+
+    ~raw_mode()
+    {
+        if (enabled_)
+            tcsetattr(STDIN_FILENO, TCSANOW, &original_);
+    }
+
+    bool enabled() const
+    {
+        return enabled_;
+    }
+
+   private:
+    termios original_{};
+    bool enabled_ = false;
+};
+
+// What a TAB press resolved to, computed away from the input loop
+struct completion_result
+{
+    uint64_t generation = 0;
+    size_t word_start = 0;
+    std::string word;
+    std::vector<std::string> matches;
+};
+
+// Entries of the word's directory that start with its last path component, as full words with a
+// trailing '/' on directories
+std::vector<std::string> find_matching_files(const std::string& word)
+{
+    namespace fs = std::filesystem;
+    size_t slash = word.rfind('/');
+    std::string directory = slash == std::string::npos ? "" : word.substr(0, slash + 1);
+    std::string base = slash == std::string::npos ? word : word.substr(slash + 1);
+
+    std::vector<std::string> matches;
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(directory.empty() ? "." : directory, error))
+    {
+        std::string name = entry.path().filename().string();
+        if (!name.starts_with(base) || (name.starts_with('.') && !base.starts_with('.')))
+            continue;
+        std::error_code type_error;
+        matches.push_back(directory + name + (entry.is_directory(type_error) ? "/" : ""));
+    }
+    std::sort(matches.begin(), matches.end());
+    return matches;
+}
+
+completion_result complete_word(completion_result request, bool command_position)
+{
+    if (command_position)
+    {
+        bool index_ready = executables_index_ready(IndexWaitOnCompletion);
+        request.matches = find_matching_commands(request.word, index_ready);
+    }
+    else
+    {
+        request.matches = find_matching_files(request.word);
+    }
+    return request;
+}
+
+class line_editor
+{
+   public:
+    line_editor()
+    {
+        if (pipe2(wake_fds_.data(), O_CLOEXEC | O_NONBLOCK) != 0)
+            wake_fds_ = {-1, -1};
+    }
+
+    bool read_line(std::string_view prompt, std::string& result)
+    {
+        raw_mode raw;
+        if (!raw.enabled())
+            return false;
+
+        prompt_ = prompt;
+        line_.clear();
+        point_ = 0;
+        generation_++;
+        history_index_ = history_length;
+        ambiguous_generation_ = 0;
+        std::error_code error;
+        cwd_ = std::filesystem::current_path(error).string();
+        // Builtins and plugins may have changed since the last line
+        highlighter_.reset();
+        render();
+
+        // Whether input_ ends inside a key sequence and needs more bytes first
+        bool incomplete = false;
+        while (true)
+        {
+            // Keys already read are used first, e.g. the lines after the first one of a paste
+            if (!input_.empty() && !incomplete)
+            {
+                std::string_view pending = input_;
+                action next = action::keep_editing;
+                while (!pending.empty() && next == action::keep_editing)
+                {
+                    next = handle_key(pending);
+                }
+                input_.erase(0, input_.size() - pending.size());
+                incomplete = next == action::need_more;
+                if (next == action::accept)
+                {
+                    render(false);
+                    renderer_.finish();
+                    result = std::move(line_);
+                    return true;
+                }
+                if (next == action::end_of_input)
+                {
+                    renderer_.finish();
+                    return false;
+                }
+                render();
+            }
+
+            std::array<pollfd, 2> fds = {{{STDIN_FILENO, POLLIN, 0}, {wake_fds_[0], POLLIN, 0}}};
+            // An unfinished escape sequence only gets a short grace period
+            int timeout = incomplete ? EscapeTimeoutMs : -1;
+            int ready = poll(fds.data(), wake_fds_[0] >= 0 ? 2 : 1, timeout);
+            if (ready < 0 && errno == EINTR)
+                continue;
+
+            if (ready > 0 && (fds[1].revents & POLLIN))
+                apply_completion();
+
+            if (ready == 0)
+            {
+                // A lone ESC: nothing is bound to it
+                input_.clear();
+                incomplete = false;
+                continue;
+            }
+            if (!(fds[0].revents & (POLLIN | POLLHUP)))
+                continue;
+
+            // Take everything that is already there, so a paste renders once
+            char buffer[4096];
+            ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+            {
+                renderer_.finish();
+                return false;
+            }
+            input_.append(buffer, count);
+            incomplete = false;
+        }
+    }
+
+   private:
+    enum class action
+    {
+        keep_editing,
+        need_more,
+        accept,
+        end_of_input,
+    };
+
+    // Consume one key from the front of input
+    action handle_key(std::string_view& input)
+    {
+        char c = input.front();
+        if (c == Escape)
+            return handle_escape_sequence(input);
+
+        input.remove_prefix(1);
+        switch (c)
+        {
+            case '\r':
+            case '\n':
+                return action::accept;
+            case 0x01:  // Ctrl-A
+                point_ = 0;
+                break;
+            case 0x02:  // Ctrl-B
+                move_left();
+                break;
+            case 0x03:  // Ctrl-C: drop the line and start over
+                render(false);
+                renderer_.finish("^C");
+                line_.clear();
+                point_ = 0;
+                edited();
+                break;
+            case 0x04:  // Ctrl-D: end of input on an empty line, delete otherwise
+                if (line_.empty())
+                    return action::end_of_input;
+                delete_forward();
+                break;
+            case 0x05:  // Ctrl-E
+                move_to_end();
+                break;
+            case 0x06:  // Ctrl-F
+                move_right();
+                break;
+            case 0x08:  // Ctrl-H
+            case 0x7f:  // Backspace
+                delete_backward();
+                break;
+            case '\t':
+                start_completion();
+                break;
+            case 0x0b:  // Ctrl-K
+                line_.erase(point_);
+                edited();
+                break;
+            case 0x0c:  // Ctrl-L
+                write_all(STDOUT_FILENO, "\x1b[H\x1b[2J");
+                renderer_.forget();
+                break;
+            case 0x0e:  // Ctrl-N
+                history_next();
+                break;
+            case 0x10:  // Ctrl-P
+                history_previous();
+                break;
+            case 0x15:  // Ctrl-U
+                line_.erase(0, point_);
+                point_ = 0;
+                edited();
+                break;
+            case 0x17:  // Ctrl-W: delete the word before the cursor
+            {
+                size_t start = point_;
+                while (start > 0 && line_[start - 1] == ' ')
+                    start--;
+                while (start > 0 && line_[start - 1] != ' ')
+                    start--;
+                line_.erase(start, point_ - start);
+                point_ = start;
+                edited();
+                break;
+            }
+            default:
+                if (static_cast<unsigned char>(c) >= 0x20)
+                {
+                    line_.insert(point_, 1, c);
+                    point_++;
+                    edited();
+                }
+                break;
+        }
+        return action::keep_editing;
+    }
+
+    // ESC [ ... sequences for the arrows, Home, End and Delete
+    action handle_escape_sequence(std::string_view& input)
+    {
+        if (input.size() < 2)
+            return action::need_more;
+        if (input[1] != '[' && input[1] != 'O')
+        {
+            input.remove_prefix(1);
+            return action::keep_editing;
+        }
+
+        size_t end = 2;
+        while (end < input.size() && (input[end] < 0x40 || input[end] > 0x7e))
+            end++;
+        if (end == input.size())
+            return action::need_more;
+
+        std::string_view sequence = input.substr(2, end - 2);
+        char final_byte = input[end];
+        input.remove_prefix(end + 1);
+
+        switch (final_byte)
+        {
+            case 'A':
+                history_previous();
+                break;
+            case 'B':
+                history_next();
+                break;
+            case 'C':
+                move_right();
+                break;
+            case 'D':
+                move_left();
+                break;
+            case 'H':
+                point_ = 0;
+                break;
+            case 'F':
+                move_to_end();
+                break;
+            case '~':
+                if (sequence == "1" || sequence == "7")
+                    point_ = 0;
+                else if (sequence == "4" || sequence == "8")
+                    move_to_end();
+                else if (sequence == "3")
+                    delete_forward();
+                break;
+            default:
+                break;
+        }
+        return action::keep_editing;
+    }
+
+    void move_left()
+    {
+        while (point_ > 0 && is_continuation_byte(line_[--point_]))
+        {
+        }
+    }
+
+    void move_right()
+    {
+        if (point_ < line_.size())
+            point_ += std::min(utf8_sequence_length(line_[point_]), line_.size() - point_);
+        else
+            accept_suggestion();
+    }
+
+    void move_to_end()
+    {
+        if (point_ < line_.size())
+            point_ = line_.size();
+        else
+            accept_suggestion();
+    }
+
+    // The rest of the best history entry that extends the line
+    std::string_view find_suggestion()
+    {
+        std::string_view entry = shell_history_index().suggest(line_, cwd_);
+        return entry.substr(std::min(line_.size(), entry.size()));
+    }
+
+    // Moving right at the end of the line takes the suggestion shown after it
+    void accept_suggestion()
+    {
+        std::string_view suggestion = find_suggestion();
+        if (suggestion.empty())
+            return;
+        line_.append(suggestion);
+        point_ = line_.size();
+        edited();
+    }
+
+    void delete_backward()
+    {
+        size_t end = point_;
+        move_left();
+        line_.erase(point_, end - point_);
+        edited();
+    }
+
+    void delete_forward()
+    {
+        size_t start = point_;
+        move_right();
+        line_.erase(start, point_ - start);
+        point_ = start;
+        edited();
+    }
+
+    void edited()
+    {
+        generation_++;
+    }
+
+    void history_previous()
+    {
+        if (history_index_ <= 0)
+            return;
+        if (history_index_ == history_length)
+            saved_line_ = line_;
+        history_index_--;
+        HIST_ENTRY* entry = history_get(history_base + history_index_);
+        line_ = entry ? entry->line : "";
+        point_ = line_.size();
+        edited();
+    }
+
+    void history_next()
+    {
+        if (history_index_ >= history_length)
+            return;
+        history_index_++;
+        if (history_index_ == history_length)
+        {
+            line_ = saved_line_;
+        }
+        else
+        {
+            HIST_ENTRY* entry = history_get(history_base + history_index_);
+            line_ = entry ? entry->line : "";
+        }
+        point_ = line_.size();
+        edited();
+    }
+
+    void start_completion()
+    {
+        if (completion_.valid())
+            return;
+
+        completion_result request;
+        request.generation = generation_;
+        size_t space = point_ == 0 ? std::string::npos : line_.rfind(' ', point_ - 1);
+        request.word_start = space == std::string::npos ? 0 : space + 1;
+        request.word = line_.substr(request.word_start, point_ - request.word_start);
+        bool command_position = line_.find_first_not_of(' ') >= request.word_start;
+
+        int wake_fd = wake_fds_[1];
+        worker_thread_signals signals;
+        completion_ = std::async(std::launch::async,
+                                 [request = std::move(request), command_position, wake_fd]
+                                 {
+                                     completion_result result =
+                                         complete_word(std::move(request), command_position);
+                                     (void)!write(wake_fd, "", 1);
+                                     return result;
+                                 });
+    }
+
+    void apply_completion()
+    {
+        char drain[64];
+        while (read(wake_fds_[0], drain, sizeof(drain)) > 0)
+        {
+        }
+        if (!completion_.valid())
+            return;
+
+        // The worker wakes us right before it returns, so this wait is only for its last steps
+        completion_result result = completion_.get();
+        if (result.generation != generation_)
+            return;  // The line changed while the completion ran
+
+        if (result.matches.empty())
+        {
+            renderer_.bell();
+            return;
+        }
+
+        if (result.matches.size() == 1)
+        {
+            const std::string& match = result.matches.front();
+            replace_word(result, match.ends_with('/') ? match : match + ' ');
+            return;
+        }
+
+        std::string common = longest_common_prefix(result.matches);
+        if (common.size() > result.word.size())
+        {
+            replace_word(result, common);
+            return;
+        }
+
+        // Ambiguous: the first TAB rings the bell, the second lists the candidates
+        if (ambiguous_generation_ != result.generation)
+        {
+            ambiguous_generation_ = result.generation;
+            renderer_.bell();
+            return;
+        }
+
+        std::string listing;
+        for (size_t i = 0; i < result.matches.size(); i++)
+        {
+            if (i > 0)
+                listing += "  ";
+            listing += result.matches[i];
+        }
+        listing += "\r\n";
+        renderer_.finish();
+        write_all(STDOUT_FILENO, listing);
+        render();
+    }
+
+    void replace_word(const completion_result& result, const std::string& replacement)
+    {
+        line_.replace(result.word_start, result.word.size(), replacement);
+        point_ = result.word_start + replacement.size();
+        edited();
+        render();
+    }
+
+    void render(bool suggest = true)
+    {
+        highlighter_.update(line_);
+        cells_.clear();
+        append_cells(prompt_, nullptr, cells_);
+        append_cells(line_, highlighter_.styles().data(), cells_);
+
+        // Suggest only while typing at the end of the line, the way the suggestion would extend it
+        std::string_view suggestion;
+        if (suggest && point_ == line_.size())
+            suggestion = find_suggestion();
+        ghost_styles_.assign(suggestion.size(), HIGHLIGHT_SUGGESTION);
+        append_cells(suggestion, ghost_styles_.data(), cells_);
+        size_t cursor = cell_count(prompt_) + cell_count(std::string_view(line_).substr(0, point_));
+        renderer_.render(cells_, cursor);
+    }
+
+    std::string prompt_;
+    std::string line_;
+    size_t point_ = 0;
+    // Bumped on every edit so completions computed for an older line are dropped
+    uint64_t generation_ = 0;
+    uint64_t ambiguous_generation_ = 0;
+    int history_index_ = 0;
+    std::string saved_line_;
+    std::future<completion_result> completion_;
+    // The completion thread wakes the input loop through this pipe
+    std::array<int, 2> wake_fds_ = {-1, -1};
+    std::vector<cell> cells_;
+    line_highlighter highlighter_;
+    std::string cwd_;
+    // Bytes read from the terminal but not handled yet. They outlive one line, since a paste of
+    // several lines arrives in one read.
+    std::string input_;
+    std::vector<uint8_t> ghost_styles_;
+    screen_renderer renderer_;
+};
+}  // namespace
+
+bool line_editor_supported()
+{
+    const char* term = std::getenv("TERM");
+    return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) && term &&
+           std::string_view(term) != "dumb";
+}
+
+bool edit_line(std::string_view prompt, std::string& line)
+{
+    static line_editor editor;
+    return editor.read_line(prompt, line);
+}
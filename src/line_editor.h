@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Built-in line editor, used instead of readline after `set -o lineedit`. Keys are read in raw
+// mode and every batch of input is answered with a single write() that only touches the cells of
+// the screen that changed. TAB completion runs on a worker thread, so typing never waits for it;
+// a result that arrives after the line has changed is dropped. The line is syntax highlighted
+// incrementally as it is edited (line_highlighter.h). History is shared with readline's history
+// list, so `history` and HISTFILE keep working. While the cursor is at the end of the line, the
+// best matching history entry (history_index.h) is shown dimmed after it; moving right or to the
+// end of the line takes it.
+
+// Whether the editor can drive this terminal (stdin and stdout are a tty, TERM isn't "dumb")
+bool line_editor_supported();
+
+// Read one line into line. Returns false at end of input (Ctrl-D on an empty line).
+bool edit_line(std::string_view prompt, std::string& line);
@@ -0,0 +1,273 @@
+#include "line_highlighter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <map>
+
+#include "builtin_registry.h"
+#include "shell_compiler.h"
+#include "shell_plugins.h"
+#include "shell_vm.h"
+#include "user_input.h"
+
+extern std::map<std::string, std::string> Executables;
+
+namespace
+{
+// Parameter lexing: after '$', and inside ${...}
+constexpr uint8_t ParameterNone = 0;
+constexpr uint8_t ParameterName = 1;
+constexpr uint8_t ParameterBraced = 2;
+
+// Replace vector[first, last) with replacement
+template <typename T>
+void splice(std::vector<T>& vector, size_t first, size_t last, const std::vector<T>& replacement)
+{
+    size_t common = std::min(last - first, replacement.size());
+    std::copy_n(replacement.begin(), common, vector.begin() + first);
+    if (replacement.size() > common)
+        vector.insert(vector.begin() + last, replacement.begin() + common, replacement.end());
+    else
+        vector.erase(vector.begin() + first + common, vector.begin() + last);
+}
+
+// Lengths of the common prefix and suffix, compared a block at a time with memcmp
+size_t common_prefix_length(std::string_view a, std::string_view b)
+{
+    constexpr size_t Block = 256;
+    size_t limit = std::min(a.size(), b.size());
+    size_t length = 0;
+    while (length + Block <= limit && std::memcmp(a.data() + length, b.data() + length, Block) == 0)
+        length += Block;
+    while (length < limit && a[length] == b[length])
+        length++;
+    return length;
+}
+
+size_t common_suffix_length(std::string_view a, std::string_view b)
+{
+    constexpr size_t Block = 256;
+    size_t limit = std::min(a.size(), b.size());
+    size_t length = 0;
+    while (length + Block <= limit &&
+           std::memcmp(a.data() + a.size() - length - Block, b.data() + b.size() - length - Block,
+                       Block) == 0)
+    {
+        length += Block;
+    }
+    while (length < limit && a[a.size() - 1 - length] == b[b.size() - 1 - length])
+        length++;
+    return length;
+}
+
+bool is_redirect_operator(std::string_view word)
+{
+    return word == ">" || word == "1>" || word == ">>" || word == "1>>" || word == "2>" ||
+           word == "2>>";
+}
+
+// The operators the compiler splits words at; a command follows each of them
+bool is_operator_char(char c)
+{
+    return c == ';' || c == '&' || c == '|' || c == '(' || c == ')';
+}
+
+// Whether a command follows this keyword, rather than a name (for, case, in, function) or an
+// operator (the words that close a construct)
+bool keyword_precedes_command(std::string_view keyword)
+{
+    return keyword == "if" || keyword == "then" || keyword == "elif" || keyword == "else" ||
+           keyword == "while" || keyword == "until" || keyword == "do" || keyword == "!" ||
+           keyword == "{";
+}
+}  // namespace
+
+void line_highlighter::reset()
+{
+    line_.clear();
+    states_.assign(1, lex_state{});
+    styles_.clear();
+}
+
+uint8_t line_highlighter::command_style(const std::string& word)
+{
+    // Paths would need a stat(); leave them uncoloured rather than touch the filesystem
+    if (word.empty() || word.find('/') != std::string_view::npos)
+        return HIGHLIGHT_PLAIN;
+    if (find_builtin(word) || find_plugin_builtin(word) || is_function(word))
+        return HIGHLIGHT_COMMAND;
+    if (!index_ready_)
+        return HIGHLIGHT_PLAIN;
+    return Executables.contains(word) ? HIGHLIGHT_COMMAND : HIGHLIGHT_UNKNOWN_COMMAND;
+}
+
+void line_highlighter::end_word(std::string_view line, size_t start, size_t end, lex_state& state)
+{
+    state.in_word = false;
+
+    // The word as the parser will see it, without quotes and escapes
+    word_.clear();
+    bool escaped = false;
+    for (size_t i = start; i < end; i++)
+    {
+        char c = line[i];
+        if (!escaped && c == '\\')
+            escaped = true;
+        else if (escaped || (c != '\'' && c != '"'))
+        {
+            word_ += c;
+            escaped = false;
+        }
+    }
+
+    std::string_view text = line.substr(start, end - start);
+    uint8_t style;
+    if (state.command_position && is_shell_keyword(text))
+    {
+        style = HIGHLIGHT_KEYWORD;
+        state.command_position = keyword_precedes_command(text);
+    }
+    else if (state.command_position)
+    {
+        style = command_style(word_);
+        state.command_position = false;
+    }
+    else if (is_redirect_operator(text))
+    {
+        style = HIGHLIGHT_OPERATOR;
+    }
+    else
+    {
+        return;
+    }
+    // next_styles_ holds the re-lexed bytes only; words never start before the restart point
+    std::fill(next_styles_.begin() + (start - restart_), next_styles_.begin() + (end - restart_),
+              style);
+}
+
+void line_highlighter::update(std::string_view line)
+{
+    // Words that couldn't be checked while the PATH index was loading can be now
+    bool index_ready = executables_index_ready(std::chrono::milliseconds(0));
+    if (index_ready != index_ready_ || states_.empty())
+    {
+        index_ready_ = index_ready;
+        reset();
+    }
+
+    size_t old_size = line_.size();
+    size_t prefix = common_prefix_length(line_, line);
+    if (prefix == old_size && prefix == line.size())
+        return;
+    size_t suffix = common_suffix_length(std::string_view(line_).substr(prefix),
+                                         line.substr(prefix));
+    size_t changed_end = line.size() - suffix;
+
+    // Restart at the word boundary before the change: a command word is styled as a whole
+    size_t restart = prefix;
+    while (restart > 0 && !states_[restart].at_boundary())
+        restart--;
+
+    // Only the re-lexed stretch is built separately and spliced in, so typing at the end of a
+    // long line copies nothing
+    restart_ = restart;
+    next_states_.clear();
+    next_styles_.clear();
+    lex_state state = states_[restart];
+    size_t word_start = restart;
+    size_t i = restart;
+    for (; i < line.size(); i++)
+    {
+        // Past the change, the old lexing is valid again once both agree at a word boundary
+        if (i >= changed_end && state.at_boundary() &&
+            states_[i + old_size - line.size()] == state)
+        {
+            break;
+        }
+
+        char c = line[i];
+        uint8_t style = state.quote ? HIGHLIGHT_QUOTED : HIGHLIGHT_PLAIN;
+        if (state.parameter == ParameterBraced)
+        {
+            style = HIGHLIGHT_PARAMETER;
+            if (c == '}')
+                state.parameter = ParameterNone;
+        }
+        else if (state.parameter == ParameterName &&
+                 (c == '?' || c == '{' || c == '_' || std::isalnum(static_cast<unsigned char>(c))))
+        {
+            style = HIGHLIGHT_PARAMETER;
+            state.parameter = c == '{' ? ParameterBraced : c == '?' ? ParameterNone : ParameterName;
+        }
+        else
+        {
+            state.parameter = ParameterNone;
+            if (state.escaped)
+            {
+                state.escaped = false;
+            }
+            else if (state.quote == '\'')
+            {
+                if (c == '\'')
+                    state.quote = 0;
+            }
+            else if (state.quote == '"' && c != '$')
+            {
+                if (c == '\\')
+                    state.escaped = true;
+                else if (c == '"')
+                    state.quote = 0;
+            }
+            else if (!state.quote && (c == ' ' || c == '\t' || c == '\n' || is_operator_char(c)))
+            {
+                if (state.in_word)
+                    end_word(line, word_start, i, state);
+                if (is_operator_char(c))
+                {
+                    style = HIGHLIGHT_OPERATOR;
+                    state.command_position = true;
+                }
+            }
+            else
+            {
+                if (!state.in_word && !state.quote)
+                {
+                    state.in_word = true;
+                    word_start = i;
+                }
+                if (c == '$')
+                {
+                    style = HIGHLIGHT_PARAMETER;
+                    state.parameter = ParameterName;
+                }
+                else if (c == '\'' || c == '"')
+                {
+                    state.quote = c;
+                    style = HIGHLIGHT_QUOTED;
+                }
+                else if (c == '\\')
+                {
+                    state.escaped = true;
+                }
+            }
+        }
+
+        next_styles_.push_back(style);
+        next_states_.push_back(state);
+    }
+
+    // A word still being typed at the end is styled as if it ended here
+    if (i == line.size() && state.in_word)
+    {
+        lex_state end_state = state;
+        end_word(line, word_start, line.size(), end_state);
+    }
+
+    // Old bytes [restart, i + old_size - line.size()) were replaced by the re-lexed [restart, i)
+    size_t old_end = i + old_size - line.size();
+    splice(states_, restart + 1, old_end + 1, next_states_);
+    splice(styles_, restart, old_end, next_styles_);
+    line_.replace(prefix, old_size - suffix - prefix, line.substr(prefix, changed_end - prefix));
+}
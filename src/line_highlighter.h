@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Colour classes the line editor draws a line with
+enum highlight_style : uint8_t
+{
+    HIGHLIGHT_PLAIN = 0,
+    HIGHLIGHT_COMMAND,          // command word that resolves to a builtin or indexed executable
+    HIGHLIGHT_UNKNOWN_COMMAND,  // command word that resolves to nothing
+    HIGHLIGHT_QUOTED,           // inside '...' or "..."
+    HIGHLIGHT_OPERATOR,         // | ; && || and redirections
+    HIGHLIGHT_PARAMETER,        // $? and ${...}
+    HIGHLIGHT_SUGGESTION,       // history autosuggestion shown past the end of the line
+    HIGHLIGHT_KEYWORD,          // reserved word, such as if or done, in place of a command
+};
+
+// Incremental highlighter for the line being edited. The lexer state before every byte is kept,
+// so after an edit lexing restarts at the word boundary before the change and stops as soon as
+// its state matches the old state again past the change; everything after that is shifted, not
+// re-lexed. Command words are looked up in the builtin registry, loaded plugins, shell functions
+// and the PATH index only, never on the filesystem.
+class line_highlighter
+{
+   public:
+    // Bring the styles up to date with line, whatever the edit was
+    void update(std::string_view line);
+
+    // Forget the previous line, e.g. when a new one starts or commands may have changed
+    void reset();
+
+    // One style per byte of the last line passed to update()
+    const std::vector<uint8_t>& styles() const
+    {
+        return styles_;
+    }
+
+   private:
+    struct lex_state
+    {
+        char quote = 0;
+        bool escaped = false;
+        bool in_word = false;
+        bool command_position = true;
+        uint8_t parameter = 0;
+
+        bool at_boundary() const
+        {
+            return quote == 0 && !escaped && !in_word && parameter == 0;
+        }
+
+        bool operator==(const lex_state&) const = default;
+    };
+
+    uint8_t command_style(const std::string& word);
+    void end_word(std::string_view line, size_t start, size_t end, lex_state& state);
+
+    std::string line_;
+    std::vector<lex_state> states_;  // states_[i] is the state before byte i; size() + 1 entries
+    std::vector<uint8_t> styles_;
+    // The stretch being re-lexed, starting at byte restart_
+    size_t restart_ = 0;
+    std::vector<lex_state> next_states_;
+    std::vector<uint8_t> next_styles_;
+    std::string word_;
+    bool index_ready_ = false;
+};
@@ -1,195 +1,194 @@
 #include <readline/history.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
+#include <csignal>
+#include <cstddef>
+#include <future>
 #include <iostream>
-#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 
 #include "Trie.h"
+#include "alloc_counter.h"
+#include "builtin_registry.h"
 #include "shell_commands.h"
+#include "shell_compiler.h"
 #include "shell_executor.h"
 #include "shell_parser.h"
+#include "shell_server.h"
+#include "shell_vm.h"
 #include "user_input.h"
 
-bool initialized_executables = false;
 std::map<std::string, std::string> Executables;
 Trie* trie;
+// Becomes ready once Executables and trie have been populated by the background indexer.
+// Readers must not touch either of them before that.
+std::shared_future<void> ExecutablesIndexed;
 
-void ExecuteInputCommand(const user_input& u_input)
+void IndexExecutables()
 {
-    // Handle output redirection if specified
-    std::unique_ptr<stream_redirector> stdout_redir;
-    if (u_input.has_stdout_redirect() && u_input.has_builtin_command())
+    Executables = get_all_executables_in_path();
+    trie = new Trie();
+    for (const auto& [exe_name, exe_path] : Executables)
     {
-        try
-        {
-            std::ios_base::openmode mode = u_input.stdout_append
-                                               ? (std::ios::out | std::ios::app)
-                                               : (std::ios::out | std::ios::trunc);
-
-            stdout_redir = std::make_unique<stream_redirector>(
-                std::cout, u_input.stdout_redirect_filename, mode);
-        }
-        catch (const std::exception& e)
-        {
-            std::cerr << e.what() << std::endl;
-        }
+        trie->insert(exe_name);
     }
-
-    std::unique_ptr<stream_redirector> stderr_redir;
-    if (u_input.has_stderr_redirect() && u_input.has_builtin_command())
+    for (const auto& builtin : BuiltinRegistry)
     {
-        try
-        {
-            std::ios_base::openmode mode = u_input.stderr_append
-                                               ? (std::ios::out | std::ios::app)
-                                               : (std::ios::out | std::ios::trunc);
-
-            stderr_redir = std::make_unique<stream_redirector>(
-                std::cerr, u_input.stderr_redirect_filename, mode);
-        }
-        catch (const std::exception& e)
-        {
-            std::cerr << e.what() << std::endl;
-        }
+        trie->insert(std::string(builtin.name));
     }
+}
 
-    // Handle commands
-    if (u_input.command == BUILTIN_ECHO)
-    {
-        handle_echo(u_input.args);
-    }
-    else if (u_input.command == BUILTIN_TYPE)
-    {
-        handle_type(u_input.args);
-    }
-    else if (u_input.command == BUILTIN_PWD)
+int main(int argc, char* argv[])
+{
+    // `shell -c LINES` and a script on a non-terminal stdin run in batch mode: no prompt, no
+    // history and no completion index, and the shell exits with the last command's status
+    bool server_mode = argc == 3 && std::string_view(argv[1]) == "--server";
+    bool command_string_mode = argc == 3 && std::string_view(argv[1]) == "-c";
+    bool interactive = !command_string_mode && !server_mode && isatty(STDIN_FILENO);
+    if (argc != 1 && !server_mode && !command_string_mode)
     {
-        handle_pwd();
+        std::cerr << "usage: shell [-c COMMAND | --server SOCKET]" << std::endl;
+        return 2;
     }
-    else if (u_input.command == BUILTIN_CD)
+
+    // Read from HISTFILE if set (only if it's a regular file)
+    const char* histfile = interactive || server_mode ? std::getenv("HISTFILE") : nullptr;
+    if (histfile && std::filesystem::exists(histfile) && std::filesystem::is_regular_file(histfile))
     {
-        handle_cd(u_input.args);
+        read_history(histfile);
+        // Silently ignore errors during startup history loading
     }
-    else if (u_input.command == BUILTIN_HISTORY)
+
+    if (interactive || server_mode)
     {
-        handle_history(u_input.args);
+        // Scanning PATH can take a while with many directories, so build the completion index in
+        // the background and show the prompt right away. Command execution resolves through
+        // find_in_path and never needs the index.
+        worker_thread_signals signals;
+        ExecutablesIndexed = std::async(std::launch::async, IndexExecutables).share();
     }
     else
     {
-        // Try to execute as external command
-        execute_external_command(u_input);
+        // Nothing completes in batch mode; start with an empty, ready index
+        trie = new Trie();
+        std::promise<void> indexed;
+        indexed.set_value();
+        ExecutablesIndexed = indexed.get_future().share();
     }
-}
 
-int main()
-{
-    // Read from HISTFILE if set (only if it's a regular file)
-    const char* histfile = std::getenv("HISTFILE");
-    if (histfile && std::filesystem::exists(histfile) && std::filesystem::is_regular_file(histfile))
+    // Everything parsed from one command line is carved out of this arena and dropped in one go
+    // after the line has run, so a steady-state loop over builtins never touches the heap. Lines
+    // that outgrow the buffer spill over to the default resource until the next release().
+    alignas(std::max_align_t) static std::byte line_arena_buffer[64 * 1024];
+    std::pmr::monotonic_buffer_resource line_arena(line_arena_buffer, sizeof(line_arena_buffer));
+
+    // The shell survives builtins writing into a closed pipe; spawned commands get the default
+    // disposition back
+    signal(SIGPIPE, SIG_IGN);
+
+    // `shell --server PATH`: wait for the index so every forked worker starts with it, then serve
+    // command lines until told to stop
+    if (server_mode)
     {
-        read_history(histfile);
-        // Silently ignore errors during startup history loading
+        ExecutablesIndexed.wait();
+        int status = run_server(argv[2]);
+        delete trie;
+        return status;
     }
 
-    std::string input;
-    while (true)
+    // Lines of a -c string, one per call
+    std::string_view command_string = command_string_mode ? argv[2] : "";
+    auto next_line = [&](std::string& input, const char* prompt)
     {
-        if (!initialized_executables)
+        if (interactive)
         {
-            Executables = get_all_executables_in_path();
-            trie = new Trie();
-            for (const auto& [exe_name, exe_path] : Executables)
-            {
-                trie->insert(exe_name);
-            }
-            for (const auto& builtin_cmd : BuiltinCommands)
-            {
-                trie->insert(builtin_cmd);
-            }
-
-            initialized_executables = true;
+            return GetUserInput(input, prompt);
         }
-
-        // Get user input
-        input = GetUserInput();
-
-        if (input.empty())
+        if (!command_string_mode)
         {
-            continue;
+            return GetScriptInput(STDIN_FILENO, input);
         }
-
-        if (input == BUILTIN_EXIT)
+        if (command_string.empty())
         {
-            break;
+            return false;
         }
+        size_t newline = command_string.find('\n');
+        input.assign(command_string.substr(0, newline));
+        command_string.remove_prefix(newline == std::string_view::npos ? command_string.size()
+                                                                       : newline + 1);
+        return true;
+    };
 
-        // Parse input into command and arguments
-        std::vector<user_input> u_inputs;
-        parse_pipeline_input(input, u_inputs);
-        if (u_inputs.empty())
+    std::string input;
+    int exit_status = 0;
+    int last_status = 0;
+    while (true)
+    {
+        // Get user input
+        if (!next_line(input, "$ "))
         {
-            continue;  // No command entered
+            // End of input exits with the status of the last command, like sh
+            exit_status = last_status;
+            break;
         }
 
-        if (u_inputs.size() == 1)
+        if (input.empty())
         {
-            // Single command, no pipeline
-            ExecuteInputCommand(u_inputs[0]);
             continue;
         }
 
-        int pipe_fds[u_inputs.size() - 1][2];
-        for (size_t i = 0; i < u_inputs.size() - 1; i++)
+        size_t allocations_before = allocation_count();
+        if (is_plain_pipeline(input))
         {
-            if (pipe(pipe_fds[i]) == -1)
+            // Parse input into command and arguments
+            user_input_list u_inputs(&line_arena);
+            parse_pipeline_input(input, u_inputs);
+            if (take_expansion_error())
+            {
+                int failed = 1;
+                last_status = record_pipeline_status({&failed, 1});
+            }
+            else if (!u_inputs.empty())
             {
-                std::cerr << "Error creating pipe" << std::endl;
-                return 1;
+                last_status = ExecutePipeline(u_inputs);
             }
         }
-
-        for (size_t i = 0; i < u_inputs.size(); i++)
+        else
         {
-            pid_t pid = fork();
-            if (pid == 0)
+            // Lists, control structures and functions are compiled once and run on the VM. A
+            // construct that isn't closed yet continues on the next line.
+            shell_program program;
+            compile_result result = compile_script(input, program);
+            std::string continuation;
+            while (result == compile_result::incomplete && next_line(continuation, "> "))
             {
-                // Child process
-                // Set up pipes
-                if (i > 0)
-                    dup2(pipe_fds[i - 1][0], STDIN_FILENO);
-
-                if (i < u_inputs.size() - 1)
-                    dup2(pipe_fds[i][1], STDOUT_FILENO);
-
-                // Close all pipe fds in child
-                for (size_t j = 0; j < u_inputs.size() - 1; j++)
-                {
-                    close(pipe_fds[j][0]);
-                    close(pipe_fds[j][1]);
-                }
+                input += '\n';
+                input += continuation;
+                result = compile_script(input, program);
+            }
 
-                ExecuteInputCommand(u_inputs[i]);
-                exit(0);
+            if (result == compile_result::complete)
+            {
+                last_status = run_program(program);
             }
-            else if (pid < 0)
+            else
             {
-                std::cerr << "Error forking process" << std::endl;
-                return 1;
+                if (result == compile_result::incomplete)
+                {
+                    std::cerr << "shell: syntax error: unexpected end of file" << std::endl;
+                }
+                int status = 2;
+                last_status = record_pipeline_status({&status, 1});
             }
         }
+        line_arena.release();
+        report_allocations(allocation_count() - allocations_before);
 
-        for (size_t i = 0; i < u_inputs.size() - 1; i++)
-        {
-            // Close all pipe fds in parent
-            close(pipe_fds[i][0]);
-            close(pipe_fds[i][1]);
-        }
-        // Wait for all child processes
-        for (size_t i = 0; i < u_inputs.size(); i++)
+        if (exit_requested(exit_status))
         {
-            waitpid(-1, nullptr, 0);
+            break;
         }
     }
 
@@ -199,10 +198,11 @@ int main()
         write_history(histfile);
     }
 
+    ExecutablesIndexed.wait();
     if (trie)
     {
         delete trie;
     }
 
-    return 0;
+    return exit_status;
 }
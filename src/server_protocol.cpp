@@ -0,0 +1,138 @@
+#include "server_protocol.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+
+std::string encode_server_request(const server_request& request)
+{
+    std::string message(ServerProtocolVersion);
+    message += '\0';
+    message += request.cwd;
+    message += '\0';
+    message += std::to_string(request.words.size());
+    for (const auto& word : request.words)
+    {
+        message += '\0';
+        message += word;
+    }
+    for (const auto& variable : request.environment)
+    {
+        message += '\0';
+        message += variable;
+    }
+    return message;
+}
+
+bool decode_server_request(std::string_view message, server_request& request)
+{
+    std::vector<std::string_view> fields;
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = message.find('\0', start);
+        fields.push_back(message.substr(start, end - start));
+        if (end == std::string_view::npos)
+            break;
+        start = end + 1;
+    }
+
+    if (fields.size() < 3 || fields[0] != ServerProtocolVersion)
+    {
+        return false;
+    }
+    size_t word_count = 0;
+    std::string_view count = fields[2];
+    auto [end, error] = std::from_chars(count.data(), count.data() + count.size(), word_count);
+    if (error != std::errc() || end != count.data() + count.size() || word_count == 0 ||
+        word_count > fields.size() - 3)
+    {
+        return false;
+    }
+    request.cwd = fields[1];
+    request.words.assign(fields.begin() + 3, fields.begin() + 3 + word_count);
+    request.environment.assign(fields.begin() + 3 + word_count, fields.end());
+    return true;
+}
+
+bool send_with_fds(int socket_fd, std::string_view message, const int* fds, size_t fd_count)
+{
+    iovec iov{const_cast<char*>(message.data()), message.size()};
+    msghdr header{};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+
+    std::vector<char> control;
+    if (fd_count > 0)
+    {
+        control.resize(CMSG_SPACE(fd_count * sizeof(int)));
+        header.msg_control = control.data();
+        header.msg_controllen = control.size();
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+    }
+
+    ssize_t sent;
+    while ((sent = sendmsg(socket_fd, &header, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+    {
+    }
+    return sent == static_cast<ssize_t>(message.size());
+}
+
+bool receive_with_fds(int socket_fd, std::string& message, int* fds, size_t fd_count,
+                      size_t& received_fds)
+{
+    received_fds = 0;
+
+    // Peek first so a request of any size is read whole
+    ssize_t size;
+    while ((size = recv(socket_fd, nullptr, 0, MSG_PEEK | MSG_TRUNC)) < 0 && errno == EINTR)
+    {
+    }
+    if (size <= 0)
+    {
+        return false;
+    }
+
+    message.resize(size);
+    iovec iov{message.data(), message.size()};
+    std::vector<char> control(CMSG_SPACE(fd_count * sizeof(int)));
+    msghdr header{};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control.data();
+    header.msg_controllen = control.size();
+
+    ssize_t received;
+    while ((received = recvmsg(socket_fd, &header, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+    {
+    }
+    if (received <= 0)
+    {
+        return false;
+    }
+    message.resize(received);
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* attached = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        for (size_t i = 0; i < count; i++)
+        {
+            // Keep what fits, close any extras rather than leaking them
+            if (received_fds < fd_count)
+                fds[received_fds++] = attached[i];
+            else
+                close(attached[i]);
+        }
+    }
+    return (header.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0;
+}
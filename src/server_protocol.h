@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Wire format between `shell --server` and shell-client. The socket is SOCK_SEQPACKET, so every
+// request and reply is exactly one message:
+//   request: NUL-separated fields (version, cwd, the number of words, the client's words one
+//            per field, then one VAR=value per environment entry) with the client's
+//            stdin/stdout/stderr attached as SCM_RIGHTS
+//   reply:   the command's exit status as a native-endian int32_t
+// Output never travels over the socket: the command writes straight into the client's
+// descriptors.
+
+constexpr std::string_view ServerProtocolVersion = "2";
+constexpr size_t ServerRequestFds = 3;
+
+struct server_request
+{
+    std::string cwd;
+    // `-c LINE` for a command line, otherwise a command and its arguments, taken literally
+    std::vector<std::string> words;
+    std::vector<std::string> environment;
+};
+
+std::string encode_server_request(const server_request& request);
+
+// Returns false if the message is malformed or from another protocol version
+bool decode_server_request(std::string_view message, server_request& request);
+
+// Send one message with fds attached (none if fd_count is 0). Returns false and sets errno on
+// failure.
+bool send_with_fds(int socket_fd, std::string_view message, const int* fds, size_t fd_count);
+
+// Receive one message into message, storing up to fd_count attached descriptors in fds and the
+// number received in received_fds. Returns false on EOF or error; descriptors that did arrive are
+// still reported so the caller can close them.
+bool receive_with_fds(int socket_fd, std::string& message, int* fds, size_t fd_count,
+                      size_t& received_fds);
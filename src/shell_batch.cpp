@@ -0,0 +1,206 @@
+#include "shell_batch.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "shell_executor.h"
+
+extern char** environ;
+
+namespace
+{
+// Room left under ARG_MAX for what the kernel and loader add, as xargs keeps
+constexpr size_t Headroom = 4096;
+
+// Longest single argument Linux accepts (MAX_ARG_STRLEN)
+constexpr size_t MaxArgumentLength = 32 * 4096;
+
+// Bytes a word takes of the exec limit: the string, its terminator and its pointer
+size_t exec_cost(std::string_view word)
+{
+    return word.size() + 1 + sizeof(char*);
+}
+
+// Bytes of ARG_MAX left for argv once the environment is counted
+size_t argument_budget()
+{
+    long arg_max = sysconf(_SC_ARG_MAX);
+    size_t budget = arg_max > 0 ? static_cast<size_t>(arg_max) : _POSIX_ARG_MAX;
+    size_t used = Headroom + 2 * sizeof(char*);
+    for (char** variable = environ; *variable; variable++)
+    {
+        used += exec_cost(*variable);
+    }
+    return budget > used ? budget - used : 0;
+}
+
+void report_error(int err_fd, const std::string& message)
+{
+    std::string line = "batch: " + message + "\n";
+    ssize_t written = write(err_fd, line.data(), line.size());
+    (void)written;
+}
+
+// Copy a finished run's output from its memory file to out_fd
+void copy_output(int from, int to)
+{
+    char buffer[64 * 1024];
+    off_t offset = 0;
+    while (true)
+    {
+        ssize_t n = pread(from, buffer, sizeof(buffer), offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        offset += n;
+        for (ssize_t done = 0; done < n;)
+        {
+            ssize_t written = write(to, buffer + done, n - done);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return;
+            done += written;
+        }
+    }
+}
+
+// One exec of the command, over the arguments [first, last) after the repeated ones
+struct batch_run
+{
+    size_t first;
+    size_t last;
+    pid_t pid = -1;
+    // Memory file holding its stdout when runs go in parallel
+    int output_fd = -1;
+};
+}  // namespace
+
+int handle_batch(const arg_list& args, int in_fd, int out_fd, int err_fd)
+{
+    size_t jobs = 1;
+    size_t command = 0;
+    if (!args.empty() && args[0] == "-j")
+    {
+        std::string_view count = args.size() > 1 ? std::string_view(args[1]) : "";
+        auto [end, error] = std::from_chars(count.data(), count.data() + count.size(), jobs);
+        if (count.empty() || error != std::errc() || end != count.data() + count.size())
+            command = args.size();
+        else
+            command = 2;
+        if (jobs == 0)
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // The command and its fixed arguments, up to the first `--`, start every run; the `--` itself
+    // is batch's and goes to none of them
+    std::span<const shell_string> words(args.data() + command, args.size() - command);
+    auto separator = words.empty() ? words.end() : std::find(words.begin() + 1, words.end(), "--");
+    if (separator == words.end())
+    {
+        report_error(err_fd, "usage: batch [-j N] command [arg ...] -- arg ...");
+        return 2;
+    }
+    size_t fixed = separator - words.begin();
+    size_t list = fixed + 1;
+
+    // Fill every run greedily up to the budget
+    size_t budget = argument_budget();
+    size_t fixed_cost = 0;
+    for (size_t i = 0; i < fixed; i++)
+    {
+        fixed_cost += exec_cost(words[i]);
+    }
+    std::vector<batch_run> runs;
+    size_t first = list;
+    size_t cost = fixed_cost;
+    for (size_t i = list; i < words.size(); i++)
+    {
+        size_t word_cost = exec_cost(words[i]);
+        if (words[i].size() >= MaxArgumentLength || fixed_cost + word_cost > budget)
+        {
+            report_error(err_fd, std::string(words[0]) + ": argument list too long");
+            return 1;
+        }
+        if (cost + word_cost > budget)
+        {
+            runs.push_back(batch_run{first, i});
+            first = i;
+            cost = fixed_cost;
+        }
+        cost += word_cost;
+    }
+    runs.push_back(batch_run{first, words.size()});
+
+    // Every run appends to the same stderr, so reopening it through /dev/fd mustn't truncate it
+    user_input stage;
+    stage.command = words[0];
+    if (err_fd != STDERR_FILENO)
+    {
+        std::string path = "/dev/fd/" + std::to_string(err_fd);
+        stage.stderr_redirect_filename.assign(path.data(), path.size());
+        stage.stderr_append = true;
+    }
+
+    bool parallel = jobs > 1 && runs.size() > 1;
+    auto start = [&](batch_run& run)
+    {
+        stage.args.assign(words.begin() + 1, words.begin() + fixed);
+        stage.args.insert(stage.args.end(), words.begin() + run.first, words.begin() + run.last);
+        int run_out_fd = out_fd;
+        if (parallel)
+        {
+            run.output_fd = memfd_create("batch", MFD_CLOEXEC);
+            if (run.output_fd < 0)
+            {
+                report_error(err_fd, std::strerror(errno));
+                return false;
+            }
+            run_out_fd = run.output_fd;
+        }
+        run.pid = spawn_external_command(stage, in_fd, run_out_fd);
+        return run.pid >= 0;
+    };
+
+    // Runs start in order with up to jobs of them going, and finish in order so their output
+    // does too. One that fails to start or is interrupted ends the batch once the ones already
+    // started are done.
+    foreground_signals signals;
+    int status = 0;
+    bool starting = true;
+    size_t started = 0;
+    for (size_t next = 0; next < started || (starting && next < runs.size()); next++)
+    {
+        for (; starting && started < std::min(runs.size(), next + jobs); started++)
+        {
+            starting = start(runs[started]);
+        }
+
+        batch_run& run = runs[next];
+        int run_status = 127;
+        if (run.pid >= 0)
+            wait_for_children({&run.pid, 1}, {&run_status, 1}, signals);
+        if (run.output_fd >= 0)
+        {
+            copy_output(run.output_fd, out_fd);
+            close(run.output_fd);
+        }
+
+        if (status == 0)
+            status = run_status;
+        if (run.pid < 0 || run_status == 128 + SIGINT)
+            starting = false;
+    }
+    return status;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "user_input.h"
+
+// Handle batch builtin: run a command over an argument list too long for one exec, like xargs.
+//
+//   batch [-j N] command [arg...] -- arg...
+//
+// The command and its arguments before the first `--` are repeated in every run; the arguments
+// after it are split into the fewest runs that each fit in ARG_MAX along with the environment.
+// That `--` only separates the two and is not passed on (`batch rm -- -- *` gives rm one), and
+// without it batch prints its usage. With -j N up to N runs go at once
+// (-j 0: one per core); their stdout is held in memory files and written in argument order. The
+// status is 0 if every run succeeded, otherwise the first failing run's status in that order.
+int handle_batch(const arg_list& args, int in_fd, int out_fd, int err_fd);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "user_input.h"
+
+struct builtin_command;
+
+// Compiled form of a command line or script: control flow becomes jumps over a flat instruction
+// list, and every pipeline is parsed once at compile time. The VM (shell_vm.h) runs it.
+enum class opcode : uint8_t
+{
+    RUN,                // a: command. Runs it and sets the status.
+    JUMP,               // a: target
+    JUMP_IF_FAILED,     // a: target, taken when the status is non-zero
+    JUMP_IF_SUCCEEDED,  // a: target, taken when the status is zero
+    NEGATE,             // ! PIPELINE
+    SET_STATUS,         // a: status, e.g. 0 after an if whose conditions all failed
+    LOOP_BEGIN,         // Pushes a while or until loop, whose status starts at 0
+    FOR_BEGIN,          // a: loop. Expands its word list and pushes it as a loop.
+    FOR_NEXT,           // a: loop, b: target after the last item. Assigns the next item.
+    LOOP_STATUS,        // Keeps the status as the innermost loop's, after its body or continue
+    LOOP_END,           // Pops the innermost loop and sets the status it kept
+    CASE_BEGIN,         // a: word. Expands it and pushes it as the case subject.
+    CASE_MATCH,         // a: case item, b: target when none of its patterns match the subject
+    CASE_END,           // Pops the innermost case subject
+    DEFINE_FUNCTION,    // a: function
+    RETURN,             // a: word with the status, or NoOperand to keep the current one
+    NOT_IN_LOOP,        // a: 0 for break, 1 for continue. Reports it outside any loop; status 0.
+};
+
+constexpr uint32_t NoOperand = UINT32_MAX;
+
+struct instruction
+{
+    opcode op;
+    uint32_t a = NoOperand;
+    uint32_t b = NoOperand;
+};
+
+// One pipeline, with any NAME=VALUE words before it
+struct compiled_command
+{
+    // Source text of the pipeline without the assignments; empty for a pure assignment
+    std::string text;
+    // NAME and raw (unexpanded) VALUE of each leading assignment
+    std::vector<std::pair<std::string, std::string>> assignments;
+    // Whether the text has expansions and must be parsed again on every run
+    bool dynamic = false;
+    // The parsed stages when the text is static
+    user_input_list stages;
+    // Builtin the command word resolves to, when it is static and has a std::cout handler
+    const builtin_command* builtin = nullptr;
+};
+
+struct for_loop
+{
+    std::string variable;
+    std::vector<std::string> words;  // Raw, expanded on every FOR_BEGIN
+};
+
+struct case_item
+{
+    std::vector<std::string> patterns;  // Raw, expanded when matched
+};
+
+struct shell_program;
+
+struct function_definition
+{
+    std::string name;
+    std::shared_ptr<const shell_program> body;
+};
+
+struct shell_program
+{
+    std::vector<instruction> code;
+    std::vector<compiled_command> commands;
+    std::vector<for_loop> loops;
+    std::vector<case_item> case_items;
+    std::vector<std::string> words;
+    std::vector<function_definition> functions;
+};
@@ -0,0 +1,93 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "server_protocol.h"
+
+extern char** environ;
+
+// shell-client SOCKET COMMAND [ARG...]
+// shell-client SOCKET -c LINE
+// Run a command with exactly these arguments, or a command line, in a `shell --server SOCKET`
+// instance run by the same user. The server runs it in this process's cwd and environment,
+// reading and writing this process's stdin/stdout/stderr, and the client exits with the
+// command's status.
+int main(int argc, char* argv[])
+{
+    if (argc < 3 || (std::string_view(argv[2]) == "-c" && argc != 4))
+    {
+        std::cerr << "usage: shell-client SOCKET COMMAND [ARG...] | shell-client SOCKET -c LINE"
+                  << std::endl;
+        return 2;
+    }
+
+    server_request request;
+    std::error_code error;
+    request.cwd = std::filesystem::current_path(error).string();
+    request.words.assign(argv + 2, argv + argc);
+    for (char** variable = environ; *variable; variable++)
+    {
+        request.environment.emplace_back(*variable);
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::string socket_path = argv[1];
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "shell-client: " << socket_path << ": socket path too long" << std::endl;
+        return 2;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int socket_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0 ||
+        connect(socket_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        std::cerr << "shell-client: " << socket_path << ": " << std::strerror(errno) << std::endl;
+        return 126;
+    }
+
+    // The request carries the environment, so it only goes to a server of the same user
+    ucred peer{};
+    socklen_t peer_size = sizeof(peer);
+    if (getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) != 0 ||
+        peer.uid != geteuid())
+    {
+        std::cerr << "shell-client: " << socket_path << ": server belongs to another user"
+                  << std::endl;
+        return 126;
+    }
+
+    // A request is a single message, so the send buffer must hold all of it
+    std::string message = encode_server_request(request);
+    int buffer_size = static_cast<int>(message.size() + 4096);
+    setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+    const int fds[ServerRequestFds] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    if (!send_with_fds(socket_fd, message, fds, ServerRequestFds))
+    {
+        std::cerr << "shell-client: " << std::strerror(errno) << std::endl;
+        return 126;
+    }
+
+    std::string reply;
+    size_t received_fds = 0;
+    int32_t status = 0;
+    if (!receive_with_fds(socket_fd, reply, nullptr, 0, received_fds) ||
+        reply.size() != sizeof(status))
+    {
+        std::cerr << "shell-client: server closed the connection" << std::endl;
+        return 126;
+    }
+    std::memcpy(&status, reply.data(), sizeof(status));
+    return status;
+}
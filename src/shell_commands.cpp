@@ -1,43 +1,58 @@
 #include "shell_commands.h"
 
 #include <readline/history.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <cstdlib>
 #include <filesystem>
+#include <future>
 #include <iostream>
 #include <map>
 #include <sstream>
 
+#include "Trie.h"
+#include "builtin_registry.h"
+#include "shell_plugins.h"
+#include "shell_vm.h"
 #include "user_input.h"
 
 namespace fs = std::filesystem;
 
+extern std::map<std::string, std::string> Executables;
+extern Trie* trie;
+extern std::shared_future<void> ExecutablesIndexed;
+
 // Track entries appended for each file to avoid duplicates
 static std::map<std::string, int> appended_counts;
 
-void handle_echo(const std::vector<std::string>& args)
+int handle_echo(const arg_list& args)
 {
     for (size_t i = 0; i < args.size(); ++i)
     {
         std::cout << args[i] << (i < args.size() - 1 ? " " : "");
     }
     std::cout << std::endl;
+    return 0;
 }
 
-void handle_pwd()
+int handle_pwd(const arg_list&)
 {
     std::cout << fs::current_path().string() << std::endl;
+    return 0;
 }
 
-void handle_cd(const std::vector<std::string>& args)
+int handle_cd(const arg_list& args)
 {
     if (args.size() != 1)
     {
         std::cerr << "cd: wrong number of arguments" << std::endl;
-        return;
+        return 1;
     }
 
-    std::string directory = args[0];
+    std::string directory(args[0]);
     const std::string original_arg = directory;  // Keep original for error messages
 
     // Handle ~ character (home directory)
@@ -47,7 +62,7 @@ void handle_cd(const std::vector<std::string>& args)
         if (home == nullptr)
         {
             std::cerr << "cd: HOME not set" << std::endl;
-            return;
+            return 1;
         }
         // Replace ~ with HOME directory
         directory = std::string(home) + directory.substr(1);
@@ -57,7 +72,7 @@ void handle_cd(const std::vector<std::string>& args)
     if (!fs::exists(directory) || !fs::is_directory(directory))
     {
         std::cerr << "cd: " << original_arg << ": No such file or directory" << std::endl;
-        return;
+        return 1;
     }
 
     // Change directory
@@ -68,43 +83,52 @@ void handle_cd(const std::vector<std::string>& args)
     catch (const std::exception&)
     {
         std::cerr << "cd: " << original_arg << ": No such file or directory" << std::endl;
+        return 1;
     }
+    return 0;
 }
 
-void handle_type(const std::vector<std::string>& args)
+int handle_type(const arg_list& args)
 {
     if (args.size() != 1)
     {
         std::cerr << "type: invalid number of arguments" << std::endl;
-        return;
+        return 1;
     }
 
-    const std::string& cmd = args[0];
+    const std::string_view cmd = args[0];
+
+    if (is_function(cmd))
+    {
+        std::cout << cmd << " is a function" << std::endl;
+        return 0;
+    }
 
     // Check if it's a builtin
-    if (BuiltinCommands.contains(cmd))
+    if (find_builtin(cmd) || find_plugin_builtin(cmd))
     {
         std::cout << cmd << " is a shell builtin" << std::endl;
-        return;
+        return 0;
     }
 
     // Search for executable in PATH
     std::string full_path;
     // Forward declare find_in_path to use it here
-    extern bool find_in_path(const std::string& cmd, std::string& full_path);
+    extern bool find_in_path(std::string_view cmd, std::string& full_path);
 
     if (find_in_path(cmd, full_path))
     {
         std::cout << cmd << " is " << full_path << std::endl;
+        return 0;
     }
-    else
-    {
-        std::cerr << cmd << ": not found" << std::endl;
-    }
+
+    std::cerr << cmd << ": not found" << std::endl;
+    return 1;
 }
 
-void handle_history(const std::vector<std::string>& args)
+int handle_history(const arg_list& args)
 {
+    int status = 0;
     if (args.size() == 0)
     {
         HIST_ENTRY** historyList = history_list();
@@ -120,11 +144,11 @@ void handle_history(const std::vector<std::string>& args)
     {
         try
         {
-            int num_lines = std::stoi(args[0]);
+            int num_lines = std::stoi(std::string(args[0]));
             if (num_lines < 0)
             {
                 std::cerr << "history: invalid number of lines: " << args[0] << std::endl;
-                return;
+                return 1;
             }
 
             HIST_ENTRY** historyList = history_list();
@@ -141,58 +165,387 @@ void handle_history(const std::vector<std::string>& args)
         catch (const std::invalid_argument&)
         {
             std::cerr << "history: invalid argument: " << args[0] << std::endl;
+            status = 1;
         }
         catch (const std::out_of_range&)
         {
             std::cerr << "history: argument out of range: " << args[0] << std::endl;
+            status = 1;
         }
     }
     else if (args.size() == 2)
     {
+        const std::string filename(args[1]);
         if (args[0] == "-r")  // Read history from file
         {
-            int result = read_history(args[1].c_str());
+            int result = read_history(filename.c_str());
             if (result != 0)
             {
                 std::cerr << "history: error reading history from " << args[1] << std::endl;
+                status = 1;
             }
-            appended_counts[args[1]] = where_history() + 1;
+            appended_counts[filename] = where_history() + 1;
         }
         else if (args[0] == "-w")  // Write history to file
         {
-            int result = write_history(args[1].c_str());
+            int result = write_history(filename.c_str());
             if (result != 0)
             {
                 std::cerr << "history: error writing history to " << args[1] << std::endl;
+                status = 1;
             }
-            appended_counts[args[1]] = where_history() + 1;
+            appended_counts[filename] = where_history() + 1;
         }
         else if (args[0] == "-a")  // Append history to file
         {
             int total_entries = where_history() + 1;
-            int last_appended = appended_counts[args[1]];
+            int last_appended = appended_counts[filename];
             int to_append = total_entries - last_appended;
 
             if (to_append > 0)  // Only append if there are new entries
             {
-                int result = append_history(to_append, args[1].c_str());
+                int result = append_history(to_append, filename.c_str());
                 if (result != 0)
                 {
                     std::cerr << "history: error appending history to " << args[1] << std::endl;
+                    status = 1;
                 }
                 else
                 {
-                    appended_counts[args[1]] = total_entries;
+                    appended_counts[filename] = total_entries;
                 }
             }
         }
         else
         {
             std::cerr << "history: invalid option: " << args[0] << std::endl;
+            status = 1;
         }
     }
     else
     {
         std::cerr << "history: too many arguments" << std::endl;
+        status = 1;
+    }
+    return status;
+}
+
+int handle_enable(const arg_list& args)
+{
+    if (args.empty())
+    {
+        for (const auto& builtin : BuiltinRegistry)
+        {
+            std::cout << "enable " << builtin.name << std::endl;
+        }
+        for (const auto& [name, plugin] : plugin_builtins())
+        {
+            std::cout << "enable -f " << plugin.path << " " << name << std::endl;
+        }
+        return 0;
+    }
+
+    bool load = args[0] == "-f";
+    bool unload = args[0] == "-d";
+    size_t first_name = load ? 2 : 1;
+    if ((!load && !unload) || args.size() <= first_name)
+    {
+        std::cerr << "enable: usage: enable [-f filename name ...] [-d name ...]" << std::endl;
+        return 2;
+    }
+
+    // Completion must see plugin names too; the Trie only exists once indexing is done
+    ExecutablesIndexed.wait();
+
+    int status = 0;
+    for (size_t i = first_name; i < args.size(); i++)
+    {
+        std::string name(args[i]);
+        if (load)
+        {
+            std::string error;
+            if (find_builtin(name))
+            {
+                std::cerr << "enable: " << name << ": cannot replace a shell builtin" << std::endl;
+                status = 1;
+            }
+            else if (!load_plugin_builtin(std::string(args[1]), name, error))
+            {
+                std::cerr << "enable: " << error << std::endl;
+                status = 1;
+            }
+            else
+            {
+                trie->insert(name);
+            }
+        }
+        else if (!unload_plugin_builtin(name))
+        {
+            std::cerr << "enable: " << name << ": not a dynamically loaded builtin" << std::endl;
+            status = 1;
+        }
+        else if (!Executables.contains(name))
+        {
+            trie->remove(name);
+        }
+    }
+    return status;
+}
+
+// Evaluate a test expression of up to four words, the way POSIX test does by word count.
+// Returns 0 (true), 1 (false) or 2 (error, after printing it).
+static int evaluate_test(std::span<const shell_string> args)
+{
+    auto integer = [](const shell_string& word, long long& value)
+    {
+        auto [end, error] = std::from_chars(word.data(), word.data() + word.size(), value);
+        if (error != std::errc() || end != word.data() + word.size())
+        {
+            std::cerr << "test: " << word << ": integer expression expected" << std::endl;
+            return false;
+        }
+        return true;
+    };
+
+    switch (args.size())
+    {
+        case 0:
+            return 1;
+        case 1:
+            return args[0].empty() ? 1 : 0;
+        case 2:
+        {
+            if (args[0] == "!")
+                return evaluate_test(args.subspan(1)) == 0 ? 1 : 0;
+
+            const shell_string& op = args[0];
+            const shell_string& operand = args[1];
+            if (op == "-n")
+                return operand.empty() ? 1 : 0;
+            if (op == "-z")
+                return operand.empty() ? 0 : 1;
+
+            std::error_code error;
+            fs::file_status status = op == "-L" ? fs::symlink_status(operand.c_str(), error)
+                                                : fs::status(operand.c_str(), error);
+            if (op == "-e")
+                return fs::exists(status) ? 0 : 1;
+            if (op == "-f")
+                return fs::is_regular_file(status) ? 0 : 1;
+            if (op == "-d")
+                return fs::is_directory(status) ? 0 : 1;
+            if (op == "-L" || op == "-h")
+                return fs::is_symlink(status) ? 0 : 1;
+            if (op == "-s")
+                return fs::is_regular_file(status) && fs::file_size(operand.c_str(), error) > 0
+                           ? 0
+                           : 1;
+            if (op == "-r" || op == "-w" || op == "-x")
+            {
+                int mode = op == "-r" ? R_OK : op == "-w" ? W_OK : X_OK;
+                return access(operand.c_str(), mode) == 0 ? 0 : 1;
+            }
+            std::cerr << "test: " << op << ": unary operator expected" << std::endl;
+            return 2;
+        }
+        case 3:
+        {
+            const shell_string& op = args[1];
+            if (op == "=" || op == "==")
+                return args[0] == args[2] ? 0 : 1;
+            if (op == "!=")
+                return args[0] != args[2] ? 0 : 1;
+
+            static constexpr std::array<std::string_view, 6> IntegerOps = {"-eq", "-ne", "-lt",
+                                                                           "-le", "-gt", "-ge"};
+            auto integer_op = std::find(IntegerOps.begin(), IntegerOps.end(), op);
+            if (integer_op != IntegerOps.end())
+            {
+                long long left = 0;
+                long long right = 0;
+                if (!integer(args[0], left) || !integer(args[2], right))
+                    return 2;
+                bool result[] = {left == right, left != right, left < right,
+                                 left <= right, left > right,  left >= right};
+                return result[integer_op - IntegerOps.begin()] ? 0 : 1;
+            }
+
+            if (args[0] == "!")
+                return evaluate_test(args.subspan(1)) == 0 ? 1 : 0;
+            if (args[0] == "(" && args[2] == ")")
+                return evaluate_test(args.subspan(1, 1));
+            std::cerr << "test: " << op << ": binary operator expected" << std::endl;
+            return 2;
+        }
+        case 4:
+            if (args[0] == "!")
+            {
+                int status = evaluate_test(args.subspan(1));
+                return status == 2 ? 2 : status == 0 ? 1 : 0;
+            }
+            [[fallthrough]];
+        default:
+            std::cerr << "test: too many arguments" << std::endl;
+            return 2;
+    }
+}
+
+int handle_test(const arg_list& args)
+{
+    return evaluate_test(args);
+}
+
+int handle_bracket(const arg_list& args)
+{
+    if (args.empty() || args.back() != "]")
+    {
+        std::cerr << "[: missing `]'" << std::endl;
+        return 2;
+    }
+    return evaluate_test(std::span(args).first(args.size() - 1));
+}
+
+int handle_true(const arg_list&)
+{
+    return 0;
+}
+
+int handle_false(const arg_list&)
+{
+    return 1;
+}
+
+static bool exit_called = false;
+static int exit_status = 0;
+
+int handle_exit(const arg_list& args)
+{
+    if (args.size() > 1)
+    {
+        std::cerr << "exit: too many arguments" << std::endl;
+        return 1;
+    }
+
+    exit_status = last_exit_status();
+    if (args.size() == 1)
+    {
+        try
+        {
+            exit_status = std::stoi(std::string(args[0])) & 0xff;
+        }
+        catch (const std::exception&)
+        {
+            std::cerr << "exit: " << args[0] << ": numeric argument required" << std::endl;
+            exit_status = 2;
+        }
+    }
+
+    exit_called = true;
+    return exit_status;
+}
+
+bool exit_requested(int& status)
+{
+    status = exit_status;
+    return exit_called;
+}
+
+struct shell_option
+{
+    std::string_view name;
+    bool enabled;
+};
+
+static std::array shell_options = {
+    // A pipeline fails with its last failing stage instead of only its last stage
+    shell_option{"pipefail", false},
+    // Read lines with the built-in editor (line_editor.h) instead of readline
+    shell_option{"lineedit", false},
+    // Compress output redirected to a .gz file in the shell (shell_compression.h)
+    shell_option{"gzip", false},
+};
+
+int handle_set(const arg_list& args)
+{
+    if (args.empty() || (args[0] != "-o" && args[0] != "+o"))
+    {
+        if (!args.empty())
+        {
+            std::cerr << "set: " << args[0] << ": invalid option" << std::endl;
+            return 2;
+        }
+        return 0;
     }
+
+    bool enable = args[0] == "-o";
+    if (args.size() == 1)
+    {
+        // Same layouts as bash: a table for -o, re-runnable commands for +o
+        for (const auto& option : shell_options)
+        {
+            if (enable)
+            {
+                std::cout << option.name << std::string(15 - option.name.size(), ' ') << '\t'
+                          << (option.enabled ? "on" : "off") << std::endl;
+            }
+            else
+            {
+                std::cout << "set " << (option.enabled ? "-o " : "+o ") << option.name
+                          << std::endl;
+            }
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        auto option = std::find_if(shell_options.begin(), shell_options.end(),
+                                   [&](const shell_option& o) { return o.name == args[i]; });
+        if (option == shell_options.end())
+        {
+            std::cerr << "set: " << args[i] << ": invalid option name" << std::endl;
+            status = 1;
+            continue;
+        }
+        option->enabled = enable;
+    }
+    return status;
+}
+
+bool shell_option_enabled(std::string_view name)
+{
+    for (const auto& option : shell_options)
+    {
+        if (option.name == name)
+            return option.enabled;
+    }
+    return false;
+}
+
+static std::vector<int> last_pipeline_statuses = {0};
+static int last_status = 0;
+
+int record_pipeline_status(std::span<const int> statuses)
+{
+    // assign() reuses the vector's capacity, so a steady stream of commands doesn't allocate
+    last_pipeline_statuses.assign(statuses.begin(), statuses.end());
+    last_status = statuses.back();
+    if (shell_option_enabled("pipefail"))
+    {
+        auto failed = std::find_if(statuses.rbegin(), statuses.rend(),
+                                   [](int status) { return status != 0; });
+        last_status = failed == statuses.rend() ? 0 : *failed;
+    }
+    return last_status;
+}
+
+int last_exit_status()
+{
+    return last_status;
+}
+
+const std::vector<int>& pipeline_statuses()
+{
+    return last_pipeline_statuses;
 }
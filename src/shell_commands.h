@@ -1,19 +1,58 @@
 #pragma once
 
-#include <string>
+#include <span>
+#include <string_view>
 #include <vector>
 
+#include "user_input.h"
+
+// Builtin handlers return the command's exit status
+
 // Handle echo builtin
-void handle_echo(const std::vector<std::string>& args);
+int handle_echo(const arg_list& args);
 
 // Handle pwd builtin
-void handle_pwd();
+int handle_pwd(const arg_list& args);
 
 // Handle cd builtin
-void handle_cd(const std::vector<std::string>& args);
+int handle_cd(const arg_list& args);
 
 // Handle type builtin
-void handle_type(const std::vector<std::string>& args);
+int handle_type(const arg_list& args);
 
 // Handle history builtin
-void handle_history(const std::vector<std::string>& args);
+int handle_history(const arg_list& args);
+
+// Handle enable builtin: load (-f) or unload (-d) plugin builtins, or list builtins
+int handle_enable(const arg_list& args);
+
+// Handle test and [ builtins: string, integer and file tests of up to four words
+int handle_test(const arg_list& args);
+int handle_bracket(const arg_list& args);
+
+// Handle true (and :) and false builtins
+int handle_true(const arg_list& args);
+int handle_false(const arg_list& args);
+
+// Handle exit builtin. Only records the request; the REPL stops once the current line is done.
+// Without an argument the shell exits with $?.
+int handle_exit(const arg_list& args);
+
+// Whether exit has been called, and with which status
+bool exit_requested(int& status);
+
+// Handle set builtin: `set -o NAME` / `set +o NAME` toggle an option, `set -o` / `set +o` list them
+int handle_set(const arg_list& args);
+
+// Whether the named `set -o` option is on
+bool shell_option_enabled(std::string_view name);
+
+// Record the stage statuses of the pipeline that just ran, for $? and PIPESTATUS. Returns the
+// pipeline's status: its last stage's, or with pipefail the last non-zero one.
+int record_pipeline_status(std::span<const int> statuses);
+
+// Status of the last pipeline ($?)
+int last_exit_status();
+
+// Status of every stage of the last pipeline (PIPESTATUS)
+const std::vector<int>& pipeline_statuses();
@@ -0,0 +1,764 @@
+#include "shell_compiler.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+
+#include "builtin_registry.h"
+#include "shell_parser.h"
+#include "shell_variables.h"
+#include "shell_vm.h"
+
+namespace
+{
+constexpr std::array<std::string_view, 17> ReservedWords = {
+    "if", "then", "elif", "else", "fi", "while", "until", "do", "done",
+    "for", "in", "case", "esac", "function", "!", "{", "}",
+};
+
+// Commands the compiler turns into jumps rather than running
+constexpr std::array<std::string_view, 3> CompiledCommands = {"break", "continue", "return"};
+
+enum class token_kind
+{
+    word,
+    newline,
+    semicolon,
+    double_semicolon,
+    and_if,
+    or_if,
+    pipe,
+    ampersand,
+    left_paren,
+    right_paren,
+    end,
+};
+
+struct token
+{
+    token_kind kind;
+    std::string_view text;
+};
+
+// Thrown to abandon compilation; incomplete means the input ran out rather than being wrong
+struct syntax_error
+{
+    bool incomplete;
+    std::string message;
+};
+
+bool is_operator_char(char c)
+{
+    return c == ';' || c == '&' || c == '|' || c == '(' || c == ')';
+}
+
+// Split source into words and operators. Words keep their quotes and expansions, which are
+// resolved when the word is used; the lexer only needs to know where each word ends.
+std::vector<token> tokenize(std::string_view source)
+{
+    std::vector<token> tokens;
+    size_t pos = 0;
+    auto unterminated = [](const char* what)
+    { throw syntax_error{true, std::string("unterminated ") + what}; };
+
+    while (pos < source.size())
+    {
+        char c = source[pos];
+        if (c == ' ' || c == '\t')
+        {
+            pos++;
+            continue;
+        }
+        if (c == '#')
+        {
+            while (pos < source.size() && source[pos] != '\n')
+                pos++;
+            continue;
+        }
+
+        auto add = [&](token_kind kind, size_t length)
+        {
+            tokens.push_back({kind, source.substr(pos, length)});
+            pos += length;
+        };
+        char next = pos + 1 < source.size() ? source[pos + 1] : 0;
+        switch (c)
+        {
+            case '\n':
+                add(token_kind::newline, 1);
+                continue;
+            case ';':
+                next == ';' ? add(token_kind::double_semicolon, 2) : add(token_kind::semicolon, 1);
+                continue;
+            case '&':
+                next == '&' ? add(token_kind::and_if, 2) : add(token_kind::ampersand, 1);
+                continue;
+            case '|':
+                next == '|' ? add(token_kind::or_if, 2) : add(token_kind::pipe, 1);
+                continue;
+            case '(':
+                add(token_kind::left_paren, 1);
+                continue;
+            case ')':
+                add(token_kind::right_paren, 1);
+                continue;
+            default:
+                break;
+        }
+
+        size_t start = pos;
+        while (pos < source.size())
+        {
+            c = source[pos];
+            if (c == ' ' || c == '\t' || c == '\n' || is_operator_char(c))
+                break;
+
+            if (c == '\\')
+            {
+                if (pos + 1 == source.size())
+                    unterminated("line");
+                pos += 2;
+            }
+            else if (c == '\'')
+            {
+                size_t close = source.find('\'', pos + 1);
+                if (close == std::string_view::npos)
+                    unterminated("quote");
+                pos = close + 1;
+            }
+            else if (c == '"')
+            {
+                pos++;
+                while (pos < source.size() && source[pos] != '"')
+                    pos += source[pos] == '\\' ? 2 : 1;
+                if (pos >= source.size())
+                    unterminated("quote");
+                pos++;
+            }
+            else if ((c == '$' || c == '<' || c == '>') && pos + 1 < source.size() &&
+                     (source[pos + 1] == '(' || (c == '$' && source[pos + 1] == '{')))
+            {
+                // $(...), $((...)), ${...}, <(...) and >(...) may hold spaces and operators of
+                // their own
+                char open = source[pos + 1];
+                char close = open == '(' ? ')' : '}';
+                size_t depth = 0;
+                pos++;
+                do
+                {
+                    depth += source[pos] == open;
+                    depth -= source[pos] == close;
+                    pos++;
+                } while (depth > 0 && pos < source.size());
+                if (depth > 0)
+                    unterminated("expansion");
+            }
+            else
+            {
+                pos++;
+            }
+        }
+        tokens.push_back({token_kind::word, source.substr(start, pos - start)});
+    }
+
+    tokens.push_back({token_kind::end, {}});
+    return tokens;
+}
+
+bool is_reserved_word(std::string_view word)
+{
+    return std::find(ReservedWords.begin(), ReservedWords.end(), word) != ReservedWords.end();
+}
+
+// Recursive descent over the tokens, emitting code as it goes
+class compiler
+{
+   public:
+    compiler(std::vector<token> tokens, shell_program& program)
+        : tokens_(std::move(tokens)), program_(&program)
+    {
+    }
+
+    void compile()
+    {
+        compile_list({}, false);
+        if (peek().kind != token_kind::end)
+            fail(peek());
+    }
+
+   private:
+    // An enclosing loop or case, for break and continue
+    struct construct
+    {
+        enum kind_type
+        {
+            while_loop,
+            for_loop,
+            case_statement,
+        } kind;
+        uint32_t continue_target = NoOperand;
+        std::vector<size_t> breaks;
+    };
+
+    const token& peek() const
+    {
+        return tokens_[pos_];
+    }
+
+    token next()
+    {
+        token t = tokens_[pos_];
+        if (t.kind != token_kind::end)
+            pos_++;
+        return t;
+    }
+
+    bool at_word(std::string_view word) const
+    {
+        return peek().kind == token_kind::word && peek().text == word;
+    }
+
+    [[noreturn]] void fail(const token& t) const
+    {
+        if (t.kind == token_kind::end)
+            throw syntax_error{true, "unexpected end of file"};
+        throw syntax_error{false,
+                           "syntax error near unexpected token `" + std::string(t.text) + "'"};
+    }
+
+    void expect_word(std::string_view word)
+    {
+        skip_newlines();
+        if (!at_word(word))
+            fail(peek());
+        next();
+    }
+
+    void skip_newlines()
+    {
+        while (peek().kind == token_kind::newline)
+            next();
+    }
+
+    uint32_t here() const
+    {
+        return static_cast<uint32_t>(program_->code.size());
+    }
+
+    size_t emit(opcode op, uint32_t a = NoOperand, uint32_t b = NoOperand)
+    {
+        program_->code.push_back({op, a, b});
+        return program_->code.size() - 1;
+    }
+
+    bool at_terminator(std::initializer_list<std::string_view> terminators) const
+    {
+        for (std::string_view terminator : terminators)
+        {
+            if (terminator == ";;" ? peek().kind == token_kind::double_semicolon
+                                   : at_word(terminator))
+                return true;
+        }
+        return false;
+    }
+
+    // Commands separated by ; or newlines, up to one of the terminators (or the end of input
+    // when there are none). Bodies of case items may be empty; everything else needs a command.
+    void compile_list(std::initializer_list<std::string_view> terminators, bool required = true)
+    {
+        bool any = false;
+        while (true)
+        {
+            skip_newlines();
+            if (at_terminator(terminators))
+                break;
+            if (peek().kind == token_kind::end)
+            {
+                if (terminators.size() > 0)
+                    fail(peek());
+                break;
+            }
+
+            compile_and_or();
+            any = true;
+
+            const token& separator = peek();
+            if (separator.kind == token_kind::semicolon || separator.kind == token_kind::newline)
+            {
+                next();
+            }
+            else if (separator.kind == token_kind::ampersand)
+            {
+                throw syntax_error{false, "background jobs (&) are not supported"};
+            }
+            else if (separator.kind != token_kind::end && !at_terminator(terminators))
+            {
+                fail(separator);
+            }
+        }
+
+        if (required && !any)
+            fail(peek());
+    }
+
+    void compile_and_or()
+    {
+        compile_pipeline();
+        while (peek().kind == token_kind::and_if || peek().kind == token_kind::or_if)
+        {
+            bool is_and = next().kind == token_kind::and_if;
+            skip_newlines();
+            size_t skip = emit(is_and ? opcode::JUMP_IF_FAILED : opcode::JUMP_IF_SUCCEEDED);
+            compile_pipeline();
+            program_->code[skip].a = here();
+        }
+    }
+
+    void compile_pipeline()
+    {
+        bool negate = at_word("!");
+        if (negate)
+            next();
+        compile_command();
+        if (negate)
+            emit(opcode::NEGATE);
+    }
+
+    void compile_command()
+    {
+        const token& t = peek();
+        if (t.kind == token_kind::left_paren)
+            throw syntax_error{false, "subshells are not supported"};
+        if (t.kind != token_kind::word)
+            fail(t);
+
+        if (t.text == "if")
+            compile_if();
+        else if (t.text == "while" || t.text == "until")
+            compile_while();
+        else if (t.text == "for")
+            compile_for();
+        else if (t.text == "case")
+            compile_case();
+        else if (t.text == "{")
+            compile_group();
+        else if (t.text == "function")
+            compile_function();
+        else if (tokens_[pos_ + 1].kind == token_kind::left_paren && !is_reserved_word(t.text))
+            compile_function();
+        else if (t.text == "break" || t.text == "continue")
+            compile_break();
+        else if (t.text == "return")
+            compile_return();
+        else if (is_reserved_word(t.text))
+            fail(t);
+        else
+            return compile_simple_pipeline();
+
+        if (peek().kind == token_kind::pipe)
+            throw syntax_error{false, "pipes into compound commands are not supported"};
+    }
+
+    void compile_if()
+    {
+        std::vector<size_t> ends;
+        next();
+        while (true)
+        {
+            compile_list({"then"});
+            next();
+            size_t skip = emit(opcode::JUMP_IF_FAILED);
+            compile_list({"elif", "else", "fi"});
+            ends.push_back(emit(opcode::JUMP));
+            program_->code[skip].a = here();
+
+            std::string_view keyword = next().text;
+            if (keyword == "fi")
+            {
+                // No branch taken leaves status 0, as in sh
+                emit(opcode::SET_STATUS, 0);
+                break;
+            }
+            if (keyword == "else")
+            {
+                compile_list({"fi"});
+                next();
+                break;
+            }
+        }
+        for (size_t end : ends)
+            program_->code[end].a = here();
+    }
+
+    void compile_while()
+    {
+        bool until = next().text == "until";
+        emit(opcode::LOOP_BEGIN);
+        uint32_t top = here();
+        compile_list({"do"});
+        next();
+        size_t exit = emit(until ? opcode::JUMP_IF_SUCCEEDED : opcode::JUMP_IF_FAILED);
+
+        constructs_.push_back({construct::while_loop, top, {}});
+        compile_list({"done"});
+        next();
+        emit(opcode::LOOP_STATUS);
+        emit(opcode::JUMP, top);
+
+        program_->code[exit].a = here();
+        finish_loop();
+    }
+
+    void compile_for()
+    {
+        next();
+        token variable = next();
+        if (variable.kind != token_kind::word || !is_variable_name(variable.text))
+            fail(variable);
+
+        for_loop loop{std::string(variable.text), {}};
+        skip_newlines();
+        if (at_word("in"))
+        {
+            next();
+            while (peek().kind == token_kind::word)
+                loop.words.emplace_back(next().text);
+        }
+        else
+        {
+            // `for NAME; do` walks the positional parameters
+            loop.words.emplace_back("$@");
+        }
+        if (peek().kind == token_kind::semicolon)
+            next();
+        expect_word("do");
+
+        uint32_t index = static_cast<uint32_t>(program_->loops.size());
+        program_->loops.push_back(std::move(loop));
+        emit(opcode::FOR_BEGIN, index);
+        uint32_t top = here();
+        size_t step = emit(opcode::FOR_NEXT, index);
+
+        constructs_.push_back({construct::for_loop, top, {}});
+        compile_list({"done"});
+        next();
+        emit(opcode::LOOP_STATUS);
+        emit(opcode::JUMP, top);
+
+        program_->code[step].b = here();
+        finish_loop();
+    }
+
+    // Leave the innermost loop with the status of its last body command, or 0 when the body
+    // never ran. Its breaks have already popped it and land after that.
+    void finish_loop()
+    {
+        construct loop = std::move(constructs_.back());
+        constructs_.pop_back();
+        emit(opcode::LOOP_END);
+        for (size_t jump : loop.breaks)
+            program_->code[jump].a = here();
+    }
+
+    void compile_case()
+    {
+        next();
+        token subject = next();
+        if (subject.kind != token_kind::word)
+            fail(subject);
+        expect_word("in");
+
+        uint32_t word = static_cast<uint32_t>(program_->words.size());
+        program_->words.emplace_back(subject.text);
+        emit(opcode::CASE_BEGIN, word);
+        constructs_.push_back({construct::case_statement, NoOperand, {}});
+
+        std::vector<size_t> ends;
+        while (true)
+        {
+            skip_newlines();
+            if (at_word("esac"))
+                break;
+
+            if (peek().kind == token_kind::left_paren)
+                next();
+            case_item item;
+            while (true)
+            {
+                token pattern = next();
+                if (pattern.kind != token_kind::word)
+                    fail(pattern);
+                item.patterns.emplace_back(pattern.text);
+                if (peek().kind != token_kind::pipe)
+                    break;
+                next();
+            }
+            token close = next();
+            if (close.kind != token_kind::right_paren)
+                fail(close);
+
+            uint32_t index = static_cast<uint32_t>(program_->case_items.size());
+            program_->case_items.push_back(std::move(item));
+            size_t match = emit(opcode::CASE_MATCH, index);
+            compile_list({";;", "esac"}, false);
+            ends.push_back(emit(opcode::JUMP));
+            program_->code[match].b = here();
+
+            if (peek().kind == token_kind::double_semicolon)
+                next();
+        }
+        next();
+
+        // No pattern matched
+        emit(opcode::SET_STATUS, 0);
+        for (size_t end : ends)
+            program_->code[end].a = here();
+        emit(opcode::CASE_END);
+        constructs_.pop_back();
+    }
+
+    void compile_group()
+    {
+        next();
+        compile_list({"}"});
+        next();
+    }
+
+    // name() COMPOUND-COMMAND or function name [()] COMPOUND-COMMAND. The body is compiled into
+    // a program of its own, which the function table takes over when the definition runs.
+    void compile_function()
+    {
+        if (at_word("function"))
+            next();
+        token name = next();
+        if (name.kind != token_kind::word || is_reserved_word(name.text))
+            fail(name);
+        if (peek().kind == token_kind::left_paren)
+        {
+            next();
+            token close = next();
+            if (close.kind != token_kind::right_paren)
+                fail(close);
+        }
+        skip_newlines();
+
+        const token& start = peek();
+        if (start.kind != token_kind::word ||
+            !(start.text == "{" || start.text == "if" || start.text == "while" ||
+              start.text == "until" || start.text == "for" || start.text == "case"))
+        {
+            fail(start);
+        }
+
+        auto body = std::make_shared<shell_program>();
+        shell_program* outer = std::exchange(program_, body.get());
+        std::vector<construct> outer_constructs = std::exchange(constructs_, {});
+        compile_command();
+        program_ = outer;
+        constructs_ = std::move(outer_constructs);
+
+        uint32_t index = static_cast<uint32_t>(program_->functions.size());
+        program_->functions.push_back({std::string(name.text), std::move(body)});
+        emit(opcode::DEFINE_FUNCTION, index);
+    }
+
+    // break [N] and continue [N]: pop whatever the jump leaves behind, then jump
+    void compile_break()
+    {
+        bool is_break = next().text == "break";
+        size_t levels = 1;
+        if (peek().kind == token_kind::word)
+        {
+            token count = next();
+            levels = 0;
+            for (char c : count.text)
+                levels = c >= '0' && c <= '9' ? levels * 10 + (c - '0') : 0;
+            if (levels == 0)
+            {
+                throw syntax_error{false, std::string(is_break ? "break" : "continue") + ": " +
+                                              std::string(count.text) +
+                                              ": loop count out of range"};
+            }
+        }
+
+        // Counting more loops than there are picks the outermost one, as in bash
+        size_t target = constructs_.size();
+        size_t found = 0;
+        for (size_t i = constructs_.size(); i-- > 0 && found < levels;)
+        {
+            if (constructs_[i].kind != construct::case_statement)
+            {
+                target = i;
+                found++;
+            }
+        }
+        if (found == 0)
+        {
+            // Reported when it runs, not here: it may sit in a branch that never does
+            emit(opcode::NOT_IN_LOOP, is_break ? 0 : 1);
+            return;
+        }
+
+        // break leaves the target loop too. Either way the status is break's or continue's, 0.
+        for (size_t i = constructs_.size(); i-- > (is_break ? target : target + 1);)
+        {
+            if (constructs_[i].kind == construct::case_statement)
+                emit(opcode::CASE_END);
+            else
+                emit(opcode::LOOP_END);
+        }
+        emit(opcode::SET_STATUS, 0);
+
+        if (is_break)
+        {
+            constructs_[target].breaks.push_back(emit(opcode::JUMP));
+        }
+        else
+        {
+            emit(opcode::LOOP_STATUS);
+            emit(opcode::JUMP, constructs_[target].continue_target);
+        }
+    }
+
+    void compile_return()
+    {
+        next();
+        uint32_t word = NoOperand;
+        if (peek().kind == token_kind::word)
+        {
+            word = static_cast<uint32_t>(program_->words.size());
+            program_->words.emplace_back(next().text);
+        }
+        emit(opcode::RETURN, word);
+    }
+
+    // Words and pipes up to the next operator become one command. The words are joined with
+    // single spaces, the layout parse_pipeline_input expects.
+    void compile_simple_pipeline()
+    {
+        compiled_command command;
+        while (true)
+        {
+            const token& t = peek();
+            if (t.kind == token_kind::word)
+            {
+                size_t name_length = 0;
+                if (command.text.empty() && is_assignment(t.text, name_length))
+                {
+                    command.assignments.emplace_back(t.text.substr(0, name_length),
+                                                     t.text.substr(name_length + 1));
+                }
+                else
+                {
+                    if (!command.text.empty())
+                        command.text += ' ';
+                    command.text += t.text;
+                }
+                next();
+            }
+            else if (t.kind == token_kind::pipe && !command.text.empty())
+            {
+                next();
+                skip_newlines();
+                if (peek().kind != token_kind::word)
+                    fail(peek());
+                command.text += " | ";
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        command.dynamic = command.text.find('$') != std::string::npos;
+        if (!command.dynamic && !command.text.empty())
+        {
+            parse_pipeline_input(command.text, command.stages);
+            if (command.stages.size() == 1)
+            {
+                const user_input& stage = command.stages.front();
+                const builtin_command* builtin = find_builtin(stage.command);
+                if (builtin && builtin->handler && !stage.has_stdout_redirect() &&
+                    !stage.has_stderr_redirect() && stage.placement.empty() &&
+                    !stage.has_process_substitutions())
+                {
+                    command.builtin = builtin;
+                }
+            }
+        }
+
+        uint32_t index = static_cast<uint32_t>(program_->commands.size());
+        program_->commands.push_back(std::move(command));
+        emit(opcode::RUN, index);
+    }
+
+    std::vector<token> tokens_;
+    size_t pos_ = 0;
+    shell_program* program_;
+    std::vector<construct> constructs_;
+};
+}  // namespace
+
+compile_result compile_script(std::string_view source, shell_program& program)
+{
+    program = shell_program();
+    try
+    {
+        compiler(tokenize(source), program).compile();
+        return compile_result::complete;
+    }
+    catch (const syntax_error& error)
+    {
+        if (error.incomplete)
+            return compile_result::incomplete;
+        std::cerr << "shell: " << error.message << std::endl;
+        return compile_result::error;
+    }
+}
+
+bool is_shell_keyword(std::string_view word)
+{
+    return is_reserved_word(word) ||
+           std::find(CompiledCommands.begin(), CompiledCommands.end(), word) !=
+               CompiledCommands.end();
+}
+
+bool is_plain_pipeline(std::string_view line)
+{
+    char quote = 0;
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        char c = line[i];
+        if (quote == '"' && c == '\\')
+        {
+            i++;
+            continue;
+        }
+        if (quote)
+        {
+            quote = c == quote ? 0 : quote;
+            continue;
+        }
+        if (c == '\'' || c == '"')
+        {
+            quote = c;
+        }
+        else if (c == '\\' || c == '\n' || c == '\t' || c == '#' || c == '{' || c == '}' ||
+                 (is_operator_char(c) && c != '|') || (c == '|' && line.substr(i + 1, 1) == "|"))
+        {
+            return false;
+        }
+    }
+    if (quote)
+        return false;
+
+    size_t start = line.find_first_not_of(' ');
+    if (start == std::string_view::npos)
+        return true;
+    std::string_view first = line.substr(start, line.find(' ', start) - start);
+    size_t name_length = 0;
+    return !is_reserved_word(first) &&
+           std::find(CompiledCommands.begin(), CompiledCommands.end(), first) ==
+               CompiledCommands.end() &&
+           !is_assignment(first, name_length) && !is_function(first);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string_view>
+
+#include "shell_bytecode.h"
+
+enum class compile_result
+{
+    complete,
+    // The source ends inside a construct, quote or after an operator; more lines may finish it
+    incomplete,
+    // A syntax error, already printed
+    error,
+};
+
+// Compile source, one or more lines of shell code, into program: `;`, `&&` and `||` lists,
+// `!`, if/elif/else, while/until, for, case, `{ ...; }` groups, break/continue, and functions
+// defined with `name() { ...; }` or `function name { ...; }`, called like commands, with return.
+compile_result compile_script(std::string_view source, shell_program& program);
+
+// Whether line is a plain pipeline that parse_pipeline_input runs correctly as is: no operators,
+// reserved words, comments, assignments, function calls or open quotes. Such lines skip the
+// compiler.
+bool is_plain_pipeline(std::string_view line);
+
+// Whether word, unquoted at the start of a command, is a reserved word such as if, do or done,
+// or one of break, continue and return, which the compiler turns into jumps
+bool is_shell_keyword(std::string_view word);
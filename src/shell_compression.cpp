@@ -0,0 +1,180 @@
+#include "shell_compression.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <string>
+
+#include "shell_commands.h"
+#include "shell_executor.h"
+
+#ifdef SHELL_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+constexpr size_t ChunkSize = 1024 * 1024;
+
+#ifdef SHELL_HAVE_ZLIB
+// One complete gzip member holding data
+std::string compress_member(const std::string& data)
+{
+    z_stream stream{};
+    // 16 + window bits asks for a gzip header and trailer instead of zlib's
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return {};
+    }
+
+    std::string member(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(member.data());
+    stream.avail_out = static_cast<uInt>(member.size());
+    int result = deflate(&stream, Z_FINISH);
+    member.resize(result == Z_STREAM_END ? stream.total_out : 0);
+    deflateEnd(&stream);
+    return member;
+}
+#endif
+
+bool write_all(int fd, const std::string& data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        written += n;
+    }
+    return true;
+}
+}  // namespace
+
+bool is_compressed_target(std::string_view filename)
+{
+#ifdef SHELL_HAVE_ZLIB
+    return filename.size() > 3 && filename.ends_with(".gz") && shell_option_enabled("gzip");
+#else
+    (void)filename;
+    return false;
+#endif
+}
+
+compressed_output::~compressed_output()
+{
+    finish();
+}
+
+bool compressed_output::open(const shell_string& path, bool append)
+{
+    path_ = path;
+    append_ = append;
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+    file_fd_ = ::open(path.c_str(), flags, 0644);
+    if (file_fd_ < 0)
+    {
+        std::cerr << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (pipe2(pipe_fds_, O_CLOEXEC) != 0)
+    {
+        std::cerr << "Error creating pipe" << std::endl;
+        close(file_fd_);
+        file_fd_ = -1;
+        return false;
+    }
+
+    // The compressor threads start before the command's foreground_signals guard exists
+    worker_thread_signals signals;
+    thread_ = std::thread(&compressed_output::compress_stream, this);
+    return true;
+}
+
+bool compressed_output::finish()
+{
+    if (pipe_fds_[1] >= 0)
+    {
+        close(pipe_fds_[1]);
+        pipe_fds_[1] = -1;
+    }
+    if (thread_.joinable())
+        thread_.join();
+    for (int* fd : {&pipe_fds_[0], &file_fd_})
+    {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+
+    if (failed_)
+    {
+        std::cerr << path_ << ": write error" << std::endl;
+        failed_ = false;
+        return false;
+    }
+    return true;
+}
+
+// Chunks are read and handed to compressor threads here; at most one per core is in flight, and
+// the oldest is written out before another one starts, which keeps the members in order and the
+// memory bounded when the disk is slower than the compressors.
+void compressed_output::compress_stream()
+{
+#ifdef SHELL_HAVE_ZLIB
+    size_t max_in_flight = std::max(1u, std::thread::hardware_concurrency());
+    std::deque<std::future<std::string>> in_flight;
+    bool wrote_member = false;
+
+    auto write_oldest = [&]()
+    {
+        std::string member = in_flight.front().get();
+        in_flight.pop_front();
+        failed_ = failed_ || member.empty() || !write_all(file_fd_, member);
+        wrote_member = true;
+    };
+
+    bool end_of_input = false;
+    while (!end_of_input)
+    {
+        std::string chunk(ChunkSize, '\0');
+        size_t filled = 0;
+        while (filled < chunk.size())
+        {
+            ssize_t n = read(pipe_fds_[0], chunk.data() + filled, chunk.size() - filled);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                end_of_input = true;
+                break;
+            }
+            filled += n;
+        }
+        if (filled == 0)
+            break;
+
+        chunk.resize(filled);
+        if (in_flight.size() >= max_in_flight)
+            write_oldest();
+        in_flight.push_back(std::async(std::launch::async, compress_member, std::move(chunk)));
+    }
+    while (!in_flight.empty())
+        write_oldest();
+
+    // An empty file isn't valid gzip, so a command without output still gets an empty member
+    if (!wrote_member && !append_)
+        failed_ = !write_all(file_fd_, compress_member({}));
+#endif
+}
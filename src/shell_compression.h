@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string_view>
+#include <thread>
+
+#include "user_input.h"
+
+// After `set -o gzip`, output redirected to a file ending in .gz is compressed by the shell
+// itself instead of an external gzip. It is off by default so that ordinary redirections stay
+// byte-exact, e.g. for `gzip -c f > f.gz`. The command writes plain data into a pipe; the shell
+// reads it in 1 MiB chunks, compresses up to one chunk per core at a time and writes each as its
+// own gzip member, in order. Concatenated members are a standard gzip stream that gzip, zcat and
+// any zlib reader decompress as one, and `>>` simply appends more members.
+
+// Whether output redirected to filename is compressed: a .gz target with `set -o gzip` on, when
+// the shell is built with zlib
+bool is_compressed_target(std::string_view filename);
+
+class compressed_output
+{
+   public:
+    compressed_output() = default;
+    compressed_output(const compressed_output&) = delete;
+    compressed_output& operator=(const compressed_output&) = delete;
+
+    // Waits like finish() if that hasn't been called
+    ~compressed_output();
+
+    // Open path, truncated or appended to, and start compressing whatever is written to
+    // input_fd(). Prints an error and returns false on failure.
+    bool open(const shell_string& path, bool append);
+
+    // The pipe's write end, close-on-exec. Commands get their own copy by opening /dev/fd/N.
+    int input_fd() const
+    {
+        return pipe_fds_[1];
+    }
+
+    // Close the shell's write end and wait until every other writer has closed theirs and all
+    // the data is in the file. Prints an error and returns false if writing it failed.
+    bool finish();
+
+   private:
+    void compress_stream();
+
+    shell_string path_;
+    int pipe_fds_[2] = {-1, -1};
+    int file_fd_ = -1;
+    bool append_ = false;
+    bool failed_ = false;
+    std::thread thread_;
+};
@@ -1,9 +1,37 @@
 #include "shell_executor.h"
 
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <span>
 #include <sstream>
+#include <thread>
+#include <vector>
+
+#include "builtin_registry.h"
+#include "shell_commands.h"
+#include "shell_compiler.h"
+#include "shell_compression.h"
+#include "shell_placement.h"
+#include "shell_plugins.h"
+#include "shell_vm.h"
 
 namespace fs = std::filesystem;
 
@@ -75,8 +103,18 @@ std::map<std::string, std::string> get_all_executables_in_path()
     return executables;
 }
 
-bool find_in_path(const std::string& cmd, std::string& full_path)
+bool find_in_path(std::string_view cmd, std::string& full_path)
 {
+    // A name with a slash in it is a path to run as it is, not something to search PATH for
+    if (cmd.find('/') != std::string_view::npos)
+    {
+        std::error_code error;
+        if (!fs::is_regular_file(cmd, error) || !has_execute_permission(cmd))
+            return false;
+        full_path = cmd;
+        return true;
+    }
+
     const char* path_env = std::getenv("PATH");
     if (path_env == nullptr)
     {
@@ -101,7 +139,8 @@ bool find_in_path(const std::string& cmd, std::string& full_path)
         sep = "\\";
 #endif
 
-        std::string candidate = dir + sep + cmd;
+        std::string candidate = dir + sep;
+        candidate += cmd;
 
 // Try with .exe extension on Windows if needed
 #ifndef __unix__
@@ -123,59 +162,900 @@ bool find_in_path(const std::string& cmd, std::string& full_path)
     return false;
 }
 
-std::string escape_for_shell(const std::string& str, bool& needs_quoting)
+int decode_wait_status(int raw_status)
+{
+    if (WIFEXITED(raw_status))
+    {
+        return WEXITSTATUS(raw_status);
+    }
+    if (WIFSIGNALED(raw_status))
+    {
+        return 128 + WTERMSIG(raw_status);
+    }
+    return 1;
+}
+
+// Open a redirection target in a forked child and move it onto target_fd
+static bool redirect_in_child(const shell_string& filename, bool append, int target_fd)
+{
+    int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+    int fd = open(filename.c_str(), flags, 0644);
+    if (fd < 0)
+    {
+        std::cerr << filename << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    dup2(fd, target_fd);
+    close(fd);
+    return true;
+}
+
+// Builtin pipeline stages start commands from worker threads (batch, or a builtin falling back
+// to the executable). std::cout belongs to the main thread, which swaps its buffer while running
+// in-process stages, and the worker stages never write to it, so only the main thread flushes.
+static const std::thread::id MainThread = std::this_thread::get_id();
+
+static void flush_buffered_output()
+{
+    if (std::this_thread::get_id() == MainThread)
+        std::cout.flush();
+}
+
+// Apply a command's placement in its forked child. The shell may have other threads running, so
+// the error is written with write(2) rather than through std::cerr, whose lock another thread may
+// have held at the fork.
+static bool apply_placement_in_child(const user_input& u_input, const cpu_set_t* cache_domain)
+{
+    const char* error = nullptr;
+    if (apply_placement(u_input.placement, cache_domain, error))
+        return true;
+    iovec message[] = {{const_cast<char*>(error), std::strlen(error)},
+                       {const_cast<char*>("\n"), 1}};
+    (void)!writev(STDERR_FILENO, message, 2);
+    return false;
+}
+
+// The cache domain for a command's `cpuset cache` prefix, resolved before forking since reading
+// sysfs isn't safe in the child. Returns cache_domain itself when the pipeline already has one.
+static const cpu_set_t* resolve_cache_domain(const user_input& u_input,
+                                             const cpu_set_t* cache_domain, cpu_set_t& own_domain)
+{
+    if (cache_domain || !u_input.placement.share_cache)
+        return cache_domain;
+    return current_cache_domain(own_domain) ? &own_domain : nullptr;
+}
+
+// fork/exec path for commands that need setup posix_spawn can't express
+static pid_t fork_external_command(const user_input& u_input, const std::string& full_path,
+                                   char* const argv[], int stdin_fd, int stdout_fd,
+                                   const cpu_set_t* cache_domain)
+{
+    cpu_set_t own_domain;
+    cache_domain = resolve_cache_domain(u_input, cache_domain, own_domain);
+    flush_buffered_output();
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        if (pid < 0)
+            std::cerr << u_input.command << ": " << std::strerror(errno) << std::endl;
+        return pid;
+    }
+
+    if (stdin_fd != STDIN_FILENO)
+        dup2(stdin_fd, STDIN_FILENO);
+    if (stdout_fd != STDOUT_FILENO)
+        dup2(stdout_fd, STDOUT_FILENO);
+    if ((u_input.has_stdout_redirect() &&
+         !redirect_in_child(u_input.stdout_redirect_filename, u_input.stdout_append,
+                            STDOUT_FILENO)) ||
+        (u_input.has_stderr_redirect() &&
+         !redirect_in_child(u_input.stderr_redirect_filename, u_input.stderr_append,
+                            STDERR_FILENO)))
+    {
+        _exit(1);
+    }
+
+    signal(SIGPIPE, SIG_DFL);
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    pthread_sigmask(SIG_SETMASK, &no_signals, nullptr);
+    if (!apply_placement_in_child(u_input, cache_domain))
+    {
+        _exit(1);
+    }
+
+    execv(full_path.c_str(), argv);
+    std::cerr << u_input.command << ": " << std::strerror(errno) << std::endl;
+    _exit(126);
+}
+
+pid_t spawn_external_command(const user_input& u_input, int stdin_fd, int stdout_fd,
+                             const cpu_set_t* cache_domain)
+{
+    std::string full_path;
+    if (!find_in_path(u_input.command, full_path))
+    {
+        std::cerr << u_input.command << ": command not found" << std::endl;
+        return -1;
+    }
+
+    std::vector<char*> argv;
+    argv.reserve(u_input.args.size() + 2);
+    argv.push_back(const_cast<char*>(u_input.command.c_str()));
+    for (const auto& arg : u_input.args)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    if (!u_input.placement.empty())
+    {
+        return fork_external_command(u_input, full_path, argv.data(), stdin_fd, stdout_fd,
+                                     cache_domain);
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    if (stdin_fd != STDIN_FILENO)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+    }
+    if (stdout_fd != STDOUT_FILENO)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+    }
+
+    // Redirections are opened by the child so they win over pipeline wiring, like in sh
+    if (u_input.has_stdout_redirect())
+    {
+        int flags = O_WRONLY | O_CREAT | (u_input.stdout_append ? O_APPEND : O_TRUNC);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                         u_input.stdout_redirect_filename.c_str(), flags, 0644);
+    }
+    if (u_input.has_stderr_redirect())
+    {
+        int flags = O_WRONLY | O_CREAT | (u_input.stderr_append ? O_APPEND : O_TRUNC);
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO,
+                                         u_input.stderr_redirect_filename.c_str(), flags, 0644);
+    }
+
+    // Anything the builtins buffered must reach the terminal before the child writes
+    flush_buffered_output();
+
+    // The shell ignores SIGPIPE for itself; commands get the default behaviour back. Builtins
+    // may start commands while foreground_signals blocks SIGINT, so the mask is cleared too.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    int result = posix_spawn(&pid, full_path.c_str(), &actions, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (result != 0)
+    {
+        std::cerr << u_input.command << ": " << std::strerror(result) << std::endl;
+        return -1;
+    }
+
+    return pid;
+}
+
+foreground_signals::foreground_signals()
+{
+    sigemptyset(&signals_);
+    sigaddset(&signals_, SIGINT);
+    sigaddset(&signals_, SIGQUIT);
+    pthread_sigmask(SIG_BLOCK, &signals_, &previous_);
+    fd_ = signalfd(-1, &signals_, SFD_NONBLOCK | SFD_CLOEXEC);
+    interrupt_event_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    foreground_signals* none = nullptr;
+    outermost_.compare_exchange_strong(none, this);
+}
+
+foreground_signals::~foreground_signals()
+{
+    foreground_signals* self = this;
+    outermost_.compare_exchange_strong(self, nullptr);
+    // Consume anything still pending so it isn't delivered once unblocked
+    drain();
+    for (int fd : {fd_, interrupt_event_})
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_, nullptr);
+}
+
+worker_thread_signals::worker_thread_signals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGQUIT);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous_);
+}
+
+worker_thread_signals::~worker_thread_signals()
+{
+    pthread_sigmask(SIG_SETMASK, &previous_, nullptr);
+}
+
+void foreground_signals::drain()
+{
+    signalfd_siginfo info;
+    while (fd_ >= 0 && read(fd_, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo != SIGINT)
+            continue;
+        // A guard nested in a builtin may be the one to read it; readers wait on the outermost
+        interrupt();
+        if (foreground_signals* outermost = outermost_.load(); outermost && outermost != this)
+            outermost->interrupt();
+    }
+}
+
+void foreground_signals::interrupt()
+{
+    if (!interrupted_.exchange(true) && interrupt_event_ >= 0)
+    {
+        uint64_t one = 1;
+        ssize_t written = write(interrupt_event_, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+bool foreground_signals::wait_for_input(int fd)
+{
+    foreground_signals* guard = outermost_.load();
+    if (!guard)
+        return true;
+
+    while (!guard->interrupted())
+    {
+        std::array<pollfd, 3> fds = {{{fd, POLLIN, 0},
+                                      {guard->fd_, POLLIN, 0},
+                                      {guard->interrupt_event_, POLLIN, 0}}};
+        int ready = poll(fds.data(), fds.size(), -1);
+        if (ready < 0 && errno != EINTR)
+            return true;
+        if (fds[1].revents & POLLIN)
+            guard->drain();
+        if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) && !guard->interrupted())
+            return true;
+    }
+    return false;
+}
+
+static void wait_blocking(pid_t pid, int& status)
 {
-    needs_quoting = false;
-    std::string result;
-    for (char c : str)
+    int raw_status = 0;
+    while (waitpid(pid, &raw_status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            status = 1;
+            return;
+        }
+    }
+    status = decode_wait_status(raw_status);
+}
+
+void wait_for_children(std::span<const pid_t> pids, std::span<int> statuses,
+                       foreground_signals& signals)
+{
+    constexpr uint64_t SignalEvent = UINT64_MAX;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd >= 0 && signals.fd() >= 0)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = SignalEvent;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signals.fd(), &event);
+    }
+
+    std::vector<int> pidfds(pids.size(), -1);
+    size_t remaining = 0;
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        if (pids[i] < 0)
+            continue;
+
+        // Without pidfds (or epoll) fall back to waiting for the child directly
+        if (epoll_fd >= 0)
+            pidfds[i] = static_cast<int>(syscall(SYS_pidfd_open, pids[i], 0));
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        if (pidfds[i] < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfds[i], &event) != 0)
+        {
+            wait_blocking(pids[i], statuses[i]);
+            continue;
+        }
+        remaining++;
+    }
+
+    std::array<epoll_event, 16> events;
+    while (remaining > 0)
+    {
+        int ready = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0)
+            break;
+
+        for (int e = 0; e < ready; e++)
+        {
+            if (events[e].data.u64 == SignalEvent)
+            {
+                signals.drain();
+                continue;
+            }
+
+            // A readable pidfd means the child has exited, so this doesn't block
+            size_t i = events[e].data.u64;
+            close(pidfds[i]);
+            pidfds[i] = -1;
+            wait_blocking(pids[i], statuses[i]);
+            remaining--;
+        }
+    }
+
+    // Anything still tracked here means epoll failed; wait the plain way
+    for (size_t i = 0; i < pids.size(); i++)
     {
-        if (c == '"')
+        if (pidfds[i] >= 0)
         {
-            result += '\\';
-            needs_quoting = true;
+            close(pidfds[i]);
+            wait_blocking(pids[i], statuses[i]);
         }
-        else if (c == ' ' || c == '\'')
+    }
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+
+    // Like sh, end the line a SIGINT interrupted
+    signals.drain();
+    for (size_t i = 0; i < pids.size() && signals.interrupted(); i++)
+    {
+        if (pids[i] >= 0 && statuses[i] == 128 + SIGINT)
         {
-            // Single quotes and spaces need quoting (wrap in double quotes)
-            needs_quoting = true;
+            std::cerr << std::endl;
+            break;
         }
-        result += c;
     }
-    return result;
 }
 
-void execute_external_command(const user_input& u_input)
+int execute_external_command(const user_input& u_input)
 {
-    std::string full_path;
-    if (find_in_path(u_input.command, full_path))
+    pid_t pid = spawn_external_command(u_input);
+    if (pid < 0)
+    {
+        return 127;
+    }
+
+    foreground_signals signals;
+    int status = 1;
+    wait_for_children({&pid, 1}, {&status, 1}, signals);
+    return status;
+}
+
+// Builtins that work on raw descriptors instead of std::cout: native text tools and plugins.
+// Inside a pipeline they run on a worker thread of the shell, so they may read stdin like any
+// other stage.
+using fd_builtin = std::function<int(const user_input& u_input, int in_fd, int out_fd, int err_fd)>;
+
+static fd_builtin find_fd_builtin(std::string_view name)
+{
+    if (const builtin_command* builtin = find_builtin(name); builtin && builtin->fd_handler)
+    {
+        return [handler = builtin->fd_handler](const user_input& u_input, int in_fd, int out_fd,
+                                               int err_fd)
+        { return handler(u_input.args, in_fd, out_fd, err_fd); };
+    }
+    if (const plugin_builtin* plugin = find_plugin_builtin(name))
+    {
+        // The copy pins the shared object while the builtin runs
+        return [plugin = *plugin](const user_input& u_input, int in_fd, int out_fd, int err_fd)
+        { return run_plugin_builtin(plugin, u_input, in_fd, out_fd, err_fd); };
+    }
+    return nullptr;
+}
+
+// Open the target of an output redirection, printing an error and returning -1 on failure
+static int open_redirect(const shell_string& filename, bool append)
+{
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+    int fd = open(filename.c_str(), flags, 0644);
+    if (fd < 0)
+    {
+        std::cerr << filename << ": " << std::strerror(errno) << std::endl;
+    }
+    return fd;
+}
+
+// Run a descriptor-based builtin with the command's redirections applied on top of in_fd/out_fd.
+// Options the builtin doesn't implement hand the command over to the executable in PATH.
+static int run_fd_builtin(const fd_builtin& builtin, const user_input& u_input, int in_fd,
+                          int out_fd)
+{
+    int builtin_out_fd = out_fd;
+    int err_fd = STDERR_FILENO;
+    if (u_input.has_stdout_redirect())
+    {
+        builtin_out_fd = open_redirect(u_input.stdout_redirect_filename, u_input.stdout_append);
+        if (builtin_out_fd < 0)
+            return 1;
+    }
+    if (u_input.has_stderr_redirect())
+    {
+        err_fd = open_redirect(u_input.stderr_redirect_filename, u_input.stderr_append);
+        if (err_fd < 0)
+        {
+            if (u_input.has_stdout_redirect())
+                close(builtin_out_fd);
+            return 1;
+        }
+    }
+
+    // Ctrl-C ends a builtin reading the terminal, or the command it falls back to, not the shell
+    foreground_signals signals;
+    int status = builtin(u_input, in_fd, builtin_out_fd, err_fd);
+
+    if (u_input.has_stdout_redirect())
+        close(builtin_out_fd);
+    if (u_input.has_stderr_redirect())
+        close(err_fd);
+
+    if (status == BUILTIN_USE_EXTERNAL)
+    {
+        // The child reapplies the redirections itself
+        pid_t pid = spawn_external_command(u_input, in_fd, out_fd);
+        if (pid < 0)
+            return 127;
+
+        wait_for_children({&pid, 1}, {&status, 1}, signals);
+    }
+    return status;
+}
+
+// Run a builtin in a forked child with its placement applied there, so a `cpuset` / `ulimit`
+// prefix never changes the shell itself
+static void run_placed_builtin_in_child(const user_input& u_input, const cpu_set_t* cache_domain)
+{
+    signal(SIGPIPE, SIG_DFL);
+    if (!apply_placement_in_child(u_input, cache_domain))
+    {
+        exit(1);
+    }
+
+    user_input unplaced(u_input);
+    unplaced.placement.clear();
+    exit(ExecuteInputCommand(unplaced));
+}
+
+int ExecuteInputCommand(const user_input& u_input)
+{
+    if (!u_input.placement.empty() && u_input.has_builtin_command())
+    {
+        cpu_set_t own_domain;
+        const cpu_set_t* cache_domain = resolve_cache_domain(u_input, nullptr, own_domain);
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            run_placed_builtin_in_child(u_input, cache_domain);
+        }
+        if (pid < 0)
+        {
+            std::cerr << "Error forking process" << std::endl;
+            return 1;
+        }
+
+        foreground_signals signals;
+        int status = 1;
+        wait_for_children({&pid, 1}, {&status, 1}, signals);
+        return status;
+    }
+
+    if (fd_builtin fd_handler = find_fd_builtin(u_input.command))
+    {
+        // Keep anything buffered ahead of what the builtin writes to the descriptors
+        std::cout.flush();
+        std::cerr.flush();
+        return run_fd_builtin(fd_handler, u_input, STDIN_FILENO, STDOUT_FILENO);
+    }
+
+    const builtin_command* builtin = find_builtin(u_input.command);
+    if (!builtin)
+    {
+        // Try to execute as external command
+        return execute_external_command(u_input);
+    }
+
+    // Handle output redirection if specified
+    std::unique_ptr<stream_redirector> stdout_redir;
+    if (u_input.has_stdout_redirect())
+    {
+        try
+        {
+            std::ios_base::openmode mode = u_input.stdout_append
+                                               ? (std::ios::out | std::ios::app)
+                                               : (std::ios::out | std::ios::trunc);
+
+            stdout_redir = std::make_unique<stream_redirector>(
+                std::cout, u_input.stdout_redirect_filename, mode);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    std::unique_ptr<stream_redirector> stderr_redir;
+    if (u_input.has_stderr_redirect())
     {
-        // Build command string - quote only if necessary
-        bool needs_quoting;
-        std::string escaped_cmd = escape_for_shell(u_input.command, needs_quoting);
-        std::string full_command = needs_quoting ? "\"" + escaped_cmd + "\"" : escaped_cmd;
+        try
+        {
+            std::ios_base::openmode mode = u_input.stderr_append
+                                               ? (std::ios::out | std::ios::app)
+                                               : (std::ios::out | std::ios::trunc);
+
+            stderr_redir = std::make_unique<stream_redirector>(
+                std::cerr, u_input.stderr_redirect_filename, mode);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    return builtin->handler(u_input.args);
+}
+
+// Run a pipeline-safe builtin inside the shell with std::cout pointed at out_fd
+static int run_builtin_in_process(const user_input& u_input, int out_fd)
+{
+    std::cout.flush();
+    fd_streambuf pipe_buf(out_fd);
+    std::streambuf* original_buf = std::cout.rdbuf(&pipe_buf);
+    int status = ExecuteInputCommand(u_input);
+    std::cout.flush();
+    std::cout.rdbuf(original_buf);
+    return status;
+}
+
+// Run a pipeline of two or more stages, storing each stage's exit status in statuses
+static void run_pipeline_stages(const user_input_list& u_inputs, std::vector<int>& statuses)
+{
+
+    // Pipes are close-on-exec so spawned stages only keep the ends wired to their stdio
+    std::vector<std::array<int, 2>> pipe_fds(u_inputs.size() - 1);
+    for (size_t i = 0; i < pipe_fds.size(); i++)
+    {
+        if (pipe2(pipe_fds[i].data(), O_CLOEXEC) == -1)
+        {
+            std::cerr << "Error creating pipe" << std::endl;
+            for (size_t j = 0; j < i; j++)
+            {
+                close(pipe_fds[j][0]);
+                close(pipe_fds[j][1]);
+            }
+            statuses.assign(u_inputs.size(), 1);
+            return;
+        }
+    }
+
+    // `cpuset cache` stages of one pipeline all share the cache domain the shell is running on
+    cpu_set_t cache_domain;
+    const cpu_set_t* shared_cache = nullptr;
+    for (const auto& u_input : u_inputs)
+    {
+        if (u_input.placement.share_cache)
+        {
+            if (current_cache_domain(cache_domain))
+                shared_cache = &cache_domain;
+            break;
+        }
+    }
+
+    std::vector<pid_t> pids(u_inputs.size(), -1);
+    std::vector<size_t> in_process_stages;
+    std::vector<std::pair<size_t, fd_builtin>> thread_stages;
+    for (size_t i = 0; i < u_inputs.size(); i++)
+    {
+        int in_fd = i > 0 ? pipe_fds[i - 1][0] : STDIN_FILENO;
+        int out_fd = i < u_inputs.size() - 1 ? pipe_fds[i][1] : STDOUT_FILENO;
+
+        // Placed builtins fall through to the fork below so affinity and limits stay in the child
+        bool placed = !u_inputs[i].placement.empty();
+        fd_builtin fd_handler = placed ? nullptr : find_fd_builtin(u_inputs[i].command);
+        if (fd_handler)
+        {
+            thread_stages.emplace_back(i, std::move(fd_handler));
+            continue;
+        }
+
+        const builtin_command* builtin = find_builtin(u_inputs[i].command);
+        if (!builtin && !u_inputs[i].has_builtin_command())
+        {
+            // External stages are spawned directly without duplicating the shell
+            pids[i] = spawn_external_command(u_inputs[i], in_fd, out_fd, shared_cache);
+            continue;
+        }
 
-        for (const auto& arg : u_input.args)
+        if (builtin && !placed && builtin->has_flag(BUILTIN_PIPELINE_SAFE))
         {
-            std::string escaped_arg = escape_for_shell(arg, needs_quoting);
-            full_command += " \"" + escaped_arg + "\"";
+            // Run once every process stage is up, so a full pipe always has a reader
+            in_process_stages.push_back(i);
+            continue;
         }
 
-        // Append redirection if specified
-        if (u_input.has_stdout_redirect())
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // Child process
+            // Set up pipes
+            if (in_fd != STDIN_FILENO)
+                dup2(in_fd, STDIN_FILENO);
+
+            if (out_fd != STDOUT_FILENO)
+                dup2(out_fd, STDOUT_FILENO);
+
+            // Close all pipe fds in child
+            for (const auto& fds : pipe_fds)
+            {
+                close(fds[0]);
+                close(fds[1]);
+            }
+            if (placed)
+            {
+                run_placed_builtin_in_child(u_inputs[i], shared_cache);
+            }
+            signal(SIGPIPE, SIG_DFL);
+            exit(ExecuteInputCommand(u_inputs[i]));
+        }
+        else if (pid < 0)
         {
-            std::string operator_str = u_input.stdout_append ? " >> " : " > ";
-            full_command += operator_str + "\"" + u_input.stdout_redirect_filename + "\"";
+            std::cerr << "Error forking process" << std::endl;
         }
-        if (u_input.has_stderr_redirect())
+        pids[i] = pid;
+    }
+
+    // Stages that fail to start report 127, like a command that was not found
+    statuses.assign(u_inputs.size(), 127);
+
+    // Threads started from here on inherit the blocked terminal signals
+    foreground_signals signals;
+
+    // Close all pipe fds in parent, except the ends in-process stages still need. Thread stages
+    // keep both of theirs, in-process builtins only their write end. Holding no other read ends
+    // means a writer whose reader has exited gets EPIPE instead of blocking forever.
+    std::vector<std::array<bool, 2>> keep_fds(pipe_fds.size(), {false, false});
+    for (const auto& [i, fd_handler] : thread_stages)
+    {
+        if (i > 0)
+            keep_fds[i - 1][0] = true;
+        if (i < pipe_fds.size())
+            keep_fds[i][1] = true;
+    }
+    for (size_t i : in_process_stages)
+    {
+        if (i < pipe_fds.size())
+            keep_fds[i][1] = true;
+    }
+    for (size_t i = 0; i < pipe_fds.size(); i++)
+    {
+        if (!keep_fds[i][0])
+            close(pipe_fds[i][0]);
+        if (!keep_fds[i][1])
+            close(pipe_fds[i][1]);
+    }
+
+    // Thread stages close their ends as soon as they finish so neighbours see EOF/EPIPE
+    std::cout.flush();
+    std::vector<std::thread> threads;
+    for (const auto& [i, fd_handler] : thread_stages)
+    {
+        int in_fd = i > 0 ? pipe_fds[i - 1][0] : STDIN_FILENO;
+        int out_fd = i < u_inputs.size() - 1 ? pipe_fds[i][1] : STDOUT_FILENO;
+        threads.emplace_back(
+            [&statuses, &u_inputs, &fd_handler, i, in_fd, out_fd]
+            {
+                statuses[i] = run_fd_builtin(fd_handler, u_inputs[i], in_fd, out_fd);
+                if (in_fd != STDIN_FILENO)
+                    close(in_fd);
+                if (out_fd != STDOUT_FILENO)
+                    close(out_fd);
+            });
+    }
+
+    // In-process builtins never read stdin. Each one's write end is closed as soon as it is done
+    // so the next stage sees EOF.
+    for (size_t i : in_process_stages)
+    {
+        int out_fd = i < u_inputs.size() - 1 ? pipe_fds[i][1] : STDOUT_FILENO;
+        statuses[i] = run_builtin_in_process(u_inputs[i], out_fd);
+        if (out_fd != STDOUT_FILENO)
+        {
+            close(out_fd);
+        }
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    wait_for_children(pids, statuses, signals);
+}
+
+// Start the command of a <(...) or >(...) substitution in a forked shell, wired to one end of a
+// new pipe. The other end is returned, open across exec, for the main command to reach as
+// /dev/fd/N. Descriptors returned earlier are listed in open_fds so the child can drop them.
+static int start_process_substitution(std::string_view substitution, std::span<const int> open_fds,
+                                      pid_t& pid)
+{
+    bool output = substitution.front() == '>';
+    std::string_view command = substitution.substr(2, substitution.size() - 3);
+
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+    {
+        std::cerr << "Error creating pipe" << std::endl;
+        return -1;
+    }
+    int child_fd = output ? pipe_fds[0] : pipe_fds[1];
+    int shell_fd = output ? pipe_fds[1] : pipe_fds[0];
+
+    std::cout.flush();
+    pid = fork();
+    if (pid == 0)
+    {
+        // Keep only the dup: a write end left open here would keep a >(...) reader from EOF
+        dup2(child_fd, output ? STDIN_FILENO : STDOUT_FILENO);
+        close(child_fd);
+        close(shell_fd);
+        for (int fd : open_fds)
+            close(fd);
+        signal(SIGPIPE, SIG_DFL);
+
+        shell_program program;
+        int status = 2;
+        if (compile_script(command, program) == compile_result::complete)
+            status = run_program(program);
+        std::cout.flush();
+        _exit(status);
+    }
+
+    close(child_fd);
+    if (pid < 0)
+    {
+        std::cerr << "Error forking process" << std::endl;
+        close(shell_fd);
+        return -1;
+    }
+    fcntl(shell_fd, F_SETFD, 0);
+    return shell_fd;
+}
+
+// Run a pipeline whose stages have process substitutions. Every substitution starts before the
+// pipeline, so producers run alongside it and each other. Once the pipeline is done the shell's
+// pipe ends are closed, which ends readers with EOF and unread producers with SIGPIPE, and the
+// substitutions are reaped.
+static int execute_with_process_substitutions(const user_input_list& u_inputs)
+{
+    user_input_list stages(u_inputs);
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+    bool started = true;
+    for (user_input& stage : stages)
+    {
+        for (size_t index : stage.process_substitutions)
         {
-            std::string operator_str = u_input.stderr_append ? " 2>> " : " 2> ";
-            full_command += operator_str + "\"" + u_input.stderr_redirect_filename + "\"";
+            pid_t pid = -1;
+            shell_string& word = stage.substitution_word(index);
+            int fd = started ? start_process_substitution(word, fds, pid) : -1;
+            started = fd >= 0;
+            if (!started)
+                break;
+            pids.push_back(pid);
+            fds.push_back(fd);
+            std::string path = "/dev/fd/" + std::to_string(fd);
+            word.assign(path.data(), path.size());
         }
+        stage.process_substitutions.clear();
+    }
+
+    int status = 1;
+    if (started)
+        status = ExecutePipeline(stages);
+    else
+        status = record_pipeline_status({&status, 1});
+
+    for (int fd : fds)
+        close(fd);
+    foreground_signals signals;
+    std::vector<int> statuses(pids.size());
+    wait_for_children(pids, statuses, signals);
+    return status;
+}
 
-        system(full_command.c_str());
+// Run a pipeline with output redirected to .gz files. Each such redirection is pointed at a
+// compressor's pipe as /dev/fd/N, which the command opens like any other target. Substitutions
+// are started before this, so only the pipeline's own stages hold the pipes and the compressors
+// see EOF once it is done.
+static int execute_with_compressed_redirects(const user_input_list& u_inputs)
+{
+    user_input_list stages(u_inputs);
+    std::vector<std::unique_ptr<compressed_output>> outputs;
+    int status = 1;
+    bool opened = true;
+    for (user_input& stage : stages)
+    {
+        std::array redirects = {std::pair{&stage.stdout_redirect_filename, stage.stdout_append},
+                                std::pair{&stage.stderr_redirect_filename, stage.stderr_append}};
+        for (auto [filename, append] : redirects)
+        {
+            if (!opened || !is_compressed_target(*filename))
+                continue;
+            outputs.push_back(std::make_unique<compressed_output>());
+            opened = outputs.back()->open(*filename, append);
+            std::string path = "/dev/fd/" + std::to_string(outputs.back()->input_fd());
+            filename->assign(path.data(), path.size());
+        }
     }
+
+    if (opened)
+        status = ExecutePipeline(stages);
     else
+        status = record_pipeline_status({&status, 1});
+
+    for (const auto& output : outputs)
     {
-        std::cerr << u_input.command << ": command not found" << std::endl;
+        if (!output->finish() && status == 0)
+        {
+            status = 1;
+            record_pipeline_status({&status, 1});
+        }
     }
+    return status;
+}
+
+int ExecutePipeline(const user_input_list& u_inputs)
+{
+    if (std::any_of(u_inputs.begin(), u_inputs.end(),
+                    [](const user_input& stage) { return stage.has_process_substitutions(); }))
+    {
+        return execute_with_process_substitutions(u_inputs);
+    }
+    if (std::any_of(u_inputs.begin(), u_inputs.end(),
+                    [](const user_input& stage)
+                    {
+                        return is_compressed_target(stage.stdout_redirect_filename) ||
+                               is_compressed_target(stage.stderr_redirect_filename);
+                    }))
+    {
+        return execute_with_compressed_redirects(u_inputs);
+    }
+
+    if (u_inputs.size() == 1)
+    {
+        // Single command, no pipeline
+        int status = ExecuteInputCommand(u_inputs[0]);
+        return record_pipeline_status({&status, 1});
+    }
+
+    std::vector<int> statuses;
+    run_pipeline_stages(u_inputs, statuses);
+    return record_pipeline_status(statuses);
 }
@@ -1,7 +1,15 @@
 #pragma once
 
+#include <sys/signalfd.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <csignal>
 #include <map>
+#include <span>
 #include <string>
+#include <string_view>
 
 #include "user_input.h"
 
@@ -9,12 +17,94 @@
 bool has_execute_permission(const std::filesystem::path& path);
 
 // Find command in PATH
-bool find_in_path(const std::string& cmd, std::string& full_path);
+bool find_in_path(std::string_view cmd, std::string& full_path);
 
 std::map<std::string, std::string> get_all_executables_in_path();
 
-// Escape quotes in a string for passing to system()
-std::string escape_for_shell(const std::string& str, bool& needs_quoting);
+// Convert a raw waitpid() status into a shell exit status (128 + signal for killed processes)
+int decode_wait_status(int raw_status);
+
+// Start an external command without waiting for it. stdin_fd/stdout_fd are wired to the child's
+// standard streams; the command's own redirections are applied on top. Uses posix_spawn, which
+// glibc implements with clone(CLONE_VM | CLONE_VFORK), so the cost does not grow with the
+// shell's RSS. Commands with a placement (cpuset/ulimit prefix) fork instead so affinity and
+// limits can be applied between fork and exec; cache_domain is the pipeline's shared domain for
+// `cpuset cache` stages. Returns -1 (after printing an error) if the command could not be started.
+pid_t spawn_external_command(const user_input& u_input, int stdin_fd = STDIN_FILENO,
+                             int stdout_fd = STDOUT_FILENO,
+                             const cpu_set_t* cache_domain = nullptr);
+
+// While foreground children run, the terminal's SIGINT and SIGQUIT go to them and to the shell
+// alike. The shell must survive them, so for the lifetime of this guard they are blocked on the
+// calling thread (and on threads it starts) and read from a signalfd in the wait loop instead.
+// Builtins that read inside the shell wait through wait_for_input, so Ctrl-C ends them too.
+class foreground_signals
+{
+   public:
+    foreground_signals();
+    foreground_signals(const foreground_signals&) = delete;
+    foreground_signals& operator=(const foreground_signals&) = delete;
+    ~foreground_signals();
+
+    int fd() const
+    {
+        return fd_;
+    }
+
+    // Read every pending signal, noting whether one was SIGINT
+    void drain();
+
+    bool interrupted() const
+    {
+        return interrupted_;
+    }
+
+    // Wait until fd is readable. Returns false once the outermost guard alive has seen SIGINT;
+    // with no guard alive there is nothing to wait for.
+    static bool wait_for_input(int fd);
+
+   private:
+    void interrupt();
+
+    sigset_t signals_;
+    sigset_t previous_;
+    int fd_ = -1;
+    // Readable from the first SIGINT on, so every waiting reader wakes up, not just the one
+    // that happened to read the signalfd
+    int interrupt_event_ = -1;
+    std::atomic<bool> interrupted_ = false;
+
+    static inline std::atomic<foreground_signals*> outermost_ = nullptr;
+};
+
+// The shell's own worker threads (compression, PATH indexing, completion) must never be the one
+// the kernel picks for the terminal's SIGINT or SIGQUIT: with no handler that ends the shell.
+// While this guard lives both are blocked on the calling thread, so threads it starts inherit the
+// mask and keep it for good.
+class worker_thread_signals
+{
+   public:
+    worker_thread_signals();
+    worker_thread_signals(const worker_thread_signals&) = delete;
+    worker_thread_signals& operator=(const worker_thread_signals&) = delete;
+    ~worker_thread_signals();
+
+   private:
+    sigset_t previous_;
+};
+
+// Wait for every child in pids (entries of -1 are skipped) and store each one's exit status at
+// the same index in statuses. Each child is tracked through its own pidfd, so only these children
+// are reaped, and one epoll loop waits on all of them and on the foreground signals.
+void wait_for_children(std::span<const pid_t> pids, std::span<int> statuses,
+                       foreground_signals& signals);
+
+// Execute external command and wait for it, returning its exit status
+int execute_external_command(const user_input& u_input);
+
+// Execute a single builtin or external command, returning its exit status
+int ExecuteInputCommand(const user_input& u_input);
 
-// Execute external command using system()
-void execute_external_command(const user_input& u_input);
+// Execute a parsed pipeline and record its stage statuses for $? and PIPESTATUS. Returns the
+// pipeline's exit status: its last stage's, or with pipefail the last non-zero one.
+int ExecutePipeline(const user_input_list& u_inputs);
@@ -0,0 +1,787 @@
+#include "shell_memo.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "shell_compiler.h"
+#include "shell_executor.h"
+#include "shell_variables.h"
+#include "shell_vm.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+constexpr uint64_t DefaultMaxSize = uint64_t(1) << 30;
+constexpr uint64_t DefaultMaxAge = 30 * 24 * 60 * 60;
+constexpr size_t CopyChunkSize = 64 * 1024;
+
+// Temporary files of runs that never finished (e.g. the shell was killed) are removed this long
+// after they were last written
+constexpr time_t StaleTempAge = 24 * 60 * 60;
+
+// 128-bit streaming hash: two lanes of multiply-rotate mixing over 8-byte words, finished with
+// murmur3's fmix64. Not cryptographic, but accidental collisions are out of reach.
+class content_hash
+{
+   public:
+    void update(std::string_view data)
+    {
+        length_ += data.size();
+        size_t i = 0;
+        // Complete the partial word the previous call left
+        while (tail_size_ > 0 && i < data.size())
+        {
+            tail_ |= static_cast<uint64_t>(static_cast<uint8_t>(data[i++])) << (8 * tail_size_);
+            if (++tail_size_ == 8)
+            {
+                mix(tail_);
+                tail_ = 0;
+                tail_size_ = 0;
+            }
+        }
+        for (; i + 8 <= data.size(); i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data.data() + i, sizeof(word));
+            mix(word);
+        }
+        for (; i < data.size(); i++)
+        {
+            tail_ |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (8 * tail_size_++);
+        }
+    }
+
+    // Length-prefixed, so consecutive fields can't run into each other
+    void update_field(std::string_view field)
+    {
+        uint64_t size = field.size();
+        update(std::string_view(reinterpret_cast<const char*>(&size), sizeof(size)));
+        update(field);
+    }
+
+    std::string hex() const
+    {
+        uint64_t a = a_;
+        uint64_t b = b_;
+        a = std::rotl((a ^ tail_) * P1, 31) * P2;
+        b = std::rotl((b ^ tail_) * P2, 33) * P1;
+        a ^= length_;
+        b ^= length_;
+        a += b;
+        b += a;
+        a = finish(a);
+        b = finish(b);
+        a += b;
+        b += a;
+
+        static constexpr char Digits[] = "0123456789abcdef";
+        std::string text(32, '0');
+        for (int i = 0; i < 16; i++)
+        {
+            text[15 - i] = Digits[(a >> (4 * i)) & 0xf];
+            text[31 - i] = Digits[(b >> (4 * i)) & 0xf];
+        }
+        return text;
+    }
+
+   private:
+    static constexpr uint64_t P1 = 0x87c37b91114253d5ull;
+    static constexpr uint64_t P2 = 0x4cf5ad432745937full;
+
+    void mix(uint64_t word)
+    {
+        a_ = std::rotl((a_ ^ word) * P1, 31) * P2;
+        a_ = std::rotl(a_, 27) * 5 + 0x52dce729;
+        b_ = std::rotl((b_ ^ word) * P2, 33) * P1;
+        b_ = std::rotl(b_, 31) * 5 + 0x38495ab5;
+    }
+
+    static uint64_t finish(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    uint64_t a_ = 0x9e3779b97f4a7c15ull;
+    uint64_t b_ = 0xc2b2ae3d27d4eb4full;
+    uint64_t length_ = 0;
+    uint64_t tail_ = 0;
+    unsigned tail_size_ = 0;
+};
+
+// Read-only mapping of a whole regular file; an empty file maps to an empty view
+class mapped_file
+{
+   public:
+    mapped_file() = default;
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file()
+    {
+        if (data_)
+            munmap(const_cast<char*>(data_), size_);
+    }
+
+    // Returns false with errno set if the file can't be mapped
+    bool open(const fs::path& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        bool mapped = fstat(fd, &st) == 0;
+        if (mapped && !S_ISREG(st.st_mode))
+        {
+            errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+            mapped = false;
+        }
+        if (mapped && st.st_size > 0)
+        {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            mapped = map != MAP_FAILED;
+            if (mapped)
+            {
+                data_ = static_cast<const char*>(map);
+                size_ = st.st_size;
+                madvise(map, size_, MADV_SEQUENTIAL);
+            }
+        }
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return mapped;
+    }
+
+    std::string_view data() const
+    {
+        return std::string_view(data_, size_);
+    }
+
+   private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+struct memo_request
+{
+    std::vector<std::string> variables;  // -e
+    std::vector<std::string> inputs;     // -i, hashed by contents
+    std::vector<std::string> stamped;    // -m, hashed by size and mtime
+    std::span<const shell_string> command;
+};
+
+// What keys/<key> holds
+struct memo_entry
+{
+    int status = 0;
+    std::string stdout_object;
+    std::string stderr_object;
+};
+
+struct memo_stats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+fs::path store_directory()
+{
+    std::string_view value;
+    if (find_variable("MEMO_DIR", value) && !value.empty())
+        return fs::path(value);
+    if (find_variable("XDG_CACHE_HOME", value) && !value.empty())
+        return fs::path(value) / "shell" / "memo";
+    if (!find_variable("HOME", value) || value.empty())
+        value = "/tmp";
+    return fs::path(value) / ".cache" / "shell" / "memo";
+}
+
+uint64_t limit_variable(std::string_view name, uint64_t fallback)
+{
+    std::string_view value;
+    uint64_t limit = 0;
+    if (!find_variable(name, value))
+        return fallback;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), limit);
+    return error == std::errc() && end == value.data() + value.size() ? limit : fallback;
+}
+
+bool write_all(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t written = write(fd, data.data(), data.size());
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data.remove_prefix(written);
+    }
+    return true;
+}
+
+// Key of a run. Returns false after printing an error if an -i file exists but can't be read.
+bool compute_key(const memo_request& request, std::string& key)
+{
+    content_hash hash;
+    hash.update_field("argv");
+    for (const shell_string& word : request.command)
+    {
+        hash.update_field(word);
+    }
+
+    std::error_code error;
+    hash.update_field("cwd");
+    hash.update_field(fs::current_path(error).native());
+
+    for (const std::string& name : request.variables)
+    {
+        std::string_view value;
+        bool set = find_variable(name, value);
+        hash.update_field(set ? "env" : "unset env");
+        hash.update_field(name);
+        hash.update_field(value);
+    }
+
+    for (const std::string& input : request.inputs)
+    {
+        mapped_file file;
+        hash.update_field(input);
+        if (file.open(input))
+        {
+            content_hash contents;
+            contents.update(file.data());
+            hash.update_field(contents.hex());
+        }
+        else if (errno == ENOENT)
+        {
+            hash.update_field("missing");
+        }
+        else
+        {
+            std::cerr << "memo: " << input << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+
+    for (const std::string& input : request.stamped)
+    {
+        struct stat st;
+        hash.update_field(input);
+        if (stat(input.c_str(), &st) != 0)
+        {
+            hash.update_field("missing");
+            continue;
+        }
+        std::array<uint64_t, 5> stamp = {
+            static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino),
+            static_cast<uint64_t>(st.st_size), static_cast<uint64_t>(st.st_mtim.tv_sec),
+            static_cast<uint64_t>(st.st_mtim.tv_nsec)};
+        hash.update_field(std::string_view(reinterpret_cast<const char*>(stamp.data()),
+                                           sizeof(stamp)));
+    }
+
+    key = hash.hex();
+    return true;
+}
+
+bool read_entry(const fs::path& path, memo_entry& entry)
+{
+    std::ifstream file(path);
+    return static_cast<bool>(file >> entry.status >> entry.stdout_object >> entry.stderr_object);
+}
+
+// Write a file in the store under its final name in one step, so readers never see it partly
+// written
+bool write_store_file(const fs::path& path, std::string_view contents)
+{
+    std::string temp = (path.parent_path() / ".tmp-XXXXXX").string();
+    int fd = mkostemp(temp.data(), O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool written = write_all(fd, contents);
+    close(fd);
+    if (!written || rename(temp.c_str(), path.c_str()) != 0)
+    {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+memo_stats read_stats(int fd)
+{
+    memo_stats stats;
+    char buffer[128];
+    ssize_t size = pread(fd, buffer, sizeof(buffer), 0);
+    const char* position = buffer;
+    const char* end = buffer + std::max<ssize_t>(size, 0);
+    for (uint64_t* counter : {&stats.hits, &stats.misses, &stats.evictions})
+    {
+        while (position < end && *position == ' ')
+            position++;
+        position = std::from_chars(position, end, *counter).ptr;
+    }
+    return stats;
+}
+
+// Add to the counters in the store's stats file. Shells sharing the store lock the file while
+// they update it.
+void add_stats(const fs::path& store, const memo_stats& delta)
+{
+    int fd = open((store / "stats").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+    flock(fd, LOCK_EX);
+    memo_stats stats = read_stats(fd);
+    std::string text = std::to_string(stats.hits + delta.hits) + " " +
+                       std::to_string(stats.misses + delta.misses) + " " +
+                       std::to_string(stats.evictions + delta.evictions) + "\n";
+    if (pwrite(fd, text.data(), text.size(), 0) == static_cast<ssize_t>(text.size()))
+        ftruncate(fd, text.size());
+    close(fd);
+}
+
+time_t modification_time(const fs::path& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_mtim.tv_sec : 0;
+}
+
+// Drop keys unused for longer than MEMO_MAX_AGE, then the least recently used ones until the
+// objects they reference fit in MEMO_MAX_SIZE, then every object no key references. Returns the
+// number of keys dropped.
+uint64_t prune_store(const fs::path& store)
+{
+    struct key_file
+    {
+        fs::path path;
+        time_t used;
+        memo_entry entry;
+    };
+
+    uint64_t max_size = limit_variable("MEMO_MAX_SIZE", DefaultMaxSize);
+    uint64_t max_age = limit_variable("MEMO_MAX_AGE", DefaultMaxAge);
+    time_t now = std::time(nullptr);
+    uint64_t evicted = 0;
+    std::error_code error;
+
+    std::vector<key_file> keys;
+    for (const fs::directory_entry& file : fs::directory_iterator(store / "keys", error))
+    {
+        std::string name = file.path().filename().string();
+        time_t used = modification_time(file.path());
+        if (name.starts_with('.'))
+        {
+            if (now - used > StaleTempAge)
+                fs::remove(file.path(), error);
+            continue;
+        }
+
+        key_file key{file.path(), used, {}};
+        if (static_cast<uint64_t>(std::max<time_t>(now - used, 0)) > max_age ||
+            !read_entry(key.path, key.entry))
+        {
+            fs::remove(key.path, error);
+            evicted++;
+            continue;
+        }
+        keys.push_back(std::move(key));
+    }
+
+    // Size of every referenced object and how many keys share it
+    struct object_use
+    {
+        uint64_t size = 0;
+        uint32_t keys = 0;
+    };
+    std::unordered_map<std::string, object_use> objects;
+    uint64_t total = 0;
+    for (const key_file& key : keys)
+    {
+        for (const std::string* name : {&key.entry.stdout_object, &key.entry.stderr_object})
+        {
+            object_use& use = objects[*name];
+            if (use.keys++ == 0)
+            {
+                uintmax_t size = fs::file_size(store / "objects" / *name, error);
+                use.size = error ? 0 : size;
+                total += use.size;
+            }
+        }
+    }
+
+    std::sort(keys.begin(), keys.end(),
+              [](const key_file& a, const key_file& b) { return a.used < b.used; });
+    for (const key_file& key : keys)
+    {
+        if (total <= max_size)
+            break;
+        fs::remove(key.path, error);
+        evicted++;
+        for (const std::string* name : {&key.entry.stdout_object, &key.entry.stderr_object})
+        {
+            object_use& use = objects[*name];
+            if (--use.keys == 0)
+                total -= use.size;
+        }
+    }
+
+    for (const fs::directory_entry& file : fs::directory_iterator(store / "objects", error))
+    {
+        std::string name = file.path().filename().string();
+        bool stale = name.starts_with('.') ? now - modification_time(file.path()) > StaleTempAge
+                                           : !objects.contains(name) || objects[name].keys == 0;
+        if (stale)
+            fs::remove(file.path(), error);
+    }
+    return evicted;
+}
+
+std::string quote_word(std::string_view word)
+{
+    std::string quoted = "'";
+    for (char c : word)
+    {
+        if (c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    quoted += '\'';
+    return quoted;
+}
+
+// One of the command's output streams while it is passed through and stored
+struct captured_stream
+{
+    std::ostream& stream;
+    int pipe_fds[2] = {-1, -1};
+    int file_fd = -1;
+    std::string temp_path;
+    content_hash hash;
+
+    explicit captured_stream(std::ostream& target) : stream(target)
+    {
+    }
+
+    bool open(const fs::path& objects)
+    {
+        temp_path = (objects / ".tmp-XXXXXX").string();
+        file_fd = mkostemp(temp_path.data(), O_CLOEXEC);
+        if (file_fd < 0)
+            temp_path.clear();
+        return file_fd >= 0 && pipe2(pipe_fds, O_CLOEXEC) == 0;
+    }
+
+    void close_all()
+    {
+        for (int* fd : {&pipe_fds[0], &pipe_fds[1], &file_fd})
+        {
+            if (*fd >= 0)
+                close(*fd);
+            *fd = -1;
+        }
+    }
+
+    // Move the temporary file to objects/<hash>, or drop it if that output is already stored.
+    // Returns the object's name.
+    std::string store(const fs::path& objects)
+    {
+        std::string name = hash.hex();
+        fs::path object = objects / name;
+        if (access(object.c_str(), F_OK) == 0 || rename(temp_path.c_str(), object.c_str()) != 0)
+            unlink(temp_path.c_str());
+        temp_path.clear();
+        return name;
+    }
+
+    ~captured_stream()
+    {
+        close_all();
+        if (!temp_path.empty())
+            unlink(temp_path.c_str());
+    }
+};
+
+// Run the command in a forked shell with its stdout and stderr on pipes, and copy both to the
+// shell's own streams and to temporary files in the store as they arrive
+int run_and_capture(const memo_request& request, captured_stream& out, captured_stream& err)
+{
+    std::string script;
+    for (const shell_string& word : request.command)
+    {
+        script += script.empty() ? "" : " ";
+        script += quote_word(word);
+    }
+
+    // The terminal's SIGINT reaches the shell too; it must only end the command
+    foreground_signals signals;
+
+    std::cout.flush();
+    std::cerr.flush();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        sigset_t interrupts;
+        sigemptyset(&interrupts);
+        sigaddset(&interrupts, SIGINT);
+        sigaddset(&interrupts, SIGQUIT);
+        pthread_sigmask(SIG_UNBLOCK, &interrupts, nullptr);
+        close(signals.fd());
+        signal(SIGPIPE, SIG_DFL);
+        dup2(out.pipe_fds[1], STDOUT_FILENO);
+        dup2(err.pipe_fds[1], STDERR_FILENO);
+        out.close_all();
+        err.close_all();
+
+        // std::cout may still point at a redirection of memo itself
+        fd_streambuf out_buf(STDOUT_FILENO);
+        fd_streambuf err_buf(STDERR_FILENO);
+        std::cout.rdbuf(&out_buf);
+        std::cerr.rdbuf(&err_buf);
+
+        shell_program program;
+        int status = 2;
+        if (compile_script(script, program) == compile_result::complete)
+            status = run_program(program);
+        std::cout.flush();
+        std::cerr.flush();
+        _exit(status);
+    }
+
+    close(out.pipe_fds[1]);
+    close(err.pipe_fds[1]);
+    out.pipe_fds[1] = -1;
+    err.pipe_fds[1] = -1;
+
+    int status = 1;
+    if (pid < 0)
+    {
+        std::cerr << "memo: Error forking process" << std::endl;
+    }
+    else
+    {
+        std::array<captured_stream*, 2> streams = {&out, &err};
+        std::array<pollfd, 2> polled = {pollfd{out.pipe_fds[0], POLLIN, 0},
+                                        pollfd{err.pipe_fds[0], POLLIN, 0}};
+        std::vector<char> buffer(CopyChunkSize);
+        while (polled[0].fd >= 0 || polled[1].fd >= 0)
+        {
+            if (poll(polled.data(), polled.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            for (size_t i = 0; i < polled.size(); i++)
+            {
+                if (polled[i].fd < 0 || polled[i].revents == 0)
+                    continue;
+                ssize_t n = read(polled[i].fd, buffer.data(), buffer.size());
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                {
+                    polled[i].fd = -1;
+                    continue;
+                }
+                std::string_view chunk(buffer.data(), n);
+                captured_stream& stream = *streams[i];
+                stream.stream.write(chunk.data(), chunk.size());
+                stream.stream.flush();
+                stream.hash.update(chunk);
+                write_all(stream.file_fd, chunk);
+            }
+        }
+
+        wait_for_children({&pid, 1}, {&status, 1}, signals);
+    }
+    return status;
+}
+
+int run_memoized(const memo_request& request)
+{
+    fs::path store = store_directory();
+    fs::path keys = store / "keys";
+    fs::path objects = store / "objects";
+    std::error_code error;
+    fs::create_directories(keys, error);
+    if (!error)
+        fs::create_directories(objects, error);
+    if (error)
+    {
+        std::cerr << "memo: " << store.string() << ": " << error.message() << std::endl;
+        return 1;
+    }
+
+    std::string key;
+    if (!compute_key(request, key))
+        return 1;
+    fs::path key_path = keys / key;
+
+    memo_entry entry;
+    mapped_file stored_out;
+    mapped_file stored_err;
+    if (read_entry(key_path, entry) && stored_out.open(objects / entry.stdout_object) &&
+        stored_err.open(objects / entry.stderr_object))
+    {
+        std::cout.write(stored_out.data().data(), stored_out.data().size());
+        std::cout.flush();
+        std::cerr.write(stored_err.data().data(), stored_err.data().size());
+        utimensat(AT_FDCWD, key_path.c_str(), nullptr, 0);
+        add_stats(store, memo_stats{1, 0, 0});
+        return entry.status;
+    }
+
+    captured_stream out(std::cout);
+    captured_stream err(std::cerr);
+    if (!out.open(objects) || !err.open(objects))
+    {
+        std::cerr << "memo: " << objects.string() << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    int status = run_and_capture(request, out, err);
+    memo_stats delta{0, 1, 0};
+    if (status <= 128)
+    {
+        std::string contents = std::to_string(status) + " " + out.store(objects) + " " +
+                               err.store(objects) + "\n";
+        write_store_file(key_path, contents);
+        delta.evictions = prune_store(store);
+    }
+    add_stats(store, delta);
+    return status;
+}
+
+int show_stats()
+{
+    fs::path store = store_directory();
+    memo_stats stats;
+    int fd = open((store / "stats").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        stats = read_stats(fd);
+        close(fd);
+    }
+
+    std::error_code error;
+    uint64_t entries = 0;
+    for (const fs::directory_entry& file : fs::directory_iterator(store / "keys", error))
+    {
+        entries += !file.path().filename().string().starts_with('.');
+    }
+    uint64_t size = 0;
+    for (const fs::directory_entry& file : fs::directory_iterator(store / "objects", error))
+    {
+        uintmax_t file_size = file.file_size(error);
+        size += error ? 0 : file_size;
+    }
+
+    uint64_t lookups = stats.hits + stats.misses;
+    std::cout << "store: " << store.string() << std::endl
+              << "entries: " << entries << std::endl
+              << "size: " << size << " bytes" << std::endl
+              << "hits: " << stats.hits << std::endl
+              << "misses: " << stats.misses << std::endl
+              << "hit rate: " << (lookups ? stats.hits * 100 / lookups : 0) << "%" << std::endl
+              << "evictions: " << stats.evictions << std::endl;
+    return 0;
+}
+}  // namespace
+
+int handle_memo(const arg_list& args)
+{
+    memo_request request;
+    char action = 0;
+    size_t i = 0;
+    for (; i < args.size(); i++)
+    {
+        std::string_view arg = args[i];
+        if (arg == "--")
+        {
+            i++;
+            break;
+        }
+        if (arg == "-s" || arg == "-p" || arg == "-c")
+        {
+            action = arg[1];
+            continue;
+        }
+        if ((arg == "-e" || arg == "-i" || arg == "-m") && i + 1 < args.size())
+        {
+            std::vector<std::string>& list = arg == "-e"   ? request.variables
+                                             : arg == "-i" ? request.inputs
+                                                           : request.stamped;
+            list.emplace_back(args[++i]);
+            continue;
+        }
+        if (arg.size() > 1 && arg.front() == '-')
+        {
+            i = args.size() + 1;
+        }
+        break;
+    }
+
+    bool has_options = !request.variables.empty() || !request.inputs.empty() ||
+                       !request.stamped.empty();
+    if (i > args.size() || (action && (has_options || i < args.size())) ||
+        (!action && i == args.size()))
+    {
+        std::cerr << "memo: usage: memo [-e name] [-i file] [-m file] [--] command [arg ...]"
+                  << std::endl
+                  << "       memo -s | -p | -c" << std::endl;
+        return 2;
+    }
+
+    if (action == 's')
+        return show_stats();
+    if (action == 'p')
+    {
+        add_stats(store_directory(), memo_stats{0, 0, prune_store(store_directory())});
+        return 0;
+    }
+    if (action == 'c')
+    {
+        fs::path store = store_directory();
+        std::error_code error;
+        fs::remove_all(store / "keys", error);
+        fs::remove_all(store / "objects", error);
+        fs::remove(store / "stats", error);
+        return 0;
+    }
+
+    request.command = std::span<const shell_string>(args.data() + i, args.size() - i);
+    return run_memoized(request);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "user_input.h"
+
+// Handle memo builtin: run a command once and replay its output on later runs.
+//
+//   memo [-e NAME]... [-i FILE]... [-m FILE]... [--] command [arg...]
+//   memo -s | -p | -c          show statistics, prune the store now, clear it
+//
+// A run's key is a hash of the command's words, the working directory, NAME=value of every -e
+// variable, the contents of every -i file and the size and mtime of every -m file. The first run
+// with a key runs the command in a forked shell, passing its stdout and stderr through while
+// storing them. Later runs with the same key write the stored stdout and then stderr from an mmap
+// and return the stored status without running anything. stdin is passed through but isn't part
+// of the key, and runs ending with a status above 128 (killed by a signal) aren't stored.
+//
+// The store lives in $MEMO_DIR, else $XDG_CACHE_HOME/shell/memo or ~/.cache/shell/memo, and is
+// content addressed: objects/ holds every distinct output once, named by its hash, and keys/ maps
+// a key to its status and output objects. A key's mtime is its last use. After every stored run,
+// keys unused for $MEMO_MAX_AGE seconds (default 30 days) are dropped, then the least recently
+// used ones until the objects fit in $MEMO_MAX_SIZE bytes (default 1 GiB).
+int handle_memo(const arg_list& args);
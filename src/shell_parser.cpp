@@ -1,12 +1,408 @@
 #include "shell_parser.h"
 
+#include <cctype>
+#include <charconv>
+#include <cstdio>
 #include <iostream>
+#include <utility>
 
-std::string extract_quoted_string(const std::string& input, size_t& i)
+#include "shell_commands.h"
+#include "shell_variables.h"
+
+namespace
+{
+// Evaluates the integer expression of $((...)): + - * / %, comparisons, && ||, ! and unary
+// minus, parentheses, and variables by name (with or without '$'). Unset or non-numeric variables
+// count as 0, as in sh. Results wrap around on overflow, as in bash, instead of being undefined.
+class arithmetic_evaluator
+{
+   public:
+    explicit arithmetic_evaluator(std::string_view text) : text_(text)
+    {
+    }
+
+    // Returns false and sets error if the expression is malformed
+    bool evaluate(long long& value, const char*& error)
+    {
+        value = parse_or();
+        skip_spaces();
+        if (!error_ && pos_ != text_.size())
+            error_ = "syntax error in expression";
+        error = error_;
+        return error_ == nullptr;
+    }
+
+   private:
+    // Two's complement arithmetic on the unsigned values, which is defined to wrap
+    static long long wrap(unsigned long long value)
+    {
+        return static_cast<long long>(value);
+    }
+
+    void skip_spaces()
+    {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_])))
+            pos_++;
+    }
+
+    bool take(std::string_view op)
+    {
+        skip_spaces();
+        if (!text_.substr(pos_).starts_with(op))
+            return false;
+        // A one-character operator must not be the start of a two-character one
+        if (op.size() == 1)
+        {
+            std::string_view pair = text_.substr(pos_, 2);
+            for (std::string_view longer : {"<=", ">=", "==", "!=", "&&", "||"})
+            {
+                if (pair == longer)
+                    return false;
+            }
+        }
+        pos_ += op.size();
+        return true;
+    }
+
+    long long parse_or()
+    {
+        long long value = parse_and();
+        while (take("||"))
+        {
+            long long right = parse_and();
+            value = value || right;
+        }
+        return value;
+    }
+
+    long long parse_and()
+    {
+        long long value = parse_equality();
+        while (take("&&"))
+        {
+            long long right = parse_equality();
+            value = value && right;
+        }
+        return value;
+    }
+
+    long long parse_equality()
+    {
+        long long value = parse_relational();
+        while (true)
+        {
+            if (take("=="))
+                value = value == parse_relational();
+            else if (take("!="))
+                value = value != parse_relational();
+            else
+                return value;
+        }
+    }
+
+    long long parse_relational()
+    {
+        long long value = parse_additive();
+        while (true)
+        {
+            if (take("<="))
+                value = value <= parse_additive();
+            else if (take(">="))
+                value = value >= parse_additive();
+            else if (take("<"))
+                value = value < parse_additive();
+            else if (take(">"))
+                value = value > parse_additive();
+            else
+                return value;
+        }
+    }
+
+    long long parse_additive()
+    {
+        long long value = parse_multiplicative();
+        while (true)
+        {
+            if (take("+"))
+                value = wrap(static_cast<unsigned long long>(value) + parse_multiplicative());
+            else if (take("-"))
+                value = wrap(static_cast<unsigned long long>(value) - parse_multiplicative());
+            else
+                return value;
+        }
+    }
+
+    long long parse_multiplicative()
+    {
+        long long value = parse_unary();
+        while (true)
+        {
+            char op = 0;
+            if (take("*"))
+                op = '*';
+            else if (take("/"))
+                op = '/';
+            else if (take("%"))
+                op = '%';
+            else
+                return value;
+
+            long long right = parse_unary();
+            if (op == '*')
+            {
+                value = wrap(static_cast<unsigned long long>(value) * right);
+            }
+            else if (right == 0)
+            {
+                error_ = error_ ? error_ : "division by 0";
+                return 0;
+            }
+            else if (right == -1)
+            {
+                // LLONG_MIN / -1 traps; the quotient wraps back to LLONG_MIN instead
+                value = op == '/' ? wrap(0ull - value) : 0;
+            }
+            else
+            {
+                value = op == '/' ? value / right : value % right;
+            }
+        }
+    }
+
+    long long parse_unary()
+    {
+        if (take("-"))
+            return wrap(0ull - parse_unary());
+        if (take("+"))
+            return parse_unary();
+        if (take("!"))
+            return !parse_unary();
+        return parse_primary();
+    }
+
+    long long parse_primary()
+    {
+        skip_spaces();
+        if (take("("))
+        {
+            long long value = parse_or();
+            if (!take(")"))
+                error_ = error_ ? error_ : "missing `)'";
+            return value;
+        }
+
+        if (pos_ < text_.size() && std::isdigit(static_cast<unsigned char>(text_[pos_])))
+        {
+            long long value = 0;
+            auto [end, error] = std::from_chars(text_.data() + pos_, text_.data() + text_.size(),
+                                                value);
+            pos_ = end - text_.data();
+            if (error == std::errc::result_out_of_range)
+                error_ = error_ ? error_ : "number out of range";
+            return value;
+        }
+
+        if (pos_ < text_.size() && text_[pos_] == '$')
+            pos_++;
+        size_t start = pos_;
+        while (pos_ < text_.size() &&
+               (std::isalnum(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '_'))
+            pos_++;
+        std::string_view name = text_.substr(start, pos_ - start);
+        if (!is_variable_name(name))
+        {
+            error_ = error_ ? error_ : "syntax error: operand expected";
+            return 0;
+        }
+
+        std::string_view value;
+        long long number = 0;
+        if (find_variable(name, value))
+            std::from_chars(value.data(), value.data() + value.size(), number);
+        return number;
+    }
+
+    std::string_view text_;
+    size_t pos_ = 0;
+    const char* error_ = nullptr;
+};
+}  // namespace
+
+// Set when an expansion fails, until take_expansion_error() reads it
+static bool expansion_failed = false;
+
+bool take_expansion_error()
+{
+    return std::exchange(expansion_failed, false);
+}
+
+// Expand the parameter starting at input[i] ('$') into result: $?, ${?}, $PIPESTATUS,
+// ${PIPESTATUS[N]}, ${PIPESTATUS[@]}, positional parameters ($1, $#, $@), variables ($NAME,
+// ${NAME}) and arithmetic ($((...))). On success leaves i on the parameter's last character;
+// anything else (e.g. a lone '$') is left for the caller to copy literally.
+static bool expand_parameter(std::string_view input, size_t& i, shell_string& result)
+{
+    std::string_view rest = input.substr(i + 1);
+    bool braced = rest.starts_with('{');
+    size_t length = 0;
+    std::string_view name = rest;
+    if (braced)
+    {
+        length = rest.find('}');
+        if (length == std::string_view::npos)
+            return false;
+        name = rest.substr(1, length - 1);
+        length++;
+    }
+
+    auto append_number = [&](int value)
+    {
+        char digits[16];
+        int count = snprintf(digits, sizeof(digits), "%d", value);
+        result.append(digits, count);
+    };
+
+    const std::vector<int>& statuses = pipeline_statuses();
+    if (name.starts_with('?') && (!braced || name.size() == 1))
+    {
+        append_number(last_exit_status());
+        length = braced ? length : 1;
+    }
+    else if (!braced && name.starts_with("PIPESTATUS") &&
+             (name.size() == 10 || !(std::isalnum(static_cast<unsigned char>(name[10])) ||
+                                     name[10] == '_')))
+    {
+        append_number(statuses.front());
+        length = std::string_view("PIPESTATUS").size();
+    }
+    else if (braced && name == "PIPESTATUS")
+    {
+        append_number(statuses.front());
+    }
+    else if (braced && (name == "PIPESTATUS[@]" || name == "PIPESTATUS[*]"))
+    {
+        for (size_t s = 0; s < statuses.size(); s++)
+        {
+            if (s > 0)
+                result += ' ';
+            append_number(statuses[s]);
+        }
+    }
+    else if (braced && name.starts_with("PIPESTATUS[") && name.ends_with(']'))
+    {
+        std::string_view index_text = name.substr(11, name.size() - 12);
+        size_t index = 0;
+        if (index_text.empty() || index_text.size() > 9)
+            return false;
+        for (char c : index_text)
+        {
+            if (c < '0' || c > '9')
+                return false;
+            index = index * 10 + (c - '0');
+        }
+        // Out-of-range elements expand to nothing, as in bash
+        if (index < statuses.size())
+            append_number(statuses[index]);
+    }
+    else if (!braced && name.starts_with("(("))
+    {
+        // $((...)): find the parenthesis that closes the outer pair, which must be doubled
+        size_t depth = 0;
+        size_t end = 0;
+        for (; end < name.size(); end++)
+        {
+            depth += name[end] == '(';
+            depth -= name[end] == ')';
+            if (depth == 0)
+                break;
+        }
+        if (end == name.size() || name[end - 1] != ')')
+            return false;
+
+        // Parameters inside are expanded first, so $1 and ${N} work as well as bare names
+        std::string_view text = name.substr(2, end - 3);
+        shell_string expression(result.get_allocator());
+        for (size_t j = 0; j < text.size(); j++)
+        {
+            if (text[j] != '$' || !expand_parameter(text, j, expression))
+                expression += text[j];
+        }
+
+        long long value = 0;
+        const char* error = nullptr;
+        if (arithmetic_evaluator(expression).evaluate(value, error))
+        {
+            result += std::to_string(value);
+        }
+        else
+        {
+            std::cerr << "shell: " << expression << ": " << error << std::endl;
+            expansion_failed = true;
+        }
+        length = end + 1;
+    }
+    else if ((!braced && !name.empty() && name[0] >= '0' && name[0] <= '9') ||
+             (braced && !name.empty() &&
+              name.find_first_not_of("0123456789") == std::string_view::npos))
+    {
+        // Positional parameters: $1 to $9, or ${N} for any N. $0 is the shell itself.
+        size_t index = 0;
+        std::from_chars(name.data(), name.data() + (braced ? name.size() : 1), index);
+        const std::vector<std::string>& parameters = positional_parameters();
+        if (index == 0)
+            result += "shell";
+        else if (index <= parameters.size())
+            result += parameters[index - 1];
+        length = braced ? length : 1;
+    }
+    else if ((!braced && !name.empty() && (name[0] == '#' || name[0] == '@' || name[0] == '*')) ||
+             (braced && (name == "#" || name == "@" || name == "*")))
+    {
+        const std::vector<std::string>& parameters = positional_parameters();
+        if (name[0] == '#')
+        {
+            append_number(static_cast<int>(parameters.size()));
+        }
+        else
+        {
+            for (size_t p = 0; p < parameters.size(); p++)
+            {
+                if (p > 0)
+                    result += ' ';
+                result += parameters[p];
+            }
+        }
+        length = braced ? length : 1;
+    }
+    else
+    {
+        // $NAME or ${NAME}; unset variables expand to nothing
+        if (!braced)
+        {
+            length = 0;
+            while (length < name.size() &&
+                   (std::isalnum(static_cast<unsigned char>(name[length])) ||
+                    name[length] == '_'))
+                length++;
+            name = name.substr(0, length);
+        }
+        if (!is_variable_name(name))
+            return false;
+
+        std::string_view value;
+        if (find_variable(name, value))
+            result += value;
+    }
+
+    i += length;
+    return true;
+}
+
+bool extract_quoted_string(std::string_view input, size_t& i, shell_string& result)
 {
-    std::string result;
     bool in_single_quote = false;
     bool in_double_quote = false;
+    bool quoted = false;
 
     while (i < input.size())
     {
@@ -15,13 +411,16 @@ std::string extract_quoted_string(const std::string& input, size_t& i)
         if (c == '\'' && !in_double_quote)
         {
             in_single_quote = !in_single_quote;
+            quoted = true;
         }
         else if (c == '"' && !in_single_quote)
         {
             in_double_quote = !in_double_quote;
+            quoted = true;
         }
         else if (c == '\\' && !in_single_quote && i + 1 < input.size())
         {
+            quoted = true;
             // Handle escapes: in double quotes only for special chars, outside quotes for all
             bool should_escape =
                 !in_double_quote || EscapedCharsInDoubleQuotes.contains(input[i + 1]);
@@ -34,6 +433,10 @@ std::string extract_quoted_string(const std::string& input, size_t& i)
                 result += c;  // Add backslash literally
             }
         }
+        else if (c == '$' && !in_single_quote && expand_parameter(input, i, result))
+        {
+            // Expanded in place; i is on the parameter's last character
+        }
         else if (c == ' ' && !in_single_quote && !in_double_quote)
         {
             break;  // End of this token
@@ -45,16 +448,75 @@ std::string extract_quoted_string(const std::string& input, size_t& i)
 
         i++;
     }
+    return quoted;
+}
 
-    return result;
+// Index just past the parenthesis that closes the one at input[open], skipping quoted text, or
+// npos if it is never closed
+static size_t skip_parenthesized(std::string_view input, size_t open)
+{
+    size_t depth = 0;
+    char quote = 0;
+    for (size_t i = open; i < input.size(); i++)
+    {
+        char c = input[i];
+        if (quote)
+        {
+            if (c == '\\' && quote == '"')
+                i++;
+            else if (c == quote)
+                quote = 0;
+        }
+        else if (c == '\\')
+        {
+            i++;
+        }
+        else if (c == '\'' || c == '"')
+        {
+            quote = c;
+        }
+        else if (c == '(')
+        {
+            depth++;
+        }
+        else if (c == ')' && --depth == 0)
+        {
+            return i + 1;
+        }
+    }
+    return std::string_view::npos;
+}
+
+// Length of the <(...) or >(...) process substitution starting at input[i], or 0
+static size_t process_substitution_length(std::string_view input, size_t i)
+{
+    std::string_view rest = input.substr(i);
+    if (!rest.starts_with("<(") && !rest.starts_with(">("))
+        return 0;
+    size_t end = skip_parenthesized(input, i + 1);
+    return end == std::string_view::npos ? 0 : end - i;
 }
 
-void parse_input(const std::string& input, user_input& u_input)
+// Length of the unquoted >, >>, 1>, 1>>, 2> or 2>> starting at input[i], or 0
+static size_t redirection_operator_length(std::string_view input, size_t i)
+{
+    size_t length = i < input.size() && (input[i] == '1' || input[i] == '2') ? 1 : 0;
+    if (i + length >= input.size() || input[i + length] != '>')
+        return 0;
+    length++;
+    if (i + length < input.size() && input[i + length] == '>')
+        length++;
+    return length;
+}
+
+void parse_input(std::string_view input, user_input& u_input)
 {
     u_input.command.clear();
     u_input.args.clear();
     u_input.stdout_redirect_filename.clear();
     u_input.stderr_redirect_filename.clear();
+    u_input.placement.clear();
+    u_input.process_substitutions.clear();
 
     size_t i = 0;
 
@@ -66,7 +528,7 @@ void parse_input(const std::string& input, user_input& u_input)
         i++;
 
     // Extract command
-    u_input.command = extract_quoted_string(input, i);
+    extract_quoted_string(input, i, u_input.command);
 
     // Skip whitespace after command
     while (i < input.size() && input[i] == ' ')
@@ -75,90 +537,142 @@ void parse_input(const std::string& input, user_input& u_input)
     // Extract arguments
     while (i < input.size())
     {
-        std::string arg = extract_quoted_string(input, i);
-        if (!arg.empty())
+        // Process substitutions are kept as written; the executor starts them
+        if (size_t length = process_substitution_length(input, i))
         {
-            u_input.args.push_back(arg);
+            u_input.process_substitutions.push_back(u_input.args.size());
+            u_input.args.emplace_back(input.substr(i, length));
+            i += length;
+            while (i < input.size() && input[i] == ' ')
+                i++;
+            continue;
+        }
+
+        // The word after a redirection operator, spaced or not, is its target
+        if (size_t length = redirection_operator_length(input, i))
+        {
+            std::string_view op = input.substr(i, length);
+            bool to_stdout = !op.starts_with('2');
+            i += length;
+            while (i < input.size() && input[i] == ' ')
+                i++;
+            if (i == input.size())
+            {
+                std::cerr << "Error: No filename provided for redirection" << std::endl;
+                break;
+            }
+            shell_string& target =
+                to_stdout ? u_input.stdout_redirect_filename : u_input.stderr_redirect_filename;
+            (to_stdout ? u_input.stdout_append : u_input.stderr_append) = op.ends_with(">>");
+            size_t marker = to_stdout ? user_input::StdoutTargetSubstitution
+                                      : user_input::StderrTargetSubstitution;
+            std::erase(u_input.process_substitutions, marker);
+            target.clear();
+            if (size_t substitution = process_substitution_length(input, i))
+            {
+                // Redirected into a process substitution, started by the executor like an arg
+                u_input.process_substitutions.push_back(marker);
+                target = input.substr(i, substitution);
+                i += substitution;
+            }
+            else
+            {
+                extract_quoted_string(input, i, target);
+            }
+            while (i < input.size() && input[i] == ' ')
+                i++;
+            continue;
+        }
+
+        // Extract straight into the argument list so the string lands in the line's arena
+        shell_string& arg = u_input.args.emplace_back();
+        // An expansion to nothing is no word at all, but '' and "" are empty words
+        if (!extract_quoted_string(input, i, arg) && arg.empty())
+        {
+            u_input.args.pop_back();
         }
         // Skip whitespace between arguments
         while (i < input.size() && input[i] == ' ')
             i++;
     }
 
-    if (u_input.has_arguments())
+    // `cpuset` / `ulimit` prefixes describe how the real command runs. They are taken off the
+    // front of args, which shifts the substitutions after them.
+    size_t arg_count = u_input.args.size();
+    extract_stage_prefixes(u_input);
+    size_t shift = arg_count - u_input.args.size();
+    if (shift > 0)
     {
-        // check for redirection operator
-        for (size_t j = 0; j < u_input.args.size(); j++)
+        std::erase_if(u_input.process_substitutions,
+                      [shift](size_t index) { return index < shift; });
+        for (size_t& index : u_input.process_substitutions)
         {
-            if (u_input.args[j] == ">" || u_input.args[j] == "1>" || u_input.args[j] == ">>" ||
-                u_input.args[j] == "1>>")
-            {
-                if (j + 1 < u_input.args.size())
-                {
-                    u_input.stdout_redirect_filename = u_input.args[j + 1];
-                    u_input.stdout_append = u_input.args[j] == ">>" || u_input.args[j] == "1>>";
-                    // Remove redirection operator and filename from args
-                    u_input.args.erase(u_input.args.begin() + j, u_input.args.begin() + j + 2);
-                }
-                else
-                {
-                    std::cerr << "Error: No filename provided for redirection" << std::endl;
-                }
-            }
-            else if (u_input.args[j] == "2>" || u_input.args[j] == "2>>")
-            {
-                if (j + 1 < u_input.args.size())
-                {
-                    u_input.stderr_redirect_filename = u_input.args[j + 1];
-                    u_input.stderr_append = u_input.args[j] == "2>>";
-                    // Remove redirection operator and filename from args
-                    u_input.args.erase(u_input.args.begin() + j, u_input.args.begin() + j + 2);
-                }
-                else
-                {
-                    std::cerr << "Error: No filename provided for redirection" << std::endl;
-                }
-            }
+            if (index < user_input::StderrTargetSubstitution)
+                index -= shift;
         }
     }
 }
 
-void parse_pipeline_input(const std::string& input, std::vector<user_input>& u_inputs)
+// Position of the next '|' that separates pipeline stages, skipping quotes and the insides of
+// process substitutions and $(...), or npos
+static size_t find_stage_separator(std::string_view input, size_t start)
+{
+    char quote = 0;
+    for (size_t i = start; i < input.size(); i++)
+    {
+        char c = input[i];
+        if (quote)
+        {
+            if (c == '\\' && quote == '"')
+                i++;
+            else if (c == quote)
+                quote = 0;
+        }
+        else if (c == '\\')
+        {
+            i++;
+        }
+        else if (c == '\'' || c == '"')
+        {
+            quote = c;
+        }
+        else if (c == '(' && i > 0 && (input[i - 1] == '<' || input[i - 1] == '>' ||
+                                       input[i - 1] == '$'))
+        {
+            size_t end = skip_parenthesized(input, i);
+            if (end == std::string_view::npos)
+                return std::string_view::npos;
+            i = end - 1;
+        }
+        else if (c == '|')
+        {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+void parse_pipeline_input(std::string_view input, user_input_list& u_inputs)
 {
     u_inputs.clear();
 
     if (input.empty())
         return;
 
-    if (input.find('|') == std::string::npos)
-    {
-        // No pipeline, parse normally
-        user_input u_input;
-        parse_input(input, u_input);
-
-        u_inputs.push_back(u_input);
-        return;
-    }
-
-    size_t pos = input.find('|');
+    // Segments are views into input; each stage is constructed in place with u_inputs' allocator
     size_t start = 0;
-    while (pos != std::string::npos)
+    size_t pos = find_stage_separator(input, 0);
+    while (pos != std::string_view::npos)
     {
-        std::string segment = input.substr(start, pos - start);
-        user_input u_input;
-        parse_input(segment, u_input);
-        u_inputs.push_back(u_input);
+        parse_input(input.substr(start, pos - start), u_inputs.emplace_back());
 
         start = pos + 1;
-        pos = input.find('|', start);
+        pos = find_stage_separator(input, start);
     }
 
     // Handle the last segment after the final '|'
     if (start < input.size())
     {
-        std::string segment = input.substr(start);
-        user_input u_input;
-        parse_input(segment, u_input);
-        u_inputs.push_back(u_input);
+        parse_input(input.substr(start), u_inputs.emplace_back());
     }
-}
\ No newline at end of file
+}
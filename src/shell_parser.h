@@ -1,16 +1,23 @@
 #pragma once
 
-#include <string>
+#include <string_view>
 
 #include "user_input.h"
 
 // Extract a quoted/escaped string from input starting at position i
-// Returns the processed string (without outer quotes) and advances i
-std::string extract_quoted_string(const std::string& input, size_t& i);
+// Appends the processed string (without outer quotes) to result and advances i
+// Returns true if any of it was quoted or escaped, so that an empty result is still a word
+bool extract_quoted_string(std::string_view input, size_t& i, shell_string& result);
 
 // Parse input string into command and arguments
-void parse_input(const std::string& input, user_input& u_input);
+void parse_input(std::string_view input, user_input& u_input);
 
 // Parse input that may contain pipelines
-// Splits by '|' and calls parse_input on each segment
-void parse_pipeline_input(const std::string& input, std::vector<user_input>& u_inputs);
+// Splits by '|' (outside quotes and parentheses) and calls parse_input on each segment. Stages
+// are allocated with u_inputs' allocator.
+void parse_pipeline_input(std::string_view input, user_input_list& u_inputs);
+
+// Whether an expansion failed since the last call, e.g. $((1 / 0)); the error is already
+// printed. Clears the flag. A command whose words failed to expand isn't run and fails with
+// status 1.
+bool take_expansion_error();
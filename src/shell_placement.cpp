@@ -0,0 +1,423 @@
+#include "shell_placement.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "user_input.h"
+
+namespace
+{
+// A resource ulimit knows about, with the unit its values are given in (as in bash)
+struct limit_option
+{
+    char flag;
+    int resource;
+    rlim_t unit;
+    const char* description;
+    const char* unit_name;
+};
+
+constexpr std::array<limit_option, 10> LimitOptions = {{
+    {'c', RLIMIT_CORE, 1024, "core file size", "blocks"},
+    {'d', RLIMIT_DATA, 1024, "data seg size", "kbytes"},
+    {'f', RLIMIT_FSIZE, 1024, "file size", "blocks"},
+    {'l', RLIMIT_MEMLOCK, 1024, "max locked memory", "kbytes"},
+    {'m', RLIMIT_RSS, 1024, "max memory size", "kbytes"},
+    {'n', RLIMIT_NOFILE, 1, "open files", nullptr},
+    {'s', RLIMIT_STACK, 1024, "stack size", "kbytes"},
+    {'t', RLIMIT_CPU, 1, "cpu time", "seconds"},
+    {'u', RLIMIT_NPROC, 1, "max user processes", nullptr},
+    {'v', RLIMIT_AS, 1024, "virtual memory", "kbytes"},
+}};
+
+const limit_option* find_limit_option(char flag)
+{
+    for (const auto& option : LimitOptions)
+    {
+        if (option.flag == flag)
+            return &option;
+    }
+    return nullptr;
+}
+
+// `ulimit [-SH] [-a] [-cdflmnstuv] [limit [command args...]]`
+struct ulimit_request
+{
+    bool soft = false;
+    bool hard = false;
+    bool all = false;
+    std::vector<const limit_option*> options;
+    bool has_value = false;
+    rlim_t value = RLIM_INFINITY;
+    size_t command_start = 0;  // Index of a trailing command in args, args.size() if none
+};
+
+bool parse_ulimit(const arg_list& args, ulimit_request& request, std::string& error)
+{
+    size_t i = 0;
+    for (; i < args.size(); i++)
+    {
+        std::string_view arg = args[i];
+        if (arg == "--")
+        {
+            i++;
+            break;
+        }
+        if (arg.size() < 2 || arg[0] != '-')
+            break;
+
+        for (char flag : arg.substr(1))
+        {
+            if (flag == 'S')
+                request.soft = true;
+            else if (flag == 'H')
+                request.hard = true;
+            else if (flag == 'a')
+                request.all = true;
+            else if (const limit_option* option = find_limit_option(flag))
+                request.options.push_back(option);
+            else
+            {
+                error = std::string("-") + flag + ": invalid option";
+                return false;
+            }
+        }
+    }
+
+    if (request.options.empty())
+        request.options.push_back(find_limit_option('f'));
+
+    if (i < args.size())
+    {
+        std::string_view text = args[i++];
+        request.has_value = true;
+        if (text != "unlimited")
+        {
+            // Scaled by the unit, the value must stay below RLIM_INFINITY
+            rlim_t number = 0;
+            rlim_t unit = request.options.front()->unit;
+            auto [end, parse_error] = std::from_chars(text.data(), text.data() + text.size(),
+                                                      number);
+            if (parse_error != std::errc() || end != text.data() + text.size() ||
+                number > (RLIM_INFINITY - 1) / unit)
+            {
+                error = std::string(text) + ": invalid number";
+                return false;
+            }
+            request.value = number * unit;
+        }
+    }
+    request.command_start = i;
+    return true;
+}
+
+std::string format_limit(rlim_t value, rlim_t unit)
+{
+    return value == RLIM_INFINITY ? "unlimited" : std::to_string(value / unit);
+}
+
+std::string format_cpu_list(const cpu_set_t& cpus)
+{
+    std::string result;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &cpus))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpus))
+            last++;
+        if (!result.empty())
+            result += ',';
+        result += std::to_string(cpu);
+        if (last > cpu)
+            result += "-" + std::to_string(last);
+        cpu = last;
+    }
+    return result;
+}
+
+// Number of args a `cpuset` prefix consumes before its command, 0 if it isn't a valid prefix
+size_t cpuset_prefix_length(const user_input& u_input, stage_placement& placement)
+{
+    if (u_input.args.size() < 2)
+        return 0;
+
+    if (u_input.args[0] == "cache")
+    {
+        placement.pin_cpus = false;
+        placement.share_cache = true;
+        return 1;
+    }
+
+    cpu_set_t cpus;
+    if (!parse_cpu_list(u_input.args[0], cpus))
+        return 0;
+    placement.pin_cpus = true;
+    placement.share_cache = false;
+    placement.cpus = cpus;
+    return 1;
+}
+
+// Number of args a `ulimit` prefix consumes before its command, 0 if it isn't a valid prefix
+size_t ulimit_prefix_length(const user_input& u_input, stage_placement& placement)
+{
+    ulimit_request request;
+    std::string error;
+    if (!parse_ulimit(u_input.args, request, error) || request.all || !request.has_value ||
+        request.options.size() != 1 || request.command_start >= u_input.args.size())
+    {
+        return 0;
+    }
+
+    bool both = !request.soft && !request.hard;
+    placement.limits.push_back(resource_limit{request.options.front()->resource, request.value,
+                                              request.soft || both, request.hard || both});
+    return request.command_start;
+}
+}  // namespace
+
+void extract_stage_prefixes(user_input& u_input)
+{
+    while (true)
+    {
+        size_t consumed = 0;
+        if (u_input.command == "cpuset")
+            consumed = cpuset_prefix_length(u_input, u_input.placement);
+        else if (u_input.command == "ulimit")
+            consumed = ulimit_prefix_length(u_input, u_input.placement);
+
+        if (consumed == 0)
+            return;
+
+        // The first argument after the prefix becomes the command
+        u_input.command = std::move(u_input.args[consumed]);
+        u_input.args.erase(u_input.args.begin(), u_input.args.begin() + consumed + 1);
+    }
+}
+
+bool parse_cpu_list(std::string_view list, cpu_set_t& cpus)
+{
+    CPU_ZERO(&cpus);
+    if (list.empty())
+        return false;
+
+    size_t pos = 0;
+    while (pos <= list.size())
+    {
+        size_t comma = list.find(',', pos);
+        std::string_view item = list.substr(pos, comma == std::string_view::npos ? list.npos
+                                                                                 : comma - pos);
+        size_t dash = item.find('-');
+        std::string_view first_text = item.substr(0, dash);
+        std::string_view last_text =
+            dash == std::string_view::npos ? first_text : item.substr(dash + 1);
+
+        auto parse_cpu = [](std::string_view text, int& cpu)
+        {
+            if (text.empty() || text.size() > 5)
+                return false;
+            cpu = 0;
+            for (char c : text)
+            {
+                if (c < '0' || c > '9')
+                    return false;
+                cpu = cpu * 10 + (c - '0');
+            }
+            return cpu < CPU_SETSIZE;
+        };
+
+        int first = 0;
+        int last = 0;
+        if (!parse_cpu(first_text, first) || !parse_cpu(last_text, last) || last < first)
+            return false;
+        for (int cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, &cpus);
+
+        if (comma == std::string_view::npos)
+            break;
+        pos = comma + 1;
+    }
+    return CPU_COUNT(&cpus) > 0;
+}
+
+bool current_cache_domain(cpu_set_t& cpus)
+{
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        return false;
+
+    // The highest cache level listed for this CPU is the one shared most widely
+    int best_level = -1;
+    std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+    for (int index = 0; index < 10; index++)
+    {
+        std::ifstream level_file(base + std::to_string(index) + "/level");
+        std::ifstream shared_file(base + std::to_string(index) + "/shared_cpu_list");
+        int level = 0;
+        std::string shared;
+        if (!(level_file >> level) || !(shared_file >> shared))
+            continue;
+
+        cpu_set_t domain;
+        if (level > best_level && parse_cpu_list(shared, domain))
+        {
+            best_level = level;
+            cpus = domain;
+        }
+    }
+    return best_level >= 0;
+}
+
+bool apply_placement(const stage_placement& placement, const cpu_set_t* cache_domain,
+                     const char*& error)
+{
+    const cpu_set_t* cpus = nullptr;
+    if (placement.pin_cpus)
+        cpus = &placement.cpus;
+    else if (placement.share_cache)
+        cpus = cache_domain;
+
+    if (cpus && sched_setaffinity(0, sizeof(*cpus), cpus) != 0)
+    {
+        error = "cpuset: cannot set CPU affinity";
+        return false;
+    }
+
+    for (const auto& limit : placement.limits)
+    {
+        rlimit current;
+        getrlimit(limit.resource, &current);
+        if (limit.soft)
+            current.rlim_cur = limit.value;
+        if (limit.hard)
+            current.rlim_max = limit.value;
+        if (setrlimit(limit.resource, &current) != 0)
+        {
+            error = "ulimit: cannot modify limit";
+            return false;
+        }
+    }
+    return true;
+}
+
+int handle_ulimit(const arg_list& args)
+{
+    ulimit_request request;
+    std::string error;
+    if (!parse_ulimit(args, request, error))
+    {
+        std::cerr << "ulimit: " << error << std::endl;
+        return 2;
+    }
+    if (request.command_start < args.size())
+    {
+        std::cerr << "ulimit: too many arguments" << std::endl;
+        return 2;
+    }
+
+    if (request.all)
+    {
+        // Same layout as bash: the "(unit, -x)" column is right-aligned to a fixed width
+        for (const auto& option : LimitOptions)
+        {
+            std::string unit = std::string("(") +
+                               (option.unit_name ? std::string(option.unit_name) + ", " : "") +
+                               "-" + option.flag + ")";
+            std::string label = option.description;
+            label.resize(std::max<size_t>(label.size() + 1, 40 - unit.size()), ' ');
+
+            rlimit current;
+            getrlimit(option.resource, &current);
+            std::cout << label << unit << " "
+                      << format_limit(request.hard ? current.rlim_max : current.rlim_cur,
+                                      option.unit)
+                      << std::endl;
+        }
+        return 0;
+    }
+
+    if (!request.has_value)
+    {
+        // Show: soft limits unless -H was given
+        for (const limit_option* option : request.options)
+        {
+            rlimit current;
+            getrlimit(option->resource, &current);
+            if (request.options.size() > 1)
+                std::cout << option->description << " (-" << option->flag << ") ";
+            std::cout << format_limit(request.hard ? current.rlim_max : current.rlim_cur,
+                                      option->unit)
+                      << std::endl;
+        }
+        return 0;
+    }
+
+    // Set: both soft and hard unless one was named
+    bool both = !request.soft && !request.hard;
+    stage_placement placement;
+    placement.limits.push_back(resource_limit{request.options.front()->resource, request.value,
+                                              request.soft || both, request.hard || both});
+    const char* error_message = nullptr;
+    if (!apply_placement(placement, nullptr, error_message))
+    {
+        std::cerr << error_message << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int handle_cpuset(const arg_list& args)
+{
+    if (args.empty())
+    {
+        cpu_set_t cpus;
+        if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0)
+        {
+            std::cerr << "cpuset: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        std::cout << format_cpu_list(cpus) << std::endl;
+        return 0;
+    }
+
+    // A valid prefix with a command never reaches the builtin, so anything left is either the
+    // shell's own new affinity or a usage error
+    if (args.size() > 1)
+    {
+        std::cerr << "cpuset: " << args[0] << ": invalid CPU list" << std::endl;
+        return 2;
+    }
+
+    stage_placement placement;
+    cpu_set_t cache_domain;
+    bool have_cache_domain = false;
+    if (args[0] == "cache")
+    {
+        placement.share_cache = true;
+        have_cache_domain = current_cache_domain(cache_domain);
+    }
+    else if (parse_cpu_list(args[0], placement.cpus))
+    {
+        placement.pin_cpus = true;
+    }
+    else
+    {
+        std::cerr << "cpuset: " << args[0] << ": invalid CPU list" << std::endl;
+        return 2;
+    }
+    const char* error_message = nullptr;
+    if (!apply_placement(placement, have_cache_domain ? &cache_domain : nullptr, error_message))
+    {
+        std::cerr << error_message << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    return 0;
+}
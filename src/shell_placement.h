@@ -0,0 +1,99 @@
+#pragma once
+
+#include <sched.h>
+#include <sys/resource.h>
+
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct user_input;
+using arg_list = std::pmr::vector<std::pmr::string>;
+
+// One setrlimit() to apply to a single command
+struct resource_limit
+{
+    int resource;
+    rlim_t value;
+    bool soft;
+    bool hard;
+};
+
+// Where and under which limits a single command runs, set by `cpuset` and `ulimit` prefixes:
+//   cpuset 0-3 sort big.txt          pin to CPUs 0-3
+//   cpuset cache gen | cpuset cache sort
+//                                    pin every `cache` stage of the pipeline to one shared-cache
+//                                    domain so neighbouring stages exchange data through L3
+//   ulimit -v 1000000 make           cap this command only
+// Applied in the child between fork and exec.
+struct stage_placement
+{
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    bool pin_cpus = false;
+    bool share_cache = false;
+    cpu_set_t cpus;
+    std::pmr::vector<resource_limit> limits;
+
+    explicit stage_placement(allocator_type alloc = {}) : limits(alloc)
+    {
+        CPU_ZERO(&cpus);
+    }
+
+    stage_placement(const stage_placement& other, allocator_type alloc = {})
+        : pin_cpus(other.pin_cpus),
+          share_cache(other.share_cache),
+          cpus(other.cpus),
+          limits(other.limits, alloc)
+    {
+    }
+
+    stage_placement(stage_placement&& other, allocator_type alloc)
+        : pin_cpus(other.pin_cpus),
+          share_cache(other.share_cache),
+          cpus(other.cpus),
+          limits(std::move(other.limits), alloc)
+    {
+    }
+
+    stage_placement(stage_placement&&) = default;
+    stage_placement& operator=(const stage_placement&) = default;
+    stage_placement& operator=(stage_placement&&) = default;
+
+    bool empty() const
+    {
+        return !pin_cpus && !share_cache && limits.empty();
+    }
+
+    void clear()
+    {
+        pin_cpus = false;
+        share_cache = false;
+        CPU_ZERO(&cpus);
+        limits.clear();
+    }
+};
+
+// Strip leading `cpuset` / `ulimit` prefixes from a parsed command into its placement. Prefixes
+// with invalid arguments or without a command are left alone for the builtins to handle.
+void extract_stage_prefixes(user_input& u_input);
+
+// Parse a CPU list such as "0-3,6,8-10"
+bool parse_cpu_list(std::string_view list, cpu_set_t& cpus);
+
+// CPUs sharing the last-level cache with the CPU the shell is running on
+bool current_cache_domain(cpu_set_t& cpus);
+
+// Apply a placement to the calling process. cache_domain is the domain for `cpuset cache`,
+// resolved by the caller; without one the affinity is left alone. On failure returns false with
+// error set to a fixed message and errno to the cause. Only async-signal-safe calls are made, so
+// a child forked from a threaded shell can call it before exec and write(2) the message.
+bool apply_placement(const stage_placement& placement, const cpu_set_t* cache_domain,
+                     const char*& error);
+
+// Handle ulimit builtin: show or set the shell's own resource limits
+int handle_ulimit(const arg_list& args);
+
+// Handle cpuset builtin: show or set the shell's own CPU affinity
+int handle_cpuset(const arg_list& args);
@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * Stable C ABI for loadable builtins, loaded with `enable -f lib.so name`.
+ *
+ * A plugin is a shared object that defines SHELL_PLUGIN_ABI and, for every builtin `name` it
+ * provides, a function `name_builtin` of type shell_plugin_builtin_fn. The shell calls it inside
+ * its own process, possibly on a worker thread when the builtin is a pipeline stage, so it must
+ * only touch the descriptors it is given and must not exit() or change process-wide state.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SHELL_PLUGIN_ABI_VERSION 1
+
+/* Exported by every plugin; the shell refuses to load objects built against another version */
+#define SHELL_PLUGIN_ABI int shell_plugin_abi_version = SHELL_PLUGIN_ABI_VERSION
+
+/*
+ * argv[0] is the builtin name, argv and envp are NULL-terminated. Input comes from in_fd and
+ * output goes to out_fd/err_fd; the descriptors stay owned by the shell. Returns the exit status.
+ */
+typedef int (*shell_plugin_builtin_fn)(int argc, char* const argv[], char* const envp[],
+                                       int in_fd, int out_fd, int err_fd);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,85 @@
+#include "shell_plugins.h"
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <vector>
+
+static std::map<std::string, plugin_builtin, std::less<>> loaded_plugins;
+
+bool load_plugin_builtin(const std::string& path, const std::string& name, std::string& error)
+{
+    // RTLD_LOCAL keeps one plugin's symbols from resolving another's
+    void* raw_handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!raw_handle)
+    {
+        error = dlerror();
+        return false;
+    }
+    std::shared_ptr<void> handle(raw_handle, [](void* h) { dlclose(h); });
+
+    const int* abi_version = static_cast<const int*>(dlsym(raw_handle, "shell_plugin_abi_version"));
+    if (!abi_version || *abi_version != SHELL_PLUGIN_ABI_VERSION)
+    {
+        error = path + ": not a shell plugin (ABI version mismatch)";
+        return false;
+    }
+
+    std::string symbol = name + "_builtin";
+    auto function = reinterpret_cast<shell_plugin_builtin_fn>(dlsym(raw_handle, symbol.c_str()));
+    if (!function)
+    {
+        error = "cannot find " + symbol + " in shared object " + path;
+        return false;
+    }
+
+    // Replacing an entry drops its reference to the old object
+    loaded_plugins[name] = plugin_builtin{name, path, function, std::move(handle)};
+    return true;
+}
+
+bool unload_plugin_builtin(std::string_view name)
+{
+    auto it = loaded_plugins.find(name);
+    if (it == loaded_plugins.end())
+    {
+        return false;
+    }
+    loaded_plugins.erase(it);
+    return true;
+}
+
+const plugin_builtin* find_plugin_builtin(std::string_view name)
+{
+    if (loaded_plugins.empty())
+    {
+        return nullptr;
+    }
+    auto it = loaded_plugins.find(name);
+    return it == loaded_plugins.end() ? nullptr : &it->second;
+}
+
+const std::map<std::string, plugin_builtin, std::less<>>& plugin_builtins()
+{
+    return loaded_plugins;
+}
+
+int run_plugin_builtin(const plugin_builtin& plugin, const user_input& u_input, int in_fd,
+                       int out_fd, int err_fd)
+{
+    // Pin the object for the duration of the call
+    std::shared_ptr<void> handle = plugin.handle;
+    shell_plugin_builtin_fn function = plugin.function;
+
+    std::vector<char*> argv;
+    argv.reserve(u_input.args.size() + 2);
+    argv.push_back(const_cast<char*>(u_input.command.c_str()));
+    for (const auto& arg : u_input.args)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    return function(static_cast<int>(argv.size() - 1), argv.data(), environ, in_fd, out_fd,
+                    err_fd);
+}
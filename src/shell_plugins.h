@@ -0,0 +1,35 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "shell_plugin.h"
+#include "user_input.h"
+
+// A builtin loaded from a shared object with `enable -f`
+struct plugin_builtin
+{
+    std::string name;
+    std::string path;
+    shell_plugin_builtin_fn function = nullptr;
+    // dlclose()s the object once the last loaded builtin and any running call let go of it
+    std::shared_ptr<void> handle;
+};
+
+// Load builtin name from the shared object at path. On failure returns false and fills error.
+bool load_plugin_builtin(const std::string& path, const std::string& name, std::string& error);
+
+// Remove a loaded builtin. Calls already running keep the object alive until they return.
+bool unload_plugin_builtin(std::string_view name);
+
+// Find a loaded builtin by name, or nullptr
+const plugin_builtin* find_plugin_builtin(std::string_view name);
+
+// All loaded builtins, by name
+const std::map<std::string, plugin_builtin, std::less<>>& plugin_builtins();
+
+// Run a loaded builtin inside the shell on the given descriptors, returning its exit status
+int run_plugin_builtin(const plugin_builtin& plugin, const user_input& u_input, int in_fd,
+                       int out_fd, int err_fd);
@@ -0,0 +1,404 @@
+#include "shell_server.h"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#include "server_protocol.h"
+#include "shell_commands.h"
+#include "shell_executor.h"
+#include "shell_compiler.h"
+#include "shell_vm.h"
+
+namespace
+{
+// A client connection, and the worker running its current request if any
+struct connection
+{
+    pid_t worker = -1;
+    int worker_pidfd = -1;
+};
+
+int pidfd_open(pid_t pid)
+{
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+}
+
+bool add_to_epoll(int epoll_fd, int fd, uint32_t events)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+// The client's words as a command line: `-c LINE` is LINE, anything else is a command whose
+// arguments are single-quoted so the compiler takes them literally
+std::string request_command_line(const std::vector<std::string>& words)
+{
+    if (words.size() == 2 && words[0] == "-c")
+        return words[1];
+
+    std::string line;
+    for (const auto& word : words)
+    {
+        if (!line.empty())
+            line += ' ';
+        line += '\'';
+        for (char c : word)
+        {
+            if (c == '\'')
+                line += "'\\''";
+            else
+                line += c;
+        }
+        line += '\'';
+    }
+    return line;
+}
+
+// Set up the worker's process state from the request, then run its command line
+[[noreturn]] void run_request(const server_request& request, const int (&fds)[ServerRequestFds])
+{
+    for (size_t i = 0; i < ServerRequestFds; i++)
+    {
+        dup2(fds[i], static_cast<int>(i));
+    }
+
+    clearenv();
+    for (const auto& variable : request.environment)
+    {
+        // putenv keeps the pointer; the request outlives everything the worker runs
+        putenv(const_cast<char*>(variable.c_str()));
+    }
+
+    if (chdir(request.cwd.c_str()) != 0)
+    {
+        std::cerr << "cd: " << request.cwd << ": " << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+
+    // A request is a whole script; there are no further lines to finish an open construct with
+    shell_program program;
+    int status = 2;
+    switch (compile_script(request_command_line(request.words), program))
+    {
+        case compile_result::complete:
+            status = run_program(program);
+            break;
+        case compile_result::incomplete:
+            std::cerr << "shell: syntax error: unexpected end of file" << std::endl;
+            break;
+        case compile_result::error:
+            break;
+    }
+
+    int exit_status = 0;
+    if (exit_requested(exit_status))
+    {
+        status = exit_status;
+    }
+    // exit() rather than _exit() so std::cout is flushed into the client's stdout
+    exit(status);
+}
+
+class shell_server
+{
+public:
+    explicit shell_server(int listen_fd, int epoll_fd, int signal_fd)
+        : listen_fd(listen_fd), epoll_fd(epoll_fd), signal_fd(signal_fd)
+    {
+    }
+
+    int run()
+    {
+        std::array<epoll_event, 64> events;
+        while (true)
+        {
+            int ready = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+            if (ready < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                std::cerr << "server: " << std::strerror(errno) << std::endl;
+                return 1;
+            }
+
+            for (int i = 0; i < ready; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == signal_fd)
+                {
+                    // Consume the signal so it isn't delivered once it is unblocked again
+                    signalfd_siginfo info;
+                    (void)!read(signal_fd, &info, sizeof(info));
+                    return 0;
+                }
+                if (fd == listen_fd)
+                {
+                    accept_clients();
+                }
+                else if (auto worker = workers.find(fd); worker != workers.end())
+                {
+                    finish_request(worker->second);
+                }
+                else
+                {
+                    handle_client(fd, events[i].events);
+                }
+            }
+        }
+    }
+
+    ~shell_server()
+    {
+        for (const auto& [client_fd, conn] : connections)
+        {
+            close_connection_fds(client_fd, conn);
+        }
+    }
+
+private:
+    void accept_clients()
+    {
+        while (true)
+        {
+            int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd < 0)
+            {
+                return;
+            }
+            // Requests run as this user, so only this user may send them
+            ucred peer{};
+            socklen_t peer_size = sizeof(peer);
+            if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) != 0 ||
+                peer.uid != geteuid() || !add_to_epoll(epoll_fd, client_fd, EPOLLIN | EPOLLRDHUP))
+            {
+                close(client_fd);
+                continue;
+            }
+            connections[client_fd] = connection{};
+        }
+    }
+
+    void handle_client(int client_fd, uint32_t events)
+    {
+        connection& conn = connections[client_fd];
+        if (conn.worker >= 0)
+        {
+            // Stale event from before the socket left the epoll set
+            return;
+        }
+
+        std::string message;
+        int fds[ServerRequestFds];
+        size_t received_fds = 0;
+        server_request request;
+        errno = 0;
+        bool ok = (events & EPOLLIN) &&
+                  receive_with_fds(client_fd, message, fds, ServerRequestFds, received_fds) &&
+                  received_fds == ServerRequestFds && decode_server_request(message, request);
+        if (!ok && errno == EAGAIN)
+        {
+            // A stale event for a descriptor number that was closed and reused earlier in the
+            // same epoll batch
+            return;
+        }
+        if (!ok)
+        {
+            for (size_t i = 0; i < received_fds; i++)
+            {
+                close(fds[i]);
+            }
+            drop_client(client_fd);
+            return;
+        }
+
+        // One request at a time per connection: the socket leaves the epoll set while the worker
+        // runs, so a following request waits in the socket and a hangup is noticed once the
+        // reply fails
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
+        start_worker(client_fd, conn, request, fds);
+        for (int fd : fds)
+        {
+            close(fd);
+        }
+    }
+
+    void start_worker(int client_fd, connection& conn, const server_request& request,
+                      const int (&fds)[ServerRequestFds])
+    {
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // The worker only needs the client's descriptors, not the server's
+            close(listen_fd);
+            close(epoll_fd);
+            close(signal_fd);
+            for (const auto& [other_fd, other] : connections)
+            {
+                close_connection_fds(other_fd, other);
+            }
+            sigset_t signals;
+            sigemptyset(&signals);
+            sigprocmask(SIG_SETMASK, &signals, nullptr);
+            run_request(request, fds);
+        }
+
+        int pidfd = pid < 0 ? -1 : pidfd_open(pid);
+        if (pidfd < 0 || !add_to_epoll(epoll_fd, pidfd, EPOLLIN))
+        {
+            std::cerr << "server: cannot start worker: " << std::strerror(errno) << std::endl;
+            if (pid > 0)
+            {
+                kill(pid, SIGKILL);
+                waitpid(pid, nullptr, 0);
+            }
+            if (pidfd >= 0)
+                close(pidfd);
+            reply(client_fd, 126);
+            return;
+        }
+
+        conn.worker = pid;
+        conn.worker_pidfd = pidfd;
+        workers[pidfd] = client_fd;
+    }
+
+    void finish_request(int client_fd)
+    {
+        connection& conn = connections[client_fd];
+        int raw_status = 0;
+        pid_t reaped;
+        while ((reaped = waitpid(conn.worker, &raw_status, WNOHANG)) < 0 && errno == EINTR)
+        {
+        }
+        if (reaped == 0)
+        {
+            // Stale event, as in handle_client: the worker is still running
+            return;
+        }
+
+        workers.erase(conn.worker_pidfd);
+        close(conn.worker_pidfd);
+        conn.worker = -1;
+        conn.worker_pidfd = -1;
+
+        reply(client_fd, decode_wait_status(raw_status));
+    }
+
+    // Send the exit status and start listening for the connection's next request
+    void reply(int client_fd, int status)
+    {
+        int32_t message = status;
+        if (!send_with_fds(client_fd,
+                           std::string_view(reinterpret_cast<const char*>(&message),
+                                            sizeof(message)),
+                           nullptr, 0) ||
+            !add_to_epoll(epoll_fd, client_fd, EPOLLIN | EPOLLRDHUP))
+        {
+            drop_client(client_fd);
+        }
+    }
+
+    void drop_client(int client_fd)
+    {
+        auto it = connections.find(client_fd);
+        if (it == connections.end())
+        {
+            return;
+        }
+        close(client_fd);
+        connections.erase(it);
+    }
+
+    static void close_connection_fds(int client_fd, const connection& conn)
+    {
+        close(client_fd);
+        if (conn.worker_pidfd >= 0)
+            close(conn.worker_pidfd);
+    }
+
+    int listen_fd;
+    int epoll_fd;
+    int signal_fd;
+    std::map<int, connection> connections;  // client socket -> connection
+    std::map<int, int> workers;             // worker pidfd -> client socket
+};
+}  // namespace
+
+int run_server(const std::string& socket_path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "server: " << socket_path << ": socket path too long" << std::endl;
+        return 2;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+    {
+        std::cerr << "server: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    // A socket file left behind by an earlier server is replaced. The new one is created with
+    // mode 0600, so no other user can even connect.
+    unlink(socket_path.c_str());
+    mode_t old_mask = umask(0177);
+    int bound = bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    umask(old_mask);
+    if (bound != 0 || listen(listen_fd, SOMAXCONN) != 0)
+    {
+        std::cerr << "server: " << socket_path << ": " << std::strerror(errno) << std::endl;
+        close(listen_fd);
+        return 1;
+    }
+
+    // SIGINT/SIGTERM arrive through the event loop so the socket file gets cleaned up
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    int status = 1;
+    if (signal_fd >= 0 && epoll_fd >= 0 && add_to_epoll(epoll_fd, listen_fd, EPOLLIN) &&
+        add_to_epoll(epoll_fd, signal_fd, EPOLLIN))
+    {
+        shell_server server(listen_fd, epoll_fd, signal_fd);
+        status = server.run();
+    }
+    else
+    {
+        std::cerr << "server: " << std::strerror(errno) << std::endl;
+    }
+
+    unlink(socket_path.c_str());
+    if (signal_fd >= 0)
+        close(signal_fd);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    close(listen_fd);
+    sigprocmask(SIG_UNBLOCK, &signals, nullptr);
+    return status;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+// `shell --server PATH`: keep this warm shell (history loaded, PATH indexed) and run commands
+// for shell-client over a Unix socket at path, which only this user can connect to (mode 0600,
+// and SO_PEERCRED is checked). Connections are multiplexed with epoll; each
+// request runs in a worker forked from the server with the client's cwd, environment and
+// stdin/stdout/stderr, and its exit status is sent back. Returns the shell's exit status once
+// SIGINT or SIGTERM arrives.
+int run_server(const std::string& socket_path);
@@ -0,0 +1,140 @@
+#include "shell_variables.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+
+namespace
+{
+struct string_hash
+{
+    using is_transparent = void;
+    size_t operator()(std::string_view text) const
+    {
+        return std::hash<std::string_view>{}(text);
+    }
+};
+
+std::unordered_map<std::string, std::string, string_hash, std::equal_to<>> variables;
+
+// One frame per running function; the bottom frame belongs to the top level
+std::vector<std::vector<std::string>> positional_frames(1);
+
+bool is_name_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool is_name_char(char c)
+{
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+}  // namespace
+
+bool is_variable_name(std::string_view name)
+{
+    if (name.empty() || !is_name_start(name.front()))
+        return false;
+    for (char c : name)
+    {
+        if (!is_name_char(c))
+            return false;
+    }
+    return true;
+}
+
+bool is_assignment(std::string_view word, size_t& name_length)
+{
+    name_length = word.find('=');
+    return name_length != std::string_view::npos && is_variable_name(word.substr(0, name_length));
+}
+
+bool find_variable(std::string_view name, std::string_view& value)
+{
+    if (auto it = variables.find(name); it != variables.end())
+    {
+        value = it->second;
+        return true;
+    }
+
+    // getenv needs a terminated name; short names stay in the string's inline buffer
+    const char* env = std::getenv(std::string(name).c_str());
+    if (!env)
+        return false;
+    value = env;
+    return true;
+}
+
+void set_variable(std::string_view name, std::string_view value)
+{
+    std::string name_string(name);
+    if (auto it = variables.find(name); it != variables.end())
+    {
+        // assign() reuses the old value's buffer, so a counter in a loop doesn't allocate
+        it->second.assign(value);
+    }
+    else
+    {
+        variables.try_emplace(name_string, value);
+    }
+
+    if (std::getenv(name_string.c_str()))
+        setenv(name_string.c_str(), std::string(value).c_str(), 1);
+}
+
+const std::vector<std::string>& positional_parameters()
+{
+    return positional_frames.back();
+}
+
+void positional_scope::push(std::vector<std::string> args)
+{
+    positional_frames.push_back(std::move(args));
+}
+
+positional_scope::~positional_scope()
+{
+    positional_frames.pop_back();
+}
+
+void assignment_scope::assign(std::string_view name, std::string_view value)
+{
+    std::string name_string(name);
+    bool saved = std::any_of(saved_.begin(), saved_.end(),
+                             [&](const saved_variable& entry) { return entry.name == name; });
+    if (!saved)
+    {
+        saved_variable entry{name_string, false, {}, false, {}};
+        if (auto it = variables.find(name); it != variables.end())
+        {
+            entry.had_variable = true;
+            entry.variable = it->second;
+        }
+        if (const char* env = std::getenv(name_string.c_str()))
+        {
+            entry.had_environment = true;
+            entry.environment = env;
+        }
+        saved_.push_back(std::move(entry));
+    }
+
+    std::string value_string(value);
+    variables.insert_or_assign(name_string, value_string);
+    setenv(name_string.c_str(), value_string.c_str(), 1);
+}
+
+assignment_scope::~assignment_scope()
+{
+    for (auto entry = saved_.rbegin(); entry != saved_.rend(); ++entry)
+    {
+        if (entry->had_variable)
+            variables.insert_or_assign(entry->name, entry->variable);
+        else
+            variables.erase(entry->name);
+
+        if (entry->had_environment)
+            setenv(entry->name.c_str(), entry->environment.c_str(), 1);
+        else
+            unsetenv(entry->name.c_str());
+    }
+}
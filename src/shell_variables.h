@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Shell variables and positional parameters. Variables the shell hasn't set are looked up in the
+// environment, and assigning one that is in the environment updates it there too, so commands
+// the shell starts see the new value.
+
+// Whether name is a valid variable name: a letter or '_', then letters, digits and '_'
+bool is_variable_name(std::string_view name);
+
+// Whether word is an assignment (NAME=VALUE); name_length is set to the length of NAME
+bool is_assignment(std::string_view word, size_t& name_length);
+
+// Look up a variable. Returns false if it is unset.
+bool find_variable(std::string_view name, std::string_view& value);
+
+void set_variable(std::string_view name, std::string_view value);
+
+// $1, $2, ... of the function that is running; empty at the top level
+const std::vector<std::string>& positional_parameters();
+
+// Makes args the positional parameters for as long as it lives, e.g. for a function call
+class positional_scope
+{
+   public:
+    template <typename Strings>
+    explicit positional_scope(const Strings& args)
+    {
+        push(std::vector<std::string>(args.begin(), args.end()));
+    }
+
+    positional_scope(const positional_scope&) = delete;
+    positional_scope& operator=(const positional_scope&) = delete;
+
+    ~positional_scope();
+
+   private:
+    static void push(std::vector<std::string> args);
+};
+
+// The NAME=VALUE words before a command, for as long as it lives: each is set as a variable and
+// exported, so builtins, functions and the commands the shell starts all see it, and the old
+// variable and environment entry (or their absence) are put back afterwards
+class assignment_scope
+{
+   public:
+    assignment_scope() = default;
+    assignment_scope(const assignment_scope&) = delete;
+    assignment_scope& operator=(const assignment_scope&) = delete;
+
+    ~assignment_scope();
+
+    void assign(std::string_view name, std::string_view value);
+
+   private:
+    struct saved_variable
+    {
+        std::string name;
+        bool had_variable;
+        std::string variable;
+        bool had_environment;
+        std::string environment;
+    };
+    std::vector<saved_variable> saved_;
+};
@@ -0,0 +1,309 @@
+#include "shell_vm.h"
+
+#include <fnmatch.h>
+
+#include <charconv>
+#include <csignal>
+#include <iostream>
+#include <memory_resource>
+#include <unordered_map>
+
+#include "builtin_registry.h"
+#include "shell_commands.h"
+#include "shell_executor.h"
+#include "shell_parser.h"
+#include "shell_plugins.h"
+#include "shell_variables.h"
+
+namespace
+{
+// Deeper calls than this are almost certainly runaway recursion
+constexpr int MaxFunctionDepth = 1000;
+
+struct string_hash
+{
+    using is_transparent = void;
+    size_t operator()(std::string_view text) const
+    {
+        return std::hash<std::string_view>{}(text);
+    }
+};
+
+std::unordered_map<std::string, std::shared_ptr<const shell_program>, string_hash,
+                   std::equal_to<>>
+    functions;
+
+int function_depth = 0;
+
+// Set when a command was killed by SIGINT; every level of the VM unwinds
+bool interrupted = false;
+
+int set_status(int status)
+{
+    return record_pipeline_status({&status, 1});
+}
+
+// Remove the quotes of a raw word and expand its parameters
+void expand_word(std::string_view word, shell_string& result)
+{
+    size_t i = 0;
+    extract_quoted_string(word, i, result);
+}
+
+int run_program_at_depth(const shell_program& program);
+
+int call_function(const shell_program& body, const user_input& call)
+{
+    if (function_depth >= MaxFunctionDepth)
+    {
+        std::cerr << call.command << ": maximum function nesting level exceeded" << std::endl;
+        return set_status(1);
+    }
+
+    positional_scope parameters(call.args);
+    function_depth++;
+    int status = run_program_at_depth(body);
+    function_depth--;
+    return status;
+}
+
+int run_command(const compiled_command& command)
+{
+    // Expansions and re-parsed dynamic commands live here for the length of one run
+    alignas(std::max_align_t) std::byte buffer[4096];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+
+    // Only this command's expansions count, not a for list or case word expanded before it
+    take_expansion_error();
+    // A bare assignment sets the variable; before a command it only holds for that command
+    assignment_scope prefix;
+    for (const auto& [name, raw_value] : command.assignments)
+    {
+        shell_string value(&arena);
+        expand_word(raw_value, value);
+        if (command.text.empty())
+            set_variable(name, value);
+        else
+            prefix.assign(name, value);
+    }
+    if (command.text.empty())
+        return set_status(take_expansion_error() ? 1 : 0);
+
+    user_input_list parsed(&arena);
+    const user_input_list* stages = &command.stages;
+    if (command.dynamic)
+    {
+        parse_pipeline_input(command.text, parsed);
+        stages = &parsed;
+    }
+    if (take_expansion_error())
+        return set_status(1);
+    if (stages->empty())
+        return set_status(0);
+
+    if (stages->size() == 1)
+    {
+        const user_input& stage = stages->front();
+        if (!functions.empty())
+        {
+            auto function = functions.find(std::string_view(stage.command));
+            if (function != functions.end())
+            {
+                // The call may redefine the function; keep this body alive until it returns
+                std::shared_ptr<const shell_program> body = function->second;
+                return call_function(*body, stage);
+            }
+        }
+
+        // Builtins that write through std::cout and need no redirections or substitutions are
+        // called straight away, unless a plugin of the same name shadows them
+        const builtin_command* builtin = command.builtin;
+        if (command.dynamic && stage.placement.empty() && !stage.has_stdout_redirect() &&
+            !stage.has_stderr_redirect() && !stage.has_process_substitutions())
+        {
+            builtin = find_builtin(stage.command);
+            builtin = builtin && builtin->handler ? builtin : nullptr;
+        }
+        if (builtin && (plugin_builtins().empty() || !find_plugin_builtin(stage.command)))
+            return set_status(builtin->handler(stage.args));
+    }
+
+    return ExecutePipeline(*stages);
+}
+
+// Expand the words of a for loop. Unquoted expansions are split into fields at whitespace, so
+// `for arg in $@` walks the arguments one by one; "$@" keeps each argument whole.
+void expand_loop_words(const for_loop& loop, std::vector<std::string>& items)
+{
+    for (const std::string& word : loop.words)
+    {
+        // "$@" is one word per parameter, whatever they contain
+        if (word == "\"$@\"")
+        {
+            const std::vector<std::string>& parameters = positional_parameters();
+            items.insert(items.end(), parameters.begin(), parameters.end());
+            continue;
+        }
+
+        shell_string value;
+        expand_word(word, value);
+        if (word.find_first_of("'\"") != std::string::npos || word.find('$') == std::string::npos)
+        {
+            items.emplace_back(value);
+            continue;
+        }
+
+        size_t start = value.find_first_not_of(" \t\n");
+        while (start != shell_string::npos)
+        {
+            size_t end = value.find_first_of(" \t\n", start);
+            items.emplace_back(value.substr(start, end - start));
+            start = value.find_first_not_of(" \t\n", end);
+        }
+    }
+}
+
+bool case_item_matches(const case_item& item, const std::string& subject)
+{
+    for (const std::string& raw : item.patterns)
+    {
+        shell_string pattern;
+        expand_word(raw, pattern);
+        if (fnmatch(pattern.c_str(), subject.c_str(), 0) == 0)
+            return true;
+    }
+    return false;
+}
+
+int run_program_at_depth(const shell_program& program)
+{
+    struct loop_state
+    {
+        std::vector<std::string> items;
+        size_t next = 0;
+        int status = 0;  // Of the last body command run, or 0 when the body never ran
+    };
+    std::vector<loop_state> loops;
+    std::vector<std::string> subjects;
+
+    int status = last_exit_status();
+    int exit_status = 0;
+    size_t pc = 0;
+    while (pc < program.code.size())
+    {
+        const instruction& in = program.code[pc++];
+        switch (in.op)
+        {
+            case opcode::RUN:
+                status = run_command(program.commands[in.a]);
+                interrupted = interrupted || status == 128 + SIGINT;
+                if (interrupted || exit_requested(exit_status))
+                    return status;
+                break;
+            case opcode::JUMP:
+                pc = in.a;
+                break;
+            case opcode::JUMP_IF_FAILED:
+                if (status != 0)
+                    pc = in.a;
+                break;
+            case opcode::JUMP_IF_SUCCEEDED:
+                if (status == 0)
+                    pc = in.a;
+                break;
+            case opcode::NEGATE:
+                status = set_status(status == 0 ? 1 : 0);
+                break;
+            case opcode::SET_STATUS:
+                status = set_status(static_cast<int>(in.a));
+                break;
+            case opcode::LOOP_BEGIN:
+                loops.emplace_back();
+                break;
+            case opcode::FOR_BEGIN:
+                loops.emplace_back();
+                expand_loop_words(program.loops[in.a], loops.back().items);
+                break;
+            case opcode::FOR_NEXT:
+            {
+                loop_state& loop = loops.back();
+                if (loop.next < loop.items.size())
+                    set_variable(program.loops[in.a].variable, loop.items[loop.next++]);
+                else
+                    pc = in.b;
+                break;
+            }
+            case opcode::LOOP_STATUS:
+                loops.back().status = status;
+                break;
+            case opcode::LOOP_END:
+                status = set_status(loops.back().status);
+                loops.pop_back();
+                break;
+            case opcode::CASE_BEGIN:
+            {
+                shell_string subject;
+                expand_word(program.words[in.a], subject);
+                subjects.emplace_back(subject);
+                break;
+            }
+            case opcode::CASE_MATCH:
+                if (!case_item_matches(program.case_items[in.a], subjects.back()))
+                    pc = in.b;
+                break;
+            case opcode::CASE_END:
+                subjects.pop_back();
+                break;
+            case opcode::DEFINE_FUNCTION:
+            {
+                const function_definition& function = program.functions[in.a];
+                functions.insert_or_assign(function.name, function.body);
+                status = set_status(0);
+                break;
+            }
+            case opcode::NOT_IN_LOOP:
+                std::cerr << (in.a == 0 ? "break" : "continue")
+                          << ": only meaningful in a `for', `while', or `until' loop"
+                          << std::endl;
+                status = set_status(0);
+                break;
+            case opcode::RETURN:
+                if (function_depth == 0)
+                {
+                    // Only a function body can be left; the rest of the program still runs
+                    std::cerr << "return: can only `return' from a function" << std::endl;
+                    status = set_status(1);
+                    break;
+                }
+                if (in.a != NoOperand)
+                {
+                    shell_string word;
+                    expand_word(program.words[in.a], word);
+                    int value = 0;
+                    auto [end, error] = std::from_chars(word.data(), word.data() + word.size(),
+                                                        value);
+                    if (error != std::errc() || end != word.data() + word.size())
+                    {
+                        std::cerr << "return: " << word << ": numeric argument required"
+                                  << std::endl;
+                        value = 2;
+                    }
+                    status = set_status(value & 0xff);
+                }
+                return status;
+        }
+    }
+    return status;
+}
+}  // namespace
+
+int run_program(const shell_program& program)
+{
+    interrupted = false;
+    return run_program_at_depth(program);
+}
+
+bool is_function(std::string_view name)
+{
+    return !functions.empty() && functions.contains(name);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string_view>
+
+#include "shell_bytecode.h"
+
+// Run a compiled program inside the shell process and return the status of the last command.
+// Every command updates $? and PIPESTATUS as it finishes. Execution stops early when `exit` is
+// called or a command is killed by SIGINT, so Ctrl-C ends a loop rather than one iteration.
+int run_program(const shell_program& program);
+
+// Whether a shell function with this name has been defined
+bool is_function(std::string_view name);
@@ -0,0 +1,1276 @@
+#include "text_builtins.h"
+
+#include <fcntl.h>
+#include <regex.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "builtin_registry.h"
+#include "shell_executor.h"
+
+namespace
+{
+constexpr size_t ReadChunkSize = 128 * 1024;
+constexpr size_t WriteBufferSize = 64 * 1024;
+
+// Status of a tool killed by writing into a closed pipe, which is what the external one reports
+constexpr int BrokenPipeStatus = 128 + SIGPIPE;
+
+// Status of one stopped by Ctrl-C while reading, again as the external one reports it
+constexpr int InterruptedStatus = 128 + SIGINT;
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) size_t count_byte_avx2(const char* data, size_t size, char byte)
+{
+    const __m256i needle = _mm256_set1_epi8(byte);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        count += __builtin_popcount(mask);
+    }
+    for (; i < size; i++)
+    {
+        count += data[i] == byte;
+    }
+    return count;
+}
+
+__attribute__((target("sse2"))) size_t count_byte_sse2(const char* data, size_t size, char byte)
+{
+    const __m128i needle = _mm_set1_epi8(byte);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        count += __builtin_popcount(mask);
+    }
+    for (; i < size; i++)
+    {
+        count += data[i] == byte;
+    }
+    return count;
+}
+#endif
+
+// Number of occurrences of byte, 32 (AVX2) or 16 (SSE2) bytes per step where available
+size_t count_byte(const char* data, size_t size, char byte)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2 ? count_byte_avx2(data, size, byte) : count_byte_sse2(data, size, byte);
+#else
+    return std::count(data, data + size, byte);
+#endif
+}
+
+// Buffered output that goes quiet once the reader has gone away
+class fd_writer
+{
+   public:
+    explicit fd_writer(int fd) : fd_(fd)
+    {
+        buffer_.reserve(WriteBufferSize);
+    }
+
+    ~fd_writer()
+    {
+        flush();
+    }
+
+    bool write(std::string_view data)
+    {
+        if (buffer_.size() + data.size() > WriteBufferSize)
+        {
+            // Large pieces (whole mapped files) skip the copy into the buffer
+            if (!flush())
+                return false;
+            if (data.size() >= WriteBufferSize)
+                return write_direct(data.data(), data.size());
+        }
+        buffer_.append(data);
+        return !broken_pipe_;
+    }
+
+    bool flush()
+    {
+        bool ok = write_direct(buffer_.data(), buffer_.size());
+        buffer_.clear();
+        return ok;
+    }
+
+    bool broken_pipe() const
+    {
+        return broken_pipe_;
+    }
+
+   private:
+    bool write_direct(const char* data, size_t size)
+    {
+        while (size > 0 && !broken_pipe_)
+        {
+            ssize_t written = ::write(fd_, data, size);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+            {
+                broken_pipe_ = true;
+                break;
+            }
+            data += written;
+            size -= written;
+        }
+        return !broken_pipe_;
+    }
+
+    int fd_;
+    std::string buffer_;
+    bool broken_pipe_ = false;
+};
+
+// How a tool words a file it can't read. cat, wc and grep lead with the bare name; head and tail
+// quote it and say whether opening or reading failed, as coreutils does.
+enum class error_style
+{
+    plain,
+    quoted,
+};
+
+enum class failed_on
+{
+    open,
+    read,
+};
+
+void report_error(int err_fd, const char* tool, std::string_view name, int error,
+                  error_style style = error_style::plain, failed_on step = failed_on::open)
+{
+    std::string message = std::string(tool) + ": ";
+    if (style == error_style::plain)
+    {
+        message.append(name);
+    }
+    else
+    {
+        char quote = name.find('\'') == std::string_view::npos ? '\'' : '"';
+        message += step == failed_on::open ? "cannot open " : "error reading ";
+        message += quote;
+        message.append(name);
+        message += quote;
+        if (step == failed_on::open)
+            message += " for reading";
+    }
+    message += ": ";
+    message += std::strerror(error);
+    message += '\n';
+    (void) ::write(err_fd, message.data(), message.size());
+}
+
+// One input operand: a file mapped into memory when it is a non-empty regular file, otherwise a
+// descriptor read in chunks ("-" is the builtin's stdin)
+class input_source
+{
+   public:
+    input_source() = default;
+    input_source(const input_source&) = delete;
+    input_source& operator=(const input_source&) = delete;
+
+    ~input_source()
+    {
+        if (map_ != MAP_FAILED)
+            munmap(map_, map_size_);
+        if (owns_fd_)
+            close(fd_);
+    }
+
+    bool open(std::string_view name, int in_fd, int err_fd, const char* tool,
+              error_style style = error_style::plain)
+    {
+        if (name == "-")
+        {
+            fd_ = in_fd;
+        }
+        else
+        {
+            fd_ = ::open(std::string(name).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd_ < 0)
+            {
+                report_error(err_fd, tool, name, errno, style);
+                return false;
+            }
+            owns_fd_ = true;
+        }
+
+        struct stat st;
+        if (fstat(fd_, &st) == 0)
+        {
+            regular_ = S_ISREG(st.st_mode);
+            pipe_ = S_ISFIFO(st.st_mode);
+            size_ = st.st_size;
+            if (S_ISDIR(st.st_mode))
+            {
+                // Opening a directory works; it is the first read that fails
+                directory_ = true;
+                report_error(err_fd, tool, name, EISDIR, style, failed_on::read);
+                return false;
+            }
+        }
+
+        // Only map what we own from offset 0; a shared stdin may have been partly consumed
+        if (regular_ && owns_fd_ && size_ > 0)
+        {
+            map_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (map_ != MAP_FAILED)
+            {
+                map_size_ = size_;
+                madvise(map_, map_size_, MADV_SEQUENTIAL);
+            }
+        }
+        return true;
+    }
+
+    int fd() const
+    {
+        return fd_;
+    }
+
+    bool regular() const
+    {
+        return regular_;
+    }
+
+    bool pipe() const
+    {
+        return pipe_;
+    }
+
+    // open() failed on a directory, which coreutils treats as a read error rather than an open one
+    bool directory() const
+    {
+        return directory_;
+    }
+
+    off_t size() const
+    {
+        return size_;
+    }
+
+    // Calls fn(chunk) until it returns false or the input ends. Returns false on a read error.
+    template <typename Fn>
+    bool for_each_chunk(Fn fn)
+    {
+        if (map_ != MAP_FAILED)
+        {
+            fn(std::string_view(static_cast<const char*>(map_), map_size_));
+            return true;
+        }
+
+        std::vector<char> buffer(ReadChunkSize);
+        while (true)
+        {
+            if (!wait_for_input())
+                return false;
+            ssize_t n = read(fd_, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return false;
+            if (n == 0 || !fn(std::string_view(buffer.data(), n)))
+                return true;
+        }
+    }
+
+    // Like for_each_chunk, but every block ends on a line boundary except possibly the last one
+    template <typename Fn>
+    bool for_each_line_block(Fn fn)
+    {
+        if (map_ != MAP_FAILED)
+        {
+            fn(std::string_view(static_cast<const char*>(map_), map_size_));
+            return true;
+        }
+
+        std::string pending;
+        bool keep_going = true;
+        bool ok = for_each_chunk(
+            [&](std::string_view chunk)
+            {
+                const void* last_newline = memrchr(chunk.data(), '\n', chunk.size());
+                if (!last_newline)
+                {
+                    pending.append(chunk);
+                    return true;
+                }
+
+                size_t complete = static_cast<const char*>(last_newline) - chunk.data() + 1;
+                if (pending.empty())
+                {
+                    keep_going = fn(chunk.substr(0, complete));
+                }
+                else
+                {
+                    pending.append(chunk.substr(0, complete));
+                    keep_going = fn(std::string_view(pending));
+                    pending.clear();
+                }
+                pending.append(chunk.substr(complete));
+                return keep_going;
+            });
+
+        if (ok && keep_going && !pending.empty())
+        {
+            fn(std::string_view(pending));
+        }
+        return ok;
+    }
+
+    // Read the rest of the input into memory (tail needs to look backwards)
+    bool read_all(std::string& out)
+    {
+        if (map_ != MAP_FAILED)
+        {
+            out.assign(static_cast<const char*>(map_), map_size_);
+            return true;
+        }
+        return for_each_chunk(
+            [&](std::string_view chunk)
+            {
+                out.append(chunk);
+                return true;
+            });
+    }
+
+    // Block until a terminal or pipe has data, so that Ctrl-C can end the wait. Returns false,
+    // with interrupted() set, if it did.
+    bool wait_for_input()
+    {
+        if (!regular_ && !foreground_signals::wait_for_input(fd_))
+        {
+            interrupted_ = true;
+            errno = EINTR;
+        }
+        return !interrupted_;
+    }
+
+    // Whether reading stopped because of Ctrl-C
+    bool interrupted() const
+    {
+        return interrupted_;
+    }
+
+    // Whole contents without copying when mapped, else nullptr
+    const char* mapped_data() const
+    {
+        return map_ != MAP_FAILED ? static_cast<const char*>(map_) : nullptr;
+    }
+
+   private:
+    int fd_ = -1;
+    bool owns_fd_ = false;
+    bool regular_ = false;
+    bool pipe_ = false;
+    bool directory_ = false;
+    bool interrupted_ = false;
+    off_t size_ = 0;
+    void* map_ = MAP_FAILED;
+    size_t map_size_ = 0;
+};
+
+// Move the whole input to out_fd inside the kernel where possible. Returns 1 if the kernel path
+// is not available for this pair of descriptors, 0 when done or interrupted (see
+// src.interrupted()), -1 when the reader went away.
+int copy_in_kernel(input_source& src, int out_fd)
+{
+    if (src.regular())
+    {
+        while (true)
+        {
+            ssize_t sent = sendfile(out_fd, src.fd(), nullptr, 1 << 30);
+            if (sent > 0)
+                continue;
+            if (sent == 0)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            if (errno == EPIPE)
+                return -1;
+            return 1;
+        }
+    }
+
+    if (src.pipe())
+    {
+        bool moved_any = false;
+        while (true)
+        {
+            if (!src.wait_for_input())
+                return 0;
+            ssize_t moved = splice(src.fd(), nullptr, out_fd, nullptr, 1 << 20, SPLICE_F_MOVE);
+            if (moved > 0)
+            {
+                moved_any = true;
+                continue;
+            }
+            if (moved == 0)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            if (errno == EPIPE)
+                return -1;
+            // EINVAL before any data moved means splice can't write to out_fd
+            return moved_any ? -1 : 1;
+        }
+    }
+
+    return 1;
+}
+
+std::string display_name(std::string_view name, const char* stdin_name)
+{
+    return name == "-" ? std::string(stdin_name) : std::string(name);
+}
+
+// Parse a plain decimal count, rejecting suffixes and signs the builtins don't implement
+bool parse_count(std::string_view text, size_t& value)
+{
+    if (text.empty() || text.size() > 18)
+        return false;
+    value = 0;
+    for (char c : text)
+    {
+        if (c < '0' || c > '9')
+            return false;
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Shared option parsing for head and tail. Returns false for anything unsupported.
+struct head_tail_options
+{
+    bool bytes = false;
+    bool from_start = false;  // tail -n +N
+    size_t count = 10;
+    std::vector<std::string_view> files;
+};
+
+bool parse_head_tail(const arg_list& args, bool allow_plus, head_tail_options& opts)
+{
+    bool options_done = false;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        std::string_view arg = args[i];
+        if (options_done || arg == "-" || arg.size() < 2 || arg[0] != '-')
+        {
+            opts.files.push_back(arg);
+            continue;
+        }
+        if (arg == "--")
+        {
+            options_done = true;
+            continue;
+        }
+
+        std::string_view value;
+        if (arg[1] >= '0' && arg[1] <= '9')
+        {
+            // Obsolete -N form
+            opts.bytes = false;
+            value = arg.substr(1);
+        }
+        else if (arg[1] == 'n' || arg[1] == 'c')
+        {
+            opts.bytes = arg[1] == 'c';
+            if (arg.size() > 2)
+                value = arg.substr(2);
+            else if (i + 1 < args.size())
+                value = args[++i];
+            else
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+
+        opts.from_start = false;
+        if (allow_plus && !value.empty() && value[0] == '+')
+        {
+            opts.from_start = true;
+            value.remove_prefix(1);
+        }
+        if (!parse_count(value, opts.count))
+            return false;
+    }
+
+    if (opts.files.empty())
+        opts.files.push_back("-");
+    return true;
+}
+
+bool write_header(fd_writer& out, std::string_view name, bool first)
+{
+    std::string header = first ? "==> " : "\n==> ";
+    header += display_name(name, "standard input");
+    header += " <==\n";
+    return out.write(header);
+}
+
+// Characters wc treats as word separators (C locale isspace)
+bool is_word_separator(unsigned char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+struct wc_counts
+{
+    size_t lines = 0;
+    size_t words = 0;
+    size_t bytes = 0;
+};
+
+// A compiled grep pattern: plain substrings go through memmem, everything else through regexec
+class grep_matcher
+{
+   public:
+    grep_matcher() = default;
+    grep_matcher(const grep_matcher&) = delete;
+    grep_matcher& operator=(const grep_matcher&) = delete;
+
+    ~grep_matcher()
+    {
+        if (compiled_)
+            regfree(&regex_);
+    }
+
+    bool compile(std::string_view pattern, bool fixed, bool extended, bool ignore_case)
+    {
+        std::string_view metachars = extended ? ".[]*^$\\+?(){}|" : ".[]*^$\\";
+        fixed_ = !ignore_case &&
+                 (fixed || pattern.find_first_of(metachars) == std::string_view::npos);
+        if (fixed_)
+        {
+            pattern_ = pattern;
+            return true;
+        }
+
+        std::string source;
+        if (fixed)
+        {
+            // -F -i: escape into a basic regex so REG_ICASE can do the folding
+            extended = false;
+            for (char c : pattern)
+            {
+                if (std::string_view(".[]*^$\\").find(c) != std::string_view::npos)
+                    source += '\\';
+                source += c;
+            }
+        }
+        else
+        {
+            source = pattern;
+        }
+
+        int flags = REG_NOSUB | (extended ? REG_EXTENDED : 0) | (ignore_case ? REG_ICASE : 0);
+        compiled_ = regcomp(&regex_, source.c_str(), flags) == 0;
+        return compiled_;
+    }
+
+    bool fixed() const
+    {
+        return fixed_;
+    }
+
+    const std::string& pattern() const
+    {
+        return pattern_;
+    }
+
+    bool matches(std::string_view line) const
+    {
+        if (fixed_)
+            return memmem(line.data(), line.size(), pattern_.data(), pattern_.size()) != nullptr;
+
+        // REG_STARTEND matches within [rm_so, rm_eo) without needing a NUL-terminated copy
+        regmatch_t range;
+        range.rm_so = 0;
+        range.rm_eo = static_cast<regoff_t>(line.size());
+        return regexec(&regex_, line.data(), 1, &range, REG_STARTEND) == 0;
+    }
+
+   private:
+    bool fixed_ = false;
+    std::string pattern_;
+    bool compiled_ = false;
+    regex_t regex_;
+};
+}  // namespace
+
+int handle_cat(const arg_list& args, int in_fd, int out_fd, int err_fd)
+{
+    bool number = false;
+    std::vector<std::string_view> files;
+    for (const auto& arg : args)
+    {
+        if (arg == "-n")
+            number = true;
+        else if (arg.size() > 1 && arg[0] == '-')
+            return BUILTIN_USE_EXTERNAL;
+        else
+            files.push_back(arg);
+    }
+    if (files.empty())
+        files.push_back("-");
+
+    fd_writer out(out_fd);
+    int status = 0;
+    size_t line_number = 0;
+    bool at_line_start = true;
+    for (std::string_view name : files)
+    {
+        input_source src;
+        if (!src.open(name, in_fd, err_fd, "cat"))
+        {
+            status = 1;
+            continue;
+        }
+
+        if (!number)
+        {
+            if (!out.flush())
+                return BrokenPipeStatus;
+            int copied = copy_in_kernel(src, out_fd);
+            if (copied < 0)
+                return BrokenPipeStatus;
+            if (src.interrupted())
+                return InterruptedStatus;
+            if (copied == 0)
+                continue;
+        }
+
+        bool read_ok = src.for_each_chunk(
+            [&](std::string_view chunk)
+            {
+                if (!number)
+                    return out.write(chunk);
+
+                while (!chunk.empty())
+                {
+                    if (at_line_start)
+                    {
+                        char prefix[32];
+                        int len = snprintf(prefix, sizeof(prefix), "%6zu\t", ++line_number);
+                        out.write(std::string_view(prefix, len));
+                    }
+                    size_t newline = chunk.find('\n');
+                    size_t take = newline == std::string_view::npos ? chunk.size() : newline + 1;
+                    at_line_start = newline != std::string_view::npos;
+                    if (!out.write(chunk.substr(0, take)))
+                        return false;
+                    chunk.remove_prefix(take);
+                }
+                return true;
+            });
+
+        if (out.broken_pipe())
+            return BrokenPipeStatus;
+        if (src.interrupted())
+            return InterruptedStatus;
+        if (!read_ok)
+        {
+            report_error(err_fd, "cat", name, errno);
+            status = 1;
+        }
+    }
+
+    return out.flush() ? status : BrokenPipeStatus;
+}
+
+int handle_wc(const arg_list& args, int in_fd, int out_fd, int err_fd)
+{
+    bool lines = false;
+    bool words = false;
+    bool bytes = false;
+    std::vector<std::string_view> files;
+    for (const auto& arg : args)
+    {
+        if (arg.size() > 1 && arg[0] == '-')
+        {
+            for (char flag : std::string_view(arg).substr(1))
+            {
+                if (flag == 'l')
+                    lines = true;
+                else if (flag == 'w')
+                    words = true;
+                else if (flag == 'c')
+                    bytes = true;
+                else
+                    return BUILTIN_USE_EXTERNAL;
+            }
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+    if (!lines && !words && !bytes)
+        lines = words = bytes = true;
+
+    bool read_stdin = files.empty();
+    if (read_stdin)
+        files.push_back("-");
+
+    struct file_result
+    {
+        std::string_view name;
+        wc_counts counts;
+        bool failed = false;
+        bool statted = false;
+        bool regular = false;
+        off_t size = 0;
+    };
+    std::vector<file_result> results;
+    int status = 0;
+
+    for (std::string_view name : files)
+    {
+        file_result result;
+        result.name = name;
+        input_source src;
+        if (!src.open(name, in_fd, err_fd, "wc"))
+        {
+            // An unreadable file still counts towards the column width if stat() can see it. A
+            // directory fails on read, so like any read error it still gets a line of zeros.
+            struct stat st;
+            result.failed = !src.directory();
+            result.statted = stat(std::string(name).c_str(), &st) == 0;
+            result.regular = result.statted && S_ISREG(st.st_mode);
+            result.size = result.statted ? st.st_size : 0;
+            status = 1;
+            results.push_back(result);
+            continue;
+        }
+        result.statted = true;
+        result.regular = src.regular();
+        result.size = src.size();
+
+        if (bytes && !lines && !words && src.regular() && src.mapped_data())
+        {
+            // Byte count of a regular file needs no reading at all
+            result.counts.bytes = src.size();
+        }
+        else
+        {
+            bool in_word = false;
+            bool read_ok = src.for_each_chunk(
+                [&](std::string_view chunk)
+                {
+                    result.counts.bytes += chunk.size();
+                    if (lines)
+                        result.counts.lines += count_byte(chunk.data(), chunk.size(), '\n');
+                    if (words)
+                    {
+                        for (unsigned char c : chunk)
+                        {
+                            bool separator = is_word_separator(c);
+                            result.counts.words += !separator && !in_word;
+                            in_word = !separator;
+                        }
+                    }
+                    return true;
+                });
+            if (src.interrupted())
+                return InterruptedStatus;
+            if (!read_ok)
+            {
+                report_error(err_fd, "wc", name, errno);
+                result.failed = true;
+                status = 1;
+            }
+        }
+        results.push_back(result);
+    }
+
+    // Column width follows coreutils: wide enough for the total size of the regular files stat()
+    // succeeded on, failed or not, at least 7 when anything else is involved, and no padding for
+    // a single count of a single input
+    int width = 1;
+    if (!(results.size() == 1 && lines + words + bytes == 1))
+    {
+        int minimum_width = 1;
+        uintmax_t regular_total = 0;
+        for (const auto& result : results)
+        {
+            if (!result.statted)
+                continue;
+            if (result.regular)
+                regular_total += result.size;
+            else
+                minimum_width = 7;
+        }
+        for (; regular_total >= 10; regular_total /= 10)
+            width++;
+        width = std::max(width, minimum_width);
+    }
+
+    fd_writer out(out_fd);
+    wc_counts total;
+    auto print = [&](const wc_counts& counts, std::string_view name)
+    {
+        std::string line;
+        char field[32];
+        auto add = [&](size_t value)
+        {
+            int len = snprintf(field, sizeof(field), "%s%*zu", line.empty() ? "" : " ", width,
+                               value);
+            line.append(field, len);
+        };
+        if (lines)
+            add(counts.lines);
+        if (words)
+            add(counts.words);
+        if (bytes)
+            add(counts.bytes);
+        if (!name.empty())
+        {
+            line += ' ';
+            line.append(name);
+        }
+        line += '\n';
+        out.write(line);
+    };
+
+    for (const auto& result : results)
+    {
+        if (result.failed)
+            continue;
+        print(result.counts, read_stdin ? std::string_view() : result.name);
+        total.lines += result.counts.lines;
+        total.words += result.counts.words;
+        total.bytes += result.counts.bytes;
+    }
+    if (results.size() > 1)
+        print(total, "total");
+
+    return out.flush() ? status : BrokenPipeStatus;
+}
+
+int handle_head(const arg_list& args, int in_fd, int out_fd, int err_fd)
+{
+    head_tail_options opts;
+    if (!parse_head_tail(args, false, opts))
+        return BUILTIN_USE_EXTERNAL;
+
+    fd_writer out(out_fd);
+    int status = 0;
+    for (size_t f = 0; f < opts.files.size(); f++)
+    {
+        input_source src;
+        bool opened = src.open(opts.files[f], in_fd, err_fd, "head", error_style::quoted);
+        if (!opened && !src.directory())
+        {
+            status = 1;
+            continue;
+        }
+        // A directory fails on the first read, after its header is out
+        if (opts.files.size() > 1)
+            write_header(out, opts.files[f], f == 0);
+        if (!opened)
+        {
+            status = 1;
+            continue;
+        }
+
+        // Stop reading as soon as enough has been written
+        size_t remaining = opts.count;
+        size_t unread = 0;
+        src.for_each_chunk(
+            [&](std::string_view chunk)
+            {
+                if (remaining == 0)
+                {
+                    unread = chunk.size();
+                    return false;
+                }
+
+                size_t take = chunk.size();
+                if (opts.bytes)
+                {
+                    take = std::min(take, remaining);
+                    remaining -= take;
+                }
+                else
+                {
+                    size_t pos = 0;
+                    while (remaining > 0 && pos < chunk.size())
+                    {
+                        const void* newline = memchr(chunk.data() + pos, '\n', chunk.size() - pos);
+                        if (!newline)
+                        {
+                            pos = chunk.size();
+                            break;
+                        }
+                        pos = static_cast<const char*>(newline) - chunk.data() + 1;
+                        remaining--;
+                    }
+                    take = pos;
+                }
+                unread = chunk.size() - take;
+                return out.write(chunk.substr(0, take)) && remaining > 0;
+            });
+
+        // Like coreutils, leave a seekable stdin just past what was printed so a script's next
+        // command reads on from there
+        if (opts.files[f] == "-" && src.regular() && unread > 0)
+            lseek(src.fd(), -static_cast<off_t>(unread), SEEK_CUR);
+
+        if (out.broken_pipe())
+            return BrokenPipeStatus;
+        if (src.interrupted())
+            return InterruptedStatus;
+    }
+
+    return out.flush() ? status : BrokenPipeStatus;
+}
+
+int handle_tail(const arg_list& args, int in_fd, int out_fd, int err_fd)
+{
+    head_tail_options opts;
+    if (!parse_head_tail(args, true, opts))
+        return BUILTIN_USE_EXTERNAL;
+
+    fd_writer out(out_fd);
+    int status = 0;
+    for (size_t f = 0; f < opts.files.size(); f++)
+    {
+        input_source src;
+        bool opened = src.open(opts.files[f], in_fd, err_fd, "tail", error_style::quoted);
+        if (!opened && !src.directory())
+        {
+            status = 1;
+            continue;
+        }
+        // A directory fails on the first read, after its header is out
+        if (opts.files.size() > 1)
+            write_header(out, opts.files[f], f == 0);
+        if (!opened)
+        {
+            status = 1;
+            continue;
+        }
+
+        if (opts.from_start)
+        {
+            // +N: skip the first N-1 lines or bytes, then stream the rest
+            size_t skip = opts.count > 0 ? opts.count - 1 : 0;
+            src.for_each_chunk(
+                [&](std::string_view chunk)
+                {
+                    while (skip > 0 && !chunk.empty())
+                    {
+                        if (opts.bytes)
+                        {
+                            size_t n = std::min(skip, chunk.size());
+                            chunk.remove_prefix(n);
+                            skip -= n;
+                            continue;
+                        }
+                        size_t newline = chunk.find('\n');
+                        if (newline == std::string_view::npos)
+                            return true;
+                        chunk.remove_prefix(newline + 1);
+                        skip--;
+                    }
+                    return out.write(chunk);
+                });
+        }
+        else
+        {
+            // Mapped files are scanned backwards in place; streams have to be read to the end
+            std::string buffer;
+            std::string_view data;
+            if (src.mapped_data())
+            {
+                data = std::string_view(src.mapped_data(), src.size());
+            }
+            else
+            {
+                src.read_all(buffer);
+                data = buffer;
+            }
+
+            size_t start = data.size();
+            if (opts.bytes)
+            {
+                start = data.size() - std::min(opts.count, data.size());
+            }
+            else if (opts.count > 0)
+            {
+                // A final line without a newline still counts as a line
+                size_t scan = data.size();
+                if (scan > 0 && data[scan - 1] == '\n')
+                    scan--;
+                start = 0;
+                for (size_t found = 0; found < opts.count; found++)
+                {
+                    const void* newline = memrchr(data.data(), '\n', scan);
+                    if (!newline)
+                    {
+                        start = 0;
+                        break;
+                    }
+                    scan = static_cast<const char*>(newline) - data.data();
+                    start = scan + 1;
+                }
+            }
+            out.write(data.substr(start));
+        }
+
+        if (out.broken_pipe())
+            return BrokenPipeStatus;
+        if (src.interrupted())
+            return InterruptedStatus;
+    }
+
+    return out.flush() ? status : BrokenPipeStatus;
+}
+
+int handle_grep(const arg_list& args, int in_fd, int out_fd, int err_fd)
+{
+    bool fixed = false;
+    bool extended = false;
+    bool ignore_case = false;
+    bool invert = false;
+    bool count_only = false;
+    bool line_numbers = false;
+    bool list_files = false;
+    bool quiet = false;
+    bool have_pattern = false;
+    std::string_view pattern;
+    std::vector<std::string_view> files;
+
+    bool options_done = false;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        std::string_view arg = args[i];
+        if (options_done || arg == "-" || arg.size() < 2 || arg[0] != '-')
+        {
+            if (!have_pattern)
+            {
+                pattern = arg;
+                have_pattern = true;
+            }
+            else
+            {
+                files.push_back(arg);
+            }
+            continue;
+        }
+        if (arg == "--")
+        {
+            options_done = true;
+            continue;
+        }
+        if (arg[1] == '-')
+            return BUILTIN_USE_EXTERNAL;
+
+        for (size_t j = 1; j < arg.size(); j++)
+        {
+            switch (arg[j])
+            {
+                case 'F':
+                    fixed = true;
+                    extended = false;
+                    break;
+                case 'E':
+                    extended = true;
+                    fixed = false;
+                    break;
+                case 'G':
+                    extended = fixed = false;
+                    break;
+                case 'i':
+                    ignore_case = true;
+                    break;
+                case 'v':
+                    invert = true;
+                    break;
+                case 'c':
+                    count_only = true;
+                    break;
+                case 'n':
+                    line_numbers = true;
+                    break;
+                case 'l':
+                    list_files = true;
+                    break;
+                case 'q':
+                    quiet = true;
+                    break;
+                case 'e':
+                    // Only a single pattern is handled natively
+                    if (have_pattern)
+                        return BUILTIN_USE_EXTERNAL;
+                    if (j + 1 < arg.size())
+                        pattern = arg.substr(j + 1);
+                    else if (i + 1 < args.size())
+                        pattern = args[++i];
+                    else
+                        return BUILTIN_USE_EXTERNAL;
+                    have_pattern = true;
+                    j = arg.size();
+                    break;
+                default:
+                    return BUILTIN_USE_EXTERNAL;
+            }
+        }
+    }
+
+    // Newlines make several patterns; leave that to the real grep
+    if (!have_pattern || pattern.find('\n') != std::string_view::npos)
+        return BUILTIN_USE_EXTERNAL;
+
+    grep_matcher matcher;
+    if (!matcher.compile(pattern, fixed, extended, ignore_case))
+        return BUILTIN_USE_EXTERNAL;
+
+    bool show_names = files.size() > 1;
+    if (files.empty())
+        files.push_back("-");
+
+    fd_writer out(out_fd);
+    bool any_selected = false;
+    bool had_error = false;
+    for (std::string_view name : files)
+    {
+        input_source src;
+        if (!src.open(name, in_fd, err_fd, "grep"))
+        {
+            had_error = true;
+            continue;
+        }
+
+        std::string label = display_name(name, "(standard input)");
+        size_t selected = 0;
+        size_t line_number = 0;  // Lines fully consumed before the current position
+        bool stop = false;
+
+        // Returns false once nothing more needs to be read from this input
+        auto select = [&](std::string_view line)
+        {
+            selected++;
+            any_selected = true;
+            if (quiet || list_files)
+            {
+                stop = true;
+                return false;
+            }
+            if (count_only)
+                return true;
+
+            std::string prefix;
+            if (show_names)
+                prefix = label + ":";
+            if (line_numbers)
+                prefix += std::to_string(line_number + 1) + ":";
+            bool ok = out.write(prefix) && out.write(line) && out.write("\n");
+            return ok;
+        };
+
+        src.for_each_line_block(
+            [&](std::string_view block)
+            {
+                size_t pos = 0;
+                while (pos < block.size())
+                {
+                    size_t line_start = pos;
+                    size_t line_end;
+                    if (matcher.fixed() && !invert)
+                    {
+                        // Jump straight to the next occurrence instead of walking every line
+                        const void* hit =
+                            memmem(block.data() + pos, block.size() - pos,
+                                   matcher.pattern().data(), matcher.pattern().size());
+                        if (!hit)
+                        {
+                            if (line_numbers)
+                                line_number += count_byte(block.data() + pos, block.size() - pos,
+                                                          '\n');
+                            return true;
+                        }
+                        size_t hit_pos = static_cast<const char*>(hit) - block.data();
+                        const void* prev_newline =
+                            memrchr(block.data() + pos, '\n', hit_pos - pos);
+                        if (prev_newline)
+                            line_start = static_cast<const char*>(prev_newline) - block.data() + 1;
+                        if (line_numbers)
+                            line_number +=
+                                count_byte(block.data() + pos, line_start - pos, '\n');
+
+                        const void* next_newline =
+                            memchr(block.data() + hit_pos, '\n', block.size() - hit_pos);
+                        line_end = next_newline
+                                       ? static_cast<const char*>(next_newline) - block.data()
+                                       : block.size();
+                        if (!select(block.substr(line_start, line_end - line_start)))
+                            return false;
+                    }
+                    else
+                    {
+                        const void* next_newline =
+                            memchr(block.data() + pos, '\n', block.size() - pos);
+                        line_end = next_newline
+                                       ? static_cast<const char*>(next_newline) - block.data()
+                                       : block.size();
+                        std::string_view line = block.substr(line_start, line_end - line_start);
+                        if (matcher.matches(line) != invert && !select(line))
+                            return false;
+                    }
+                    line_number++;
+                    pos = line_end + 1;
+                }
+                return true;
+            });
+
+        if (out.broken_pipe())
+            return BrokenPipeStatus;
+        if (src.interrupted())
+            return InterruptedStatus;
+        if (quiet && stop)
+            break;
+        if (count_only)
+        {
+            std::string line = show_names ? label + ":" : std::string();
+            line += std::to_string(selected) + "\n";
+            out.write(line);
+        }
+        else if (list_files && selected > 0)
+        {
+            out.write(label + "\n");
+        }
+    }
+
+    if (!out.flush())
+        return BrokenPipeStatus;
+    if (quiet && any_selected)
+        return 0;
+    return had_error ? 2 : (any_selected ? 0 : 1);
+}
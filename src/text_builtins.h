@@ -0,0 +1,24 @@
+#pragma once
+
+#include "user_input.h"
+
+// Native versions of the text tools that show up in most pipelines. They work on raw descriptors
+// so a pipeline can run them on a thread inside the shell instead of forking and exec'ing. Files
+// are mmap'd (or sent with sendfile/splice for plain copies) and line counting and substring
+// search are vectorised. Flags they don't implement make them return BUILTIN_USE_EXTERNAL so the
+// real binary runs instead.
+
+// cat [-n] [file...]
+int handle_cat(const arg_list& args, int in_fd, int out_fd, int err_fd);
+
+// wc [-lwc] [file...]
+int handle_wc(const arg_list& args, int in_fd, int out_fd, int err_fd);
+
+// head [-n N | -c N | -N] [file...]
+int handle_head(const arg_list& args, int in_fd, int out_fd, int err_fd);
+
+// tail [-n [+]N | -c N | -N] [file...]
+int handle_tail(const arg_list& args, int in_fd, int out_fd, int err_fd);
+
+// grep [-EFivcnlq] [-e] pattern [file...]
+int handle_grep(const arg_list& args, int in_fd, int out_fd, int err_fd);
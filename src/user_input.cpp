@@ -4,35 +4,81 @@
 #include <readline/readline.h>
 
 #include <algorithm>
+#include <chrono>
 #include <climits>
+#include <cstring>
+#include <filesystem>
+#include <future>
 #include <map>
 
 #include "Trie.h"
+#include "builtin_registry.h"
+#include "history_index.h"
+#include "line_editor.h"
+#include "shell_commands.h"
+#include "shell_plugins.h"
 
 extern std::map<std::string, std::string> Executables;
 extern Trie* trie;
+extern std::shared_future<void> ExecutablesIndexed;
 
-// Common matching logic for both platforms
-std::vector<std::string> find_matching_commands(const std::string& prefix)
+bool user_input::has_builtin_command() const
+{
+    return find_builtin(command) != nullptr || find_plugin_builtin(command) != nullptr;
+}
+
+bool executables_index_ready(std::chrono::milliseconds timeout)
+{
+    return ExecutablesIndexed.valid() &&
+           ExecutablesIndexed.wait_for(timeout) == std::future_status::ready;
+}
+
+std::string longest_common_prefix(const std::vector<std::string>& matches)
+{
+    if (matches.empty())
+        return "";
+
+    const std::string& first = matches.front();
+    const std::string& last = matches.back();
+    size_t len = 0;
+    while (len < first.size() && len < last.size() && first[len] == last[len])
+        len++;
+
+    return first.substr(0, len);
+}
+
+// Common matching logic for both platforms. Executables are only considered when the PATH index
+// is ready; otherwise the result is a partial list of builtins.
+std::vector<std::string> find_matching_commands(const std::string& prefix, bool index_ready)
 {
     std::set<std::string> unique_matches;
-    for (const auto& cmd : BuiltinCommands)
+    for (const auto& builtin : BuiltinRegistry)
     {
-        if (!prefix.empty() && cmd.starts_with(prefix))  // Check if cmd starts with prefix
+        if (!prefix.empty() && builtin.name.starts_with(prefix))  // Check if name starts with prefix
         {
-            unique_matches.insert(cmd);
+            unique_matches.insert(std::string(builtin.name));
         }
     }
-
-    for (const auto& [exe_name, exe_path] : Executables)
+    for (const auto& [name, plugin] : plugin_builtins())
     {
-        if (!prefix.empty() &&
-            exe_name.starts_with(prefix))  // Check if exe_name starts with prefix
+        if (!prefix.empty() && name.starts_with(prefix))
         {
-            unique_matches.insert(exe_name);
+            unique_matches.insert(name);
         }
     }
 
+    if (!index_ready)
+    {
+        return std::vector<std::string>(unique_matches.begin(), unique_matches.end());
+    }
+
+    // Executables is sorted, so the matches are one contiguous run starting at the prefix
+    for (auto it = Executables.lower_bound(prefix);
+         !prefix.empty() && it != Executables.end() && it->first.starts_with(prefix); ++it)
+    {
+        unique_matches.insert(it->first);
+    }
+
     return std::vector<std::string>(unique_matches.begin(), unique_matches.end());
 }
 
@@ -51,7 +97,8 @@ char** command_completion(const char* text, int start, int end)
         lastPrefix = currentPrefix;
     }
 
-    std::vector<std::string> matches = find_matching_commands(std::string(text));
+    bool index_ready = executables_index_ready(IndexWaitOnCompletion);
+    std::vector<std::string> matches = find_matching_commands(std::string(text), index_ready);
 
     if (matches.empty())
     {
@@ -65,7 +112,8 @@ char** command_completion(const char* text, int start, int end)
         {
             // First tab press: complete to longest common prefix. Can use Trie or simple binary
             // search.
-            std::string lcp = trie->getLongestCommonPrefix(currentPrefix);
+            std::string lcp = index_ready ? trie->getLongestCommonPrefix(currentPrefix)
+                                          : longest_common_prefix(matches);
             if (lcp != currentPrefix)
             {
                 // Update the line with the new prefix
@@ -104,21 +152,77 @@ char** command_completion(const char* text, int start, int end)
     return result;
 }
 
-std::string GetUserInput()
+// Feed a line that was just added to the history list to the autosuggestion index
+static void record_history(const std::string& input)
 {
+    std::error_code error;
+    record_history_run(input, std::filesystem::current_path(error).string());
+}
+
+bool GetUserInput(std::string& input, const char* prompt)
+{
+    if (shell_option_enabled("lineedit") && line_editor_supported())
+    {
+        if (!edit_line(prompt, input))
+            return false;
+        if (!input.empty())
+        {
+            add_history(input.c_str());
+            record_history(input);
+        }
+        return true;
+    }
+
     // Linux: use readline with completion callback
     rl_attempted_completion_function = command_completion;
 
-    char* line = readline("$ ");
+    char* line = readline(prompt);
 
     if (line == nullptr)
-        return "";
+    {
+        input.clear();
+        return false;
+    }
 
-    std::string input(line);
+    input.assign(line);
 
     if (!input.empty())
+    {
         add_history(line);
+        record_history(input);
+    }
 
     free(line);
-    return input;
+    return true;
+}
+
+bool GetScriptInput(int fd, std::string& input)
+{
+    input.clear();
+
+    // Seekable input is read in blocks and rewound to just past the newline; pipes and terminals
+    // can't be rewound, so they are read a byte at a time
+    bool seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+    char buffer[4096];
+    size_t chunk = seekable ? sizeof(buffer) : 1;
+    while (true)
+    {
+        ssize_t count = read(fd, buffer, chunk);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return !input.empty();
+
+        const char* newline = static_cast<const char*>(std::memchr(buffer, '\n', count));
+        if (!newline)
+        {
+            input.append(buffer, count);
+            continue;
+        }
+
+        input.append(buffer, newline - buffer);
+        if (seekable)
+            lseek(fd, (newline + 1) - (buffer + count), SEEK_CUR);
+        return true;
+    }
 }
\ No newline at end of file
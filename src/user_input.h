@@ -1,36 +1,106 @@
 #pragma once
 
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
 #include <set>
+#include <streambuf>
 #include <string>
+#include <string_view>
 #include <vector>
 
-namespace fs = std::filesystem;
+#include "shell_placement.h"
 
-// Builtin command names
-const std::string BUILTIN_ECHO = "echo";
-const std::string BUILTIN_TYPE = "type";
-const std::string BUILTIN_EXIT = "exit";
-const std::string BUILTIN_PWD = "pwd";
-const std::string BUILTIN_CD = "cd";
-const std::string BUILTIN_HISTORY = "history";
+namespace fs = std::filesystem;
 
-const std::set<std::string> BuiltinCommands = {BUILTIN_ECHO, BUILTIN_TYPE, BUILTIN_EXIT,
-                                               BUILTIN_PWD,  BUILTIN_CD,   BUILTIN_HISTORY};
 const std::set<char> EscapedCharsInDoubleQuotes = {'$', '`', '"', '\\', '\n'};
 
-std::string GetUserInput();
+// Read the next line from the terminal into input, reusing its capacity. Returns false at end of
+// input (Ctrl-D on an empty line).
+bool GetUserInput(std::string& input, const char* prompt = "$ ");
+
+// Command-name completion, shared by readline and the built-in line editor. Executables are only
+// offered once the background PATH index is ready; a TAB waits at most IndexWaitOnCompletion
+// for it.
+constexpr std::chrono::milliseconds IndexWaitOnCompletion(100);
+bool executables_index_ready(std::chrono::milliseconds timeout);
+std::vector<std::string> find_matching_commands(const std::string& prefix, bool index_ready);
+
+// Longest common prefix of a sorted list of matches
+std::string longest_common_prefix(const std::vector<std::string>& matches);
+
+// Read the next line of a script from fd, without a prompt or history. Never consumes input past
+// the newline, so commands the script runs read the rest of fd themselves, as in sh. Returns false
+// at end of input.
+bool GetScriptInput(int fd, std::string& input);
+
+// Parse results live in a per-command-line arena, so strings and argument lists use pmr
+// allocators and are released all at once after the line has executed
+using shell_string = std::pmr::string;
+using arg_list = std::pmr::vector<shell_string>;
 
 struct user_input
 {
-    std::string command = "";
-    std::vector<std::string> args = {};
-    std::string stdout_redirect_filename = "";
-    std::string stderr_redirect_filename = "";
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    shell_string command;
+    arg_list args;
+    shell_string stdout_redirect_filename;
+    shell_string stderr_redirect_filename;
     bool stdout_append = false;
     bool stderr_append = false;
+    // CPU affinity and resource limits from `cpuset` / `ulimit` prefixes
+    stage_placement placement;
+    // Indices of the args that are <(...) or >(...) process substitutions. Such an arg holds
+    // the substitution as written until the executor replaces it with a /dev/fd path. A
+    // redirection target can be one too (`> >(gzip > f)`), listed as one of the two markers below.
+    std::pmr::vector<size_t> process_substitutions;
+    static constexpr size_t StdoutTargetSubstitution = std::numeric_limits<size_t>::max();
+    static constexpr size_t StderrTargetSubstitution = StdoutTargetSubstitution - 1;
+
+    explicit user_input(allocator_type alloc = {})
+        : command(alloc),
+          args(alloc),
+          stdout_redirect_filename(alloc),
+          stderr_redirect_filename(alloc),
+          placement(alloc),
+          process_substitutions(alloc)
+    {
+    }
+
+    user_input(const user_input& other, allocator_type alloc = {})
+        : command(other.command, alloc),
+          args(other.args, alloc),
+          stdout_redirect_filename(other.stdout_redirect_filename, alloc),
+          stderr_redirect_filename(other.stderr_redirect_filename, alloc),
+          stdout_append(other.stdout_append),
+          stderr_append(other.stderr_append),
+          placement(other.placement, alloc),
+          process_substitutions(other.process_substitutions, alloc)
+    {
+    }
+
+    user_input(user_input&& other, allocator_type alloc)
+        : command(std::move(other.command), alloc),
+          args(std::move(other.args), alloc),
+          stdout_redirect_filename(std::move(other.stdout_redirect_filename), alloc),
+          stderr_redirect_filename(std::move(other.stderr_redirect_filename), alloc),
+          stdout_append(other.stdout_append),
+          stderr_append(other.stderr_append),
+          placement(std::move(other.placement), alloc),
+          process_substitutions(std::move(other.process_substitutions), alloc)
+    {
+    }
+
+    user_input(user_input&&) = default;
+    user_input& operator=(const user_input&) = default;
+    user_input& operator=(user_input&&) = default;
 
     bool has_stdout_redirect() const
     {
@@ -42,31 +112,46 @@ struct user_input
         return !stderr_redirect_filename.empty();
     }
 
-    bool has_builtin_command() const
-    {
-        return BuiltinCommands.contains(command);
-    }
+    // Whether command names an entry in the builtin registry
+    bool has_builtin_command() const;
 
     bool has_arguments() const
     {
         return !args.empty();
     }
+
+    bool has_process_substitutions() const
+    {
+        return !process_substitutions.empty();
+    }
+
+    // The arg or redirection target that entry index of process_substitutions stands for
+    shell_string& substitution_word(size_t index)
+    {
+        if (index == StdoutTargetSubstitution)
+            return stdout_redirect_filename;
+        if (index == StderrTargetSubstitution)
+            return stderr_redirect_filename;
+        return args[index];
+    }
 };
 
+// All stages of one command line, allocated from the line's arena
+using user_input_list = std::pmr::vector<user_input>;
+
 // RAII class to redirect any ostream to a file
 class stream_redirector
 {
    public:
-    stream_redirector(std::ostream& stream, const std::string& filename,
+    stream_redirector(std::ostream& stream, const fs::path& filename,
                       std::ios_base::openmode mode = std::ios::out | std::ios::trunc)
         : stream_(stream)
     {
         original_buf = stream.rdbuf();
 
-        fs::path file_path(filename);
-        if (file_path.has_parent_path())
+        if (filename.has_parent_path())
         {
-            fs::create_directories(file_path.parent_path());
+            fs::create_directories(filename.parent_path());
         }
 
         file_stream.open(filename, mode);
@@ -94,3 +179,54 @@ class stream_redirector
     std::streambuf* original_buf;
     std::ofstream file_stream;
 };
+
+// Output streambuf writing straight to a file descriptor. Lets in-process builtins point
+// std::cout at a pipe. Write errors (e.g. the reader went away) drop the data, matching a forked
+// builtin being killed by SIGPIPE without taking the shell down with it.
+class fd_streambuf : public std::streambuf
+{
+   public:
+    explicit fd_streambuf(int fd) : fd_(fd)
+    {
+        setp(buffer_, buffer_ + sizeof(buffer_));
+    }
+
+    ~fd_streambuf() override
+    {
+        sync();
+    }
+
+   protected:
+    int_type overflow(int_type ch) override
+    {
+        sync();
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override
+    {
+        const char* data = pbase();
+        size_t remaining = pptr() - pbase();
+        while (remaining > 0)
+        {
+            ssize_t written = ::write(fd_, data, remaining);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                break;
+            data += written;
+            remaining -= written;
+        }
+        setp(buffer_, buffer_ + sizeof(buffer_));
+        return 0;
+    }
+
+   private:
+    int fd_;
+    char buffer_[4096];
+};
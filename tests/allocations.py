@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+"""Builtin command lines make no heap allocations once the shell is warmed up.
+
+Needs a shell built with SHELL_COUNT_ALLOCATIONS, which reports `[alloc] N` on stderr after
+every command line. Each line below runs a few times to warm up and is then checked.
+"""
+
+import argparse
+import subprocess
+import sys
+
+LINES = [
+    "echo hi",
+    'echo several words "and a quoted one" \'and another\'',
+    "echo $HOME",
+    "type echo",
+    "type cat",
+    "true",
+]
+WARMUP = 2
+CHECKED = 3
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True, help="shell built with SHELL_COUNT_ALLOCATIONS")
+    args = parser.parse_args()
+
+    script = []
+    for line in LINES:
+        script += [line] * (WARMUP + CHECKED)
+    result = subprocess.run([args.shell], input="\n".join(script) + "\n", text=True,
+                            capture_output=True, timeout=30)
+    counts = [int(line.split()[1]) for line in result.stderr.splitlines()
+              if line.startswith("[alloc] ")]
+    if len(counts) != len(script):
+        print("FAIL expected %d [alloc] reports, got %d:\n%s"
+              % (len(script), len(counts), result.stderr))
+        return 1
+
+    failures = 0
+    for i, line in enumerate(LINES):
+        runs = counts[i * (WARMUP + CHECKED):(i + 1) * (WARMUP + CHECKED)]
+        checked = runs[WARMUP:]
+        if any(checked):
+            failures += 1
+            print("FAIL %-50s allocations per run %s" % (line, runs))
+        else:
+            print("ok   %-50s allocations per run %s" % (line, runs))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+"""batch passes exactly the words it was given, in order, however it splits them into runs.
+
+The fixed arguments before the first `--` start every run, that `--` goes to none of them, and
+the words after it are spread over as many runs as ARG_MAX needs, with or without -j.
+"""
+
+import argparse
+import subprocess
+import sys
+
+WORDS = ["word%d" % n for n in range(300000)]
+
+# Script for the shell's stdin, then its exact stdout and status
+CASES = [
+    ("batch echo a b -- c d", "a b c d\n", 0),
+    ("batch printf '%s\\n' -- -- a b", "--\na\nb\n", 0),
+    ("batch echo a b", "", 2),
+    ("batch printf '%s\\n' -- " + " ".join(WORDS), "".join(w + "\n" for w in WORDS), 0),
+    ("batch -j 4 printf '%s\\n' -- " + " ".join(WORDS), "".join(w + "\n" for w in WORDS), 0),
+]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True)
+    args = parser.parse_args()
+
+    failures = 0
+    for script, expected, status in CASES:
+        name = script if len(script) < 60 else script[:60] + "..."
+        result = subprocess.run([args.shell], input=script + "\n", capture_output=True, text=True,
+                                timeout=120)
+        if result.stdout != expected or result.returncode != status:
+            failures += 1
+            print("FAIL %s: status %d, %d lines of output, %r" %
+                  (name, result.returncode, result.stdout.count("\n"), result.stdout[:200]))
+        else:
+            print("ok   %s" % name)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
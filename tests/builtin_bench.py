@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Throughput of the text builtins against the external tools, written as JSON.
+
+Each command line runs twice over the same file: once as typed, which runs the builtins, and
+once with the tools called by full path, which runs the coreutils/grep binaries. Times are from
+Enter to the next prompt on a pty (best of --runs, page cache warm), so they include everything
+the user waits for. Output goes to a file: GNU grep stops at the first match when its output is
+/dev/null, and copying to /dev/null costs nothing.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+from pty_shell import PtyShell
+
+TOOLS = ["cat", "wc", "head", "tail", "grep"]
+COMMANDS = [
+    "cat {big} > {out}",
+    "cat {big} | cat > {out}",
+    "wc -l {big} > {out}",
+    "wc {big} > {out}",
+    "cat {big} | wc -l > {out}",
+    "grep -c fox {big} > {out}",
+    "grep -F -c 'lazy dog 42' {big} > {out}",
+    "cat {big} | grep fox | wc -l > {out}",
+    "head -n 1000000 {big} > {out}",
+    "tail -n 1000 {big} > {out}",
+]
+
+
+def make_big_file(path, megabytes):
+    lines = []
+    for n in range(20000):
+        lines.append(b"the quick brown fox jumps over the lazy dog %d\n" % n if n % 7 == 0
+                     else b"lorem ipsum dolor sit amet consectetur %d adipiscing elit\n" % n)
+    block = b"".join(lines)
+    size = 0
+    with open(path, "wb") as big:
+        while size < megabytes * 1024 * 1024:
+            big.write(block)
+            size += len(block)
+    return size
+
+
+def external(command):
+    """The command with every text tool replaced by the binary's full path."""
+    words = command.split(" ")
+    for i, word in enumerate(words):
+        if word in TOOLS and (i == 0 or words[i - 1] == "|"):
+            words[i] = shutil.which(word)
+    return " ".join(words)
+
+
+def best_time(shell, command, runs):
+    shell.run(command, timeout=300)
+    best = None
+    for _ in range(runs):
+        start = time.perf_counter()
+        shell.run(command, timeout=300)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True)
+    parser.add_argument("--output", help="write the JSON here as well as to stdout")
+    parser.add_argument("--runs", type=int, default=3)
+    parser.add_argument("--megabytes", type=int, default=512)
+    args = parser.parse_args()
+    shell_path = os.path.abspath(args.shell)
+
+    results = {"benchmark": "text builtins", "shell": shell_path, "time": time.time(),
+               "commands": []}
+    with tempfile.TemporaryDirectory() as root:
+        big = os.path.join(root, "big.txt")
+        size = make_big_file(big, args.megabytes)
+        out = os.path.join(root, "out.txt")
+        results["input_bytes"] = size
+        env = dict(os.environ)
+        env["HOME"] = root
+        env.pop("HISTFILE", None)
+        with PtyShell(shell_path, env) as shell:
+            shell.wait_prompt()
+            for command in COMMANDS:
+                line = command.format(big=big, out=out)
+                builtin = best_time(shell, line, args.runs)
+                binary = best_time(shell, external(line), args.runs)
+                results["commands"].append({
+                    "command": command.format(big="big.txt", out="out.txt"),
+                    "builtin_GBps": size / builtin / 1e9,
+                    "external_GBps": size / binary / 1e9,
+                    "speedup": binary / builtin,
+                })
+
+    text = json.dumps(results, indent=1)
+    print(text)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(text + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,26 @@
+if true; then echo then; else echo else; fi
+if false; then echo then; elif true; then echo elif; fi
+for i in 1 2 3; do echo "item $i"; done
+i=0
+while [ $i -lt 3 ]; do echo "loop $i"; i=$((i + 1)); done
+until [ $i -eq 0 ]; do i=$((i - 1)); done
+echo "after $i"
+case hello in h*) echo matched;; *) echo default;; esac
+greet() { echo "hello $1"; }
+greet there
+true && echo and-ran
+false || echo or-ran
+false && echo skipped
+echo "last $?"
+for i in 1 2; do false; done
+echo "for $?"
+i=0
+while [ $i -lt 2 ]; do i=$((i + 1)); false; done
+echo "while $?"
+false
+for i in; do false; done
+echo "empty $?"
+for i in 1 2; do for j in a b; do false; continue 2; done; done
+echo "continue $?"
+if false; then break; fi
+echo "unreached break $?"
@@ -0,0 +1,9 @@
+printf '%s\n' c a b | sort
+printf '%s\n' one two three | grep t | wc -l
+seq 1 1000 | tail -n 3
+seq 1 1000 | head -n 2
+false | true
+echo "status $?"
+true | false
+echo "status $?"
+echo piped | cat | cat | cat
@@ -0,0 +1,5 @@
+printf '<%s>\n' plain 'single quoted' "double quoted"
+printf '<%s>\n' 'it''s' "say \"hi\"" "back\\slash" "dollar \$HOME" "keep \a \n"
+printf '<%s>\n' a\ b a\'b a\"b a\\b \$x \* \; \| \&
+printf '<%s>\n' '' "" a''b "a""b" 'mixed'"quotes"unquoted
+printf '<%s>\n' '>' ">>" \> '2>' "|"
@@ -0,0 +1,12 @@
+echo first > out.txt
+echo second >> out.txt
+cat out.txt
+ls missing-file 2> err.txt
+echo "status $?"
+cat err.txt | wc -l
+printf '%s\n' one two 1> both.txt 2> both-err.txt
+cat both.txt both-err.txt
+printf '%s\n' three 2> late-err.txt > late.txt
+cat late.txt
+echo quoted ">" not-a-file
+ls not-a-file 2>/dev/null || echo "not created"
@@ -0,0 +1,12 @@
+/bin/echo run by path
+/bin/sh -c "exit 4"
+echo "path status $?"
+true
+echo "true $?"
+false
+echo "false $?"
+sh -c 'exit 7'
+echo "exit $?"
+{ echo grouped; false; }
+echo "group $?"
+exit 3
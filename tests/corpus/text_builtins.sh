@@ -0,0 +1,26 @@
+seq 1 20 > numbers.txt
+cat numbers.txt | wc -l
+wc -l numbers.txt
+wc -c numbers.txt 2>/dev/null
+head -n 3 numbers.txt
+tail -n 2 numbers.txt
+tail -n +19 numbers.txt
+grep -c 1 numbers.txt
+grep -n '^2' numbers.txt
+grep -v 1 numbers.txt | head -n 2
+cat -n numbers.txt | tail -n 1
+grep nothing numbers.txt
+echo "grep $?"
+wc -l missing.txt numbers.txt 2>/dev/null
+echo "wc $?"
+mkdir adir
+head -n 1 missing.txt
+echo "head $?"
+tail -n 1 missing.txt
+echo "tail $?"
+head -n 1 numbers.txt adir
+echo "head dir $?"
+tail -n 1 adir numbers.txt
+echo "tail dir $?"
+wc adir numbers.txt
+echo "wc dir $?"
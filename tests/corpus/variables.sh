@@ -0,0 +1,13 @@
+name=world
+empty=
+spaced='two  words'
+printf '<%s>\n' "$name" "${name}s" $name$name "$spaced" $empty "$empty" ${empty}x
+name=again
+printf '<%s>\n' "$name" '$name' "\$name"
+printf '<%s>\n' $undefined "$undefined"
+echo "arith $((9223372036854775807 + 1)) $((-7 % 3)) $((7 / -2)) $((2 * 3 + 1))"
+FOO=prefix env | grep '^FOO='
+echo "after [$FOO]"
+BAR=old
+BAR=new sh -c 'echo "child $BAR"'
+echo "kept $BAR"
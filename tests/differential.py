@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""Differential test: run the same scripts through this shell and a reference POSIX sh.
+
+Every case runs as `SHELL -c SCRIPT` in a fresh scratch directory, with stdin from /dev/null and
+a fixed environment. Its stdout, stderr and exit status must match the reference's exactly. The
+cases are the corpus scripts (one per *.sh file) plus randomly generated command lines that
+stress quoting, escapes, expansion and redirection, the parser paths most easily broken.
+
+Each case is timed on both shells (best of --runs) and written to --report as JSON, so a run
+shows latency regressions next to conformance ones. Exits 1 if any case differs.
+"""
+
+import argparse
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+# Characters a generated word may carry inside each kind of quoting
+PLAIN = "abcxyz019_.,:+-=@%/"
+SINGLE = PLAIN + " \t\"\\$`*?[]#~&|;<>(){}"
+DOUBLE = PLAIN + " '*?[]#~&|;<>(){}"
+DOUBLE_ESCAPES = ["\\\\", "\\\"", "\\$", "\\`", "\\a", "\\n"]
+UNQUOTED_ESCAPES = ["\\ ", "\\'", "\\\"", "\\\\", "\\$", "\\*", "\\;", "\\|", "\\&", "\\>"]
+VARIABLES = {"v": "one", "w": "two  words", "e": ""}
+
+
+def random_text(rng, alphabet, longest):
+    return "".join(rng.choice(alphabet) for _ in range(rng.randint(0, longest)))
+
+
+def random_fragment(rng):
+    kind = rng.randrange(7)
+    if kind == 0:
+        return random_text(rng, PLAIN, 6) or "x"
+    if kind == 1:
+        return "'" + random_text(rng, SINGLE, 8) + "'"
+    if kind == 2:
+        parts = [random_text(rng, DOUBLE, 4) for _ in range(rng.randint(1, 3))]
+        body = "".join(part + rng.choice(DOUBLE_ESCAPES + ["$v", "${w}", "$e"]) for part in parts)
+        return '"' + body + '"'
+    if kind == 3:
+        return rng.choice(UNQUOTED_ESCAPES)
+    if kind == 4:
+        # Unquoted expansions are only split into fields in for lists, so $w stays quoted here
+        return rng.choice(["$v", "${v}x", "$e", "${e}"])
+    if kind == 5:
+        return rng.choice(['""', "''", '"$w"'])
+    return rng.choice(["a", "b"]) + rng.choice(UNQUOTED_ESCAPES) + rng.choice(["c", "d"])
+
+
+def random_word(rng):
+    return "".join(random_fragment(rng) for _ in range(rng.randint(1, 3)))
+
+
+def random_case(rng):
+    words = " ".join(random_word(rng) for _ in range(rng.randint(1, 5)))
+    assignments = "; ".join("%s='%s'" % item for item in VARIABLES.items())
+    command = "printf '<%s>\\n' " + words
+    shape = rng.randrange(5)
+    if shape == 0:
+        body = command
+    elif shape == 1:
+        body = command + " > out.txt; cat out.txt"
+    elif shape == 2:
+        body = "echo first > out.txt; " + command + " >> out.txt; cat out.txt"
+    elif shape == 3:
+        body = command + " | cat"
+    else:
+        body = command + " 1> out.txt 2> err.txt; cat out.txt err.txt"
+    return assignments + "; " + body
+
+
+def run(shell, script, workdir, env, runs):
+    best = None
+    for _ in range(runs):
+        # Every run starts from the same empty directory
+        for entry in os.listdir(workdir):
+            path = os.path.join(workdir, entry)
+            shutil.rmtree(path) if os.path.isdir(path) else os.unlink(path)
+        start = time.perf_counter()
+        result = subprocess.run([shell, "-c", script], cwd=workdir, env=env,
+                                stdin=subprocess.DEVNULL, capture_output=True, timeout=30)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return result, best
+
+
+def load_corpus(directory):
+    cases = []
+    for name in sorted(os.listdir(directory)):
+        if name.endswith(".sh"):
+            with open(os.path.join(directory, name)) as script:
+                cases.append((name, script.read()))
+    return cases
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True, help="shell under test")
+    parser.add_argument("--reference", default="/bin/sh", help="POSIX sh to compare against")
+    parser.add_argument("--corpus", help="directory of *.sh cases")
+    parser.add_argument("--random", type=int, default=200, help="generated cases to add")
+    parser.add_argument("--seed", type=int, default=None, help="seed for generated cases")
+    parser.add_argument("--runs", type=int, default=3, help="timed runs per case and shell")
+    parser.add_argument("--report", help="write per-case results here as JSON")
+    args = parser.parse_args()
+    args.shell = os.path.abspath(args.shell)
+
+    seed = args.seed if args.seed is not None else random.randrange(1 << 32)
+    rng = random.Random(seed)
+    cases = load_corpus(args.corpus) if args.corpus else []
+    cases += [("random-%d" % i, random_case(rng)) for i in range(args.random)]
+
+    env = {"PATH": os.environ.get("PATH", "/usr/bin:/bin"), "LC_ALL": "C", "TERM": "dumb"}
+    results = []
+    failures = 0
+    with tempfile.TemporaryDirectory() as scratch:
+        env["HOME"] = scratch
+        workdir = os.path.join(scratch, "work")
+        os.mkdir(workdir)
+        for name, script in cases:
+            ours, our_time = run(args.shell, script, workdir, env, args.runs)
+            theirs, their_time = run(args.reference, script, workdir, env, args.runs)
+            differences = [stream for stream in ("stdout", "stderr", "returncode")
+                           if getattr(ours, stream) != getattr(theirs, stream)]
+            results.append({"case": name, "ok": not differences, "differences": differences,
+                            "shell_ms": our_time * 1000, "reference_ms": their_time * 1000})
+            if differences:
+                failures += 1
+                print("FAIL %s (%s)" % (name, ", ".join(differences)))
+                print("  script:    %r" % script)
+                for stream in differences:
+                    print("  %-10s %r" % (stream + ":", getattr(ours, stream)))
+                    print("  %-10s %r" % ("expected:", getattr(theirs, stream)))
+
+    if args.report:
+        with open(args.report, "w") as report:
+            json.dump({"seed": seed, "cases": results}, report, indent=1)
+
+    ours = sorted(result["shell_ms"] for result in results)
+    theirs = sorted(result["reference_ms"] for result in results)
+    print("%d cases, %d differ (seed %d)" % (len(results), failures, seed))
+    if results:
+        print("median latency: shell %.2f ms, reference %.2f ms"
+              % (ours[len(ours) // 2], theirs[len(theirs) // 2]))
+        slowest = max(results, key=lambda result: result["shell_ms"] / result["reference_ms"])
+        print("slowest relative to reference: %s (%.2f ms vs %.2f ms)"
+              % (slowest["case"], slowest["shell_ms"], slowest["reference_ms"]))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
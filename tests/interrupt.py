@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Ctrl-C stops the foreground command, never the shell, and shows up in $? and PIPESTATUS.
+
+Covers external commands, in-process builtins reading the terminal (the fd builtins run with
+no pipeline and the fallback to the external tool), pipelines mixing the two, output
+compressed by the shell's own threads with `set -o gzip`, and a command run while the PATH
+index is still being built in the background.
+"""
+
+import argparse
+import os
+import sys
+import tempfile
+import time
+
+from pty_shell import PtyShell
+
+# Command, then what $? and PIPESTATUS must say after Ctrl-C
+CASES = [
+    ("sleep 5", "130 130"),
+    ("wc -l", "130 130"),
+    ("cat", "130 130"),
+    ("head -n 3", "130 130"),
+    ("grep x", "130 130"),
+    ("tail -f /dev/null", "130 130"),
+    ("cat | wc -l", "130 130 130"),
+    ("sleep 5 | cat", "130 130 130"),
+    ("batch sleep -- 5", "130 130"),
+    ("set -o gzip", None),
+    ("cat > x.gz", "130 130"),
+    ("sleep 5 > x.gz", "130 130"),
+]
+
+
+def interrupt(shell, command, expected, delay=0.3):
+    """Run command, press Ctrl-C after delay seconds and check $? and PIPESTATUS."""
+    shell.send(command + "\n")
+    # Let it start reading or waiting before the interrupt arrives
+    time.sleep(delay)
+    shell.send(b"\x03")
+    try:
+        shell.wait_prompt(timeout=5)
+        output = shell.run('echo "status $? ${PIPESTATUS[@]}"')
+    except (TimeoutError, EOFError) as error:
+        print("FAIL %s: %s" % (command, error))
+        return False
+    line = "status " + expected
+    if line.encode() not in output:
+        print("FAIL %s: expected %r in %r" % (command, line, output))
+        return False
+    print("ok   %s" % command)
+    return True
+
+
+def make_path(root, entries):
+    directory = os.path.join(root, "bin")
+    os.mkdir(directory)
+    for n in range(entries):
+        os.close(os.open(os.path.join(directory, "zz%d" % n), os.O_CREAT | os.O_WRONLY, 0o755))
+    return directory
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True)
+    args = parser.parse_args()
+    shell_path = os.path.abspath(args.shell)
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as root:
+        with PtyShell(shell_path) as shell:
+            shell.wait_prompt()
+            shell.run("cd " + root)
+            for command, expected in CASES:
+                if expected is None:
+                    shell.run(command)
+                elif not interrupt(shell, command, expected):
+                    failures += 1
+            if not shell.alive():
+                print("FAIL shell exited")
+                return 1
+
+        # Ctrl-C while the completion index is still being built in the background
+        env = dict(os.environ)
+        env["PATH"] = make_path(root, 200000) + ":" + env.get("PATH", "/usr/bin")
+        with PtyShell(shell_path, env) as shell:
+            shell.wait_prompt()
+            if not interrupt(shell, "sleep 5", "130 130", delay=0.1):
+                failures += 1
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Keystroke-to-render latency on a pty, written as JSON.
+
+A keystroke is timed from writing it to the pty to the first byte of the editor's answer, which
+for the built-in editor (`set -o lineedit`) is its single write of the screen changes. Typing
+and deleting a character are measured at the end of lines of several lengths, for readline and
+for the built-in editor.
+
+The built-in editor also highlights the line, re-lexing it only from the edited position. That
+cost is measured on long lines full of quotes, expansions and operators, both at the end and in
+the middle, where typing a quote changes how everything after it is lexed.
+
+Every keystroke at the end of the line also looks up the best history entry to suggest. That
+is measured with HISTFILEs of up to a few million distinct entries, typing a prefix many of them
+share.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import sys
+import tempfile
+import time
+
+from pty_shell import PtyShell
+
+EDITORS = {"readline": None, "lineedit": "set -o lineedit"}
+LINE_LENGTHS = [0, 1000, 10000]
+HISTORY_SIZES = [0, 100000, 1000000, 3000000]
+
+
+def filler(length):
+    """Plain words, so the line only costs its length."""
+    text = ""
+    while len(text) < length:
+        text += "argument%d " % len(text)
+    return text[:length]
+
+
+def shell_syntax(length):
+    """Words of every kind the highlighter colours differently."""
+    text = ""
+    while len(text) < length:
+        text += "echo \"text $HOME\" 'single' > out.txt | grep -F x && ls -l; "
+    return text[:length]
+
+
+def start_editor(shell_path, env, editor):
+    shell = PtyShell(shell_path, env)
+    shell.wait_prompt(timeout=120)
+    if EDITORS[editor]:
+        shell.run(EDITORS[editor], timeout=120)
+    return shell
+
+
+def fill_line(shell, text):
+    """Type text onto the current line, a chunk at a time, and wait for the screen to settle."""
+    for start in range(0, len(text), 512):
+        shell.send(text[start:start + 512])
+        shell.drain(0.005)
+    shell.drain(0.05)
+
+
+def keystroke(shell, key):
+    """Seconds from sending key to the first byte of the editor's answer."""
+    start = time.perf_counter()
+    shell.send(key)
+    shell.read_until(lambda buffer: len(buffer) > 0)
+    elapsed = time.perf_counter() - start
+    shell.drain(0.002)
+    return elapsed
+
+
+def typing_latency(shell, runs, key=b"x"):
+    """Type key and delete it again at the cursor, runs times each."""
+    typed, deleted = [], []
+    for _ in range(runs):
+        typed.append(keystroke(shell, key))
+        deleted.append(keystroke(shell, b"\x7f"))
+    return {"type_us": summary(typed), "delete_us": summary(deleted)}
+
+
+def clear_line(shell):
+    shell.send(b"\x05\x15")  # end of line, then kill to its start
+    shell.drain(0.05)
+
+
+def summary(samples):
+    samples = sorted(sample * 1e6 for sample in samples)
+    return {"median": statistics.median(samples), "p90": samples[int(len(samples) * 0.9)],
+            "max": samples[-1]}
+
+
+def line_lengths(shell_path, env, runs):
+    results = {}
+    for editor in EDITORS:
+        with start_editor(shell_path, env, editor) as shell:
+            rows = []
+            for length in LINE_LENGTHS:
+                fill_line(shell, filler(length))
+                rows.append({"line_length": length, **typing_latency(shell, runs)})
+                clear_line(shell)
+            results[editor] = rows
+    return results
+
+
+def highlighting(shell_path, env, runs):
+    rows = []
+    with start_editor(shell_path, env, "lineedit") as shell:
+        for length in LINE_LENGTHS[1:]:
+            fill_line(shell, shell_syntax(length))
+            row = {"line_length": length, "end": typing_latency(shell, runs)}
+            # Cursor to the middle of the line, then type a quote there and delete it again
+            shell.send(b"\x01" + b"\x1b[C" * (length // 2))
+            shell.drain(0.05)
+            quote = {"type_us": [], "delete_us": []}
+            for _ in range(runs):
+                quote["type_us"].append(keystroke(shell, b'"'))
+                quote["delete_us"].append(keystroke(shell, b"\x7f"))
+            row["middle_quote"] = {key: summary(samples) for key, samples in quote.items()}
+            rows.append(row)
+            clear_line(shell)
+    return rows
+
+
+def history_suggestions(shell_path, env, root, runs):
+    rows = []
+    for entries in HISTORY_SIZES:
+        env = dict(env, HISTFILE=os.path.join(root, "history"))
+        with open(env["HISTFILE"], "w") as history:
+            for n in range(entries):
+                history.write("git commit -m 'change number %d' --author dev%d\n" % (n, n % 97))
+        with start_editor(shell_path, env, "lineedit") as shell:
+            # Entries 4, 40-49, 400-499 and so on match, and still do with a 2 typed after it
+            fill_line(shell, "git commit -m 'change number 4")
+            rows.append({"history_entries": entries, **typing_latency(shell, runs, b"2")})
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True)
+    parser.add_argument("--output", help="write the JSON here as well as to stdout")
+    parser.add_argument("--runs", type=int, default=200)
+    args = parser.parse_args()
+    shell_path = os.path.abspath(args.shell)
+
+    results = {"benchmark": "keystroke", "shell": shell_path, "time": time.time()}
+    with tempfile.TemporaryDirectory() as root:
+        env = dict(os.environ)
+        env["HOME"] = root
+        env["TERM"] = "xterm-256color"
+        env.pop("HISTFILE", None)
+        results["end_of_line"] = line_lengths(shell_path, env, args.runs)
+        results["highlighted_lines"] = highlighting(shell_path, env, args.runs)
+        results["history_suggestions"] = history_suggestions(shell_path, env, root, args.runs)
+
+    text = json.dumps(results, indent=1)
+    print(text)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(text + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
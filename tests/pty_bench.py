@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""End-to-end benchmark of the shell on a pty, written as JSON for tracking over time.
+
+Measures what microbenchmarks miss, through the real terminal, process and pipe paths: time to
+the first prompt, Enter-to-next-prompt round trips for a builtin and an external command, TAB
+completion with a large synthetic PATH, and pipeline throughput in GB/s.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import sys
+import tempfile
+import time
+
+from pty_shell import PtyShell
+
+PIPELINES = [
+    "cat {big} | cat | cat > /dev/null",
+    "cat {big} | wc -l > /dev/null",
+    "cat {big} | grep -c zzz > /dev/null",
+]
+
+
+def summary(samples, scale):
+    samples = sorted(sample * scale for sample in samples)
+    return {"median": statistics.median(samples), "min": samples[0],
+            "p90": samples[int(len(samples) * 0.9)], "samples": len(samples)}
+
+
+def first_prompt(shell_path, env, runs):
+    samples = []
+    for _ in range(runs):
+        with PtyShell(shell_path, env) as shell:
+            shell.wait_prompt()
+            samples.append(time.perf_counter() - shell.started_at)
+    return summary(samples, 1e3)
+
+
+def round_trip(shell, command, runs):
+    samples = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        shell.run(command)
+        samples.append(time.perf_counter() - start)
+    return summary(samples, 1e6)
+
+
+def make_path(root, entries):
+    directory = os.path.join(root, "bin")
+    os.mkdir(directory)
+    for n in range(entries):
+        path = os.path.join(directory, "zzbench%d" % n)
+        os.close(os.open(path, os.O_CREAT | os.O_WRONLY, 0o755))
+    os.close(os.open(os.path.join(directory, "zzuniquecmd"), os.O_CREAT | os.O_WRONLY, 0o755))
+    return directory
+
+
+def tab_completion(shell, runs):
+    # Wait for the background index, then time TAB to the completed word
+    deadline = time.monotonic() + 30
+    while True:
+        shell.send("\x15zzunique\t")
+        try:
+            shell.read_text(b"zzuniquecmd ", timeout=0.5)
+            break
+        except TimeoutError:
+            if time.monotonic() > deadline:
+                raise
+    samples = []
+    for _ in range(runs):
+        shell.send("\x15")
+        shell.drain()
+        start = time.perf_counter()
+        shell.send("zzunique\t")
+        shell.read_text(b"zzuniquecmd ")
+        samples.append(time.perf_counter() - start)
+    shell.send("\x15")
+    return summary(samples, 1e6)
+
+
+def make_big_file(path, megabytes):
+    line = b"the quick brown fox jumps over the lazy dog 0123456789\n"
+    block = line * (1024 * 1024 // len(line) + 1)
+    block = block[:1024 * 1024]
+    with open(path, "wb") as big:
+        for _ in range(megabytes):
+            big.write(block)
+    return megabytes * 1024 * 1024
+
+
+def pipelines(shell, big, size, runs):
+    results = {}
+    for pipeline in PIPELINES:
+        command = pipeline.format(big=big)
+        shell.run(command, timeout=300)  # warm the page cache
+        samples = []
+        for _ in range(runs):
+            start = time.perf_counter()
+            shell.run(command, timeout=300)
+            samples.append(time.perf_counter() - start)
+        best = min(samples)
+        results[pipeline.format(big="big")] = {"GBps": size / best / 1e9, "seconds": best}
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True)
+    parser.add_argument("--output", help="write the JSON here as well as to stdout")
+    parser.add_argument("--runs", type=int, default=200, help="samples per latency")
+    parser.add_argument("--path-entries", type=int, default=50000)
+    parser.add_argument("--pipeline-mb", type=int, default=512)
+    args = parser.parse_args()
+    shell_path = os.path.abspath(args.shell)
+
+    results = {"benchmark": "pty", "shell": shell_path, "time": time.time()}
+    with tempfile.TemporaryDirectory() as root:
+        env = dict(os.environ)
+        env["HOME"] = root
+        env.pop("HISTFILE", None)
+        results["first_prompt_ms"] = first_prompt(shell_path, env, 20)
+
+        with PtyShell(shell_path, env) as shell:
+            shell.wait_prompt()
+            results["round_trip_us"] = {
+                "builtin echo": round_trip(shell, "echo hi", args.runs),
+                "external /bin/true": round_trip(shell, "/bin/true", args.runs),
+            }
+
+        env["PATH"] = make_path(root, args.path_entries) + ":" + env.get("PATH", "/usr/bin")
+        with PtyShell(shell_path, env) as shell:
+            shell.wait_prompt()
+            results["tab_completion_us"] = tab_completion(shell, args.runs)
+            results["tab_completion_us"]["path_entries"] = args.path_entries
+
+        big = os.path.join(root, "big")
+        size = make_big_file(big, args.pipeline_mb)
+        with PtyShell(shell_path, env) as shell:
+            shell.wait_prompt()
+            results["pipelines"] = pipelines(shell, big, size, 3)
+            results["pipelines_input_mb"] = args.pipeline_mb
+
+    text = json.dumps(results, indent=1)
+    print(text)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(text + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
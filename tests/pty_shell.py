@@ -0,0 +1,89 @@
+"""Drive an interactive shell through a pseudo-terminal, as a user at a terminal would."""
+
+import fcntl
+import os
+import pty
+import select
+import signal
+import struct
+import termios
+import time
+
+PROMPT = b"$ "
+
+
+class PtyShell:
+    """The shell started on a new pty. started_at is when it was spawned."""
+
+    def __init__(self, shell, env=None, args=()):
+        self.started_at = time.perf_counter()
+        self.pid, self.fd = pty.fork()
+        if self.pid == 0:
+            # A usual terminal size, so line wrapping is what a user would see
+            fcntl.ioctl(0, termios.TIOCSWINSZ, struct.pack("HHHH", 40, 120, 0, 0))
+            os.execve(shell, [shell, *args], env if env is not None else os.environ)
+        self.output = b""
+
+    def read_until(self, done, timeout=10.0):
+        """Read until done(output read so far) holds and return that output."""
+        deadline = time.monotonic() + timeout
+        buffer = b""
+        while not done(buffer):
+            remaining = deadline - time.monotonic()
+            ready, _, _ = select.select([self.fd], [], [], max(0.0, remaining))
+            if not ready:
+                raise TimeoutError("no match after %.1f s, got %r" % (timeout, buffer[-200:]))
+            try:
+                chunk = os.read(self.fd, 65536)
+            except OSError:
+                chunk = b""
+            if not chunk:
+                raise EOFError("shell exited, got %r" % buffer[-200:])
+            buffer += chunk
+        self.output += buffer
+        return buffer
+
+    def read_text(self, text, timeout=10.0):
+        return self.read_until(lambda buffer: text in buffer, timeout)
+
+    def wait_prompt(self, timeout=10.0):
+        return self.read_until(lambda buffer: buffer.endswith(PROMPT), timeout)
+
+    def drain(self, quiet=0.01):
+        """Read and return whatever arrives until nothing has for quiet seconds."""
+        buffer = b""
+        while select.select([self.fd], [], [], quiet)[0]:
+            try:
+                chunk = os.read(self.fd, 65536)
+            except OSError:
+                break
+            if not chunk:
+                break
+            buffer += chunk
+        self.output += buffer
+        return buffer
+
+    def send(self, data):
+        os.write(self.fd, data if isinstance(data, bytes) else data.encode())
+
+    def run(self, command, timeout=10.0):
+        """Type command and Enter, and return everything up to the next prompt."""
+        self.send(command + "\n")
+        return self.wait_prompt(timeout)
+
+    def alive(self):
+        return os.waitpid(self.pid, os.WNOHANG) == (0, 0)
+
+    def close(self):
+        try:
+            os.kill(self.pid, signal.SIGKILL)
+            os.waitpid(self.pid, 0)
+        except (ProcessLookupError, ChildProcessError):
+            pass
+        os.close(self.fd)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Spawn latency of external commands against the shell's RSS, written as JSON.
+
+The shell is grown by loading ever larger HISTFILEs. At each size /bin/true is timed from Enter
+to the next prompt through the usual posix_spawn path and through the fork path that commands
+with a placement prefix take (`ulimit -c 0 /bin/true`). The posix_spawn time should stay flat
+as RSS grows, while fork pays for copying the page tables.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import sys
+import tempfile
+import time
+
+from pty_shell import PtyShell
+
+PATHS = {"posix_spawn": "/bin/true", "fork": "ulimit -c 0 /bin/true"}
+
+
+def rss_mb(pid):
+    with open("/proc/%d/status" % pid) as status:
+        for line in status:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1]) / 1024
+    return 0.0
+
+
+def write_history(path, entries):
+    with open(path, "w") as history:
+        for n in range(entries):
+            history.write("git commit -m 'change number %d' --author someone%d\n" % (n, n % 97))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True)
+    parser.add_argument("--output", help="write the JSON here as well as to stdout")
+    parser.add_argument("--runs", type=int, default=200)
+    parser.add_argument("--history", type=int, nargs="+", default=[0, 250000, 1000000, 2000000],
+                        help="HISTFILE sizes in lines")
+    args = parser.parse_args()
+    shell_path = os.path.abspath(args.shell)
+
+    results = {"benchmark": "spawn", "shell": shell_path, "time": time.time(), "sizes": []}
+    with tempfile.TemporaryDirectory() as root:
+        for entries in args.history:
+            env = dict(os.environ)
+            env["HOME"] = root
+            env["HISTFILE"] = os.path.join(root, "history")
+            write_history(env["HISTFILE"], entries)
+            with PtyShell(shell_path, env) as shell:
+                shell.wait_prompt(timeout=120)
+                # The first line also takes the loaded history into the suggestion index. Lines
+                # are read with the built-in editor: readline walks its whole history list for
+                # every line it reads, which would hide the spawn cost.
+                shell.run("set -o lineedit", timeout=120)
+                row = {"history_lines": entries, "rss_mb": rss_mb(shell.pid)}
+                for name, command in PATHS.items():
+                    samples = []
+                    for _ in range(args.runs):
+                        start = time.perf_counter()
+                        shell.run(command)
+                        samples.append((time.perf_counter() - start) * 1e6)
+                    row[name + "_us"] = {"median": statistics.median(samples), "min": min(samples)}
+                results["sizes"].append(row)
+
+    text = json.dumps(results, indent=1)
+    print(text)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(text + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Time to the first prompt byte on a pty with a 50k-entry PATH.
+
+PATH is indexed in the background, so the prompt must not wait for it. Commands typed straight
+away are found by looking them up directly, and TAB completes from the index once it is ready.
+"""
+
+import argparse
+import os
+import sys
+import tempfile
+import time
+
+from pty_shell import PtyShell
+
+ENTRIES = 50000
+DIRECTORIES = 10
+
+
+def make_path(root):
+    directories = []
+    for d in range(DIRECTORIES):
+        directory = os.path.join(root, "bin%d" % d)
+        os.mkdir(directory)
+        directories.append(directory)
+        for n in range(ENTRIES // DIRECTORIES):
+            path = os.path.join(directory, "zzcmd%d_%d" % (d, n))
+            os.close(os.open(path, os.O_CREAT | os.O_WRONLY, 0o755))
+    unique = os.path.join(directories[-1], "zzstartup-unique")
+    with open(unique, "w") as script:
+        script.write("#!/bin/sh\necho from-path\n")
+    os.chmod(unique, 0o755)
+    return directories
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--shell", required=True)
+    parser.add_argument("--limit-ms", type=float, default=250.0,
+                        help="fail when the first prompt takes longer")
+    parser.add_argument("--runs", type=int, default=5)
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as root:
+        env = dict(os.environ)
+        env["PATH"] = ":".join(make_path(root) + [env.get("PATH", "/usr/bin:/bin")])
+        env["HOME"] = root
+        env.pop("HISTFILE", None)
+
+        times = []
+        for _ in range(args.runs):
+            with PtyShell(args.shell, env) as shell:
+                shell.read_until(lambda buffer: len(buffer) > 0)
+                times.append((time.perf_counter() - shell.started_at) * 1000)
+                shell.wait_prompt()
+        best = min(times)
+        print("first prompt byte: best %.2f ms, worst %.2f ms over %d runs"
+              % (best, max(times), len(times)))
+
+        failures = 0
+        if best > args.limit_ms:
+            failures += 1
+            print("FAIL first prompt slower than %.0f ms" % args.limit_ms)
+
+        with PtyShell(args.shell, env) as shell:
+            shell.wait_prompt()
+            # Right after the prompt, before the index can be relied on
+            if b"from-path" not in shell.run("zzstartup-unique"):
+                failures += 1
+                print("FAIL command from PATH not found straight after startup")
+            # An early TAB may only offer builtins (the bell); once indexed it must complete
+            indexed_after = None
+            deadline = time.monotonic() + 10
+            while indexed_after is None and time.monotonic() < deadline:
+                shell.send("\x15zzstartup-un\t")
+                try:
+                    shell.read_text(b"zzstartup-unique ", timeout=0.2)
+                    indexed_after = time.perf_counter() - shell.started_at
+                except TimeoutError:
+                    pass
+            if indexed_after is None:
+                failures += 1
+                print("FAIL TAB never completed from PATH")
+            else:
+                print("TAB completed from the index %.0f ms after start" % (indexed_after * 1000))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())